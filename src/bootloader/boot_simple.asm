@@ -1,202 +1,118 @@
 [org 0x7c00]
 bits 16
 
+; Stage 1: load the stage 2 loader (STAGE2_SECTORS sectors from LBA 1, passed
+; in by the Makefile) with BIOS extended reads and jump to it
+
+STAGE2_ADDR equ 0x7E00
+BOOT_TSC equ 0x0500         ; Time stamp at power-on handoff, for stage 2's timing report
+
 start:
+    ; Some BIOSes enter at 07C0:0000 - normalize CS
+    jmp 0x0000:.flush
+.flush:
     ; Set up segments
     xor ax, ax
     mov ds, ax
     mov es, ax
-    mov ss, ax 
+    mov ss, ax
     mov sp, 0x7c00
 
+    mov [boot_drive], dl    ; BIOS passes the boot drive in DL
+    rdtsc
+    mov [BOOT_TSC], eax
+    mov [BOOT_TSC + 4], edx
+
     ; Print startup message
     mov si, msg_start
     call print_both
 
-    ; Load kernel from disk
-    call load_kernel
-
-    ; Enable A20 line
-    call enable_a20
-
-    ; Enter protected mode (32-bit)
-    call enter_protected_mode
+    ; Check for the INT 13h extensions (LBA reads)
+    mov ah, 0x41
+    mov bx, 0x55AA
+    mov dl, [boot_drive]
+    int 0x13
+    jc .no_lba
+    cmp bx, 0xAA55
+    jne .no_lba
+    test cl, 1              ; Bit 0: extended disk access functions
+    jz .no_lba
 
-; Load kernel from disk with retry
-load_kernel:
-    mov si, msg_loading
-    call print_both
-    
     mov byte [disk_tries], 3  ; Try 3 times
 
 .retry:
-    ; Reset disk system
-    mov ah, 0x00
-    mov dl, 0x80    ; Use hard drive instead of floppy
+    mov si, stage2_dap
+    mov ah, 0x42            ; Extended read
+    mov dl, [boot_drive]
     int 0x13
-    
-    ; Load kernel (64 sectors = 32KB to accommodate larger kernel with editor)
-    mov ah, 0x02    ; Read sectors
-    mov al, 64      ; Number of sectors (increased to 64)
-    mov ch, 0x00    ; Cylinder 0
-    mov cl, 0x02    ; Start from sector 2
-    mov dh, 0x00    ; Head 0
-    mov dl, 0x80    ; Hard drive 0
-    
-    ; Set up buffer at 0x10000
-    mov bx, 0x1000
-    mov es, bx
-    mov bx, 0x0000
-    
+    jnc .loaded
+
+    ; Reset the disk system and retry
+    xor ah, ah
+    mov dl, [boot_drive]
     int 0x13
-    jnc .success    ; Jump if no carry (success)
-    
-    ; Retry if failed
     dec byte [disk_tries]
     jnz .retry
-    
-    ; All retries failed
+
     mov si, msg_disk_error
+    jmp .fail
+
+.no_lba:
+    mov si, msg_no_lba
+.fail:
     call print_both
     cli
     hlt
 
-.success:
-    mov si, msg_loaded
-    call print_both
-    ret
-
-; Enable A20 line
-enable_a20:
-    mov si, msg_a20
-    call print_both
-    
-    ; Try fast A20 gate
-    in al, 0x92
-    or al, 2
-    out 0x92, al
-    ret
-
-; Enter 32-bit protected mode
-enter_protected_mode:
-    mov si, msg_pmode
-    call print_both
-    
-    cli
-    lgdt [gdt_descriptor]
-    
-    mov eax, cr0
-    or eax, 1
-    mov cr0, eax
-    
-    jmp CODE_SEG:protected_mode_start
+.loaded:
+    mov dl, [boot_drive]
+    jmp 0x0000:STAGE2_ADDR
 
 ; Print to both VGA and serial
 print_both:
-    call print_vga
-    call print_serial
-    ret
-
-; Print to VGA
-print_vga:
     push si
-.loop:
+.vga:
     lodsb
     or al, al
-    jz .done
+    jz .serial
     mov ah, 0x0e
     int 0x10
-    jmp .loop
-.done:
+    jmp .vga
+.serial:
     pop si
-    ret
-
-; Print to serial
-print_serial:
-.loop:
+.serial_loop:
     lodsb
     or al, al
     jz .done
-    call serial_write
-    jmp .loop
-.done:
-    ret
-
-; Write character to serial
-serial_write:
-    push dx
-    push ax
     mov dx, 0x3FD
+    mov ah, al
 .wait:
     in al, dx
     test al, 0x20
     jz .wait
-    pop ax
+    mov al, ah
     mov dx, 0x3F8
     out dx, al
-    pop dx
+    jmp .serial_loop
+.done:
     ret
 
-bits 32
-protected_mode_start:
-    ; Set up 32-bit segments
-    mov ax, DATA_SEG
-    mov ds, ax
-    mov es, ax
-    mov fs, ax
-    mov gs, ax
-    mov ss, ax
-    mov esp, 0x90000  ; Set up stack
-    
-    ; Copy kernel to 1MB (copying 64 sectors = 32KB)
-    mov esi, 0x10000  ; Source
-    mov edi, 0x100000 ; Destination (1MB)
-    mov ecx, 8192     ; 32KB / 4 = 8192 dwords
-    rep movsd
-    
-    ; Jump to kernel entry point (accounting for ELF header offset)
-    jmp 0x100000
-
-; GDT for 32-bit protected mode
-gdt_start:
-    ; Null descriptor
-    dq 0x0
-    
-    ; Code segment (32-bit)
-    dw 0xFFFF       ; Limit low
-    dw 0x0000       ; Base low
-    db 0x00         ; Base mid
-    db 0x9A         ; Access: Present, Ring 0, Code, Execute/Read
-    db 0xCF         ; Flags: 4KB granularity, 32-bit
-    db 0x00         ; Base high
-    
-    ; Data segment (32-bit)
-    dw 0xFFFF       ; Limit low
-    dw 0x0000       ; Base low
-    db 0x00         ; Base mid
-    db 0x92         ; Access: Present, Ring 0, Data, Read/Write
-    db 0xCF         ; Flags: 4KB granularity, 32-bit
-    db 0x00         ; Base high
-gdt_end:
-
-gdt_descriptor:
-    dw gdt_end - gdt_start - 1
-    dd gdt_start
-
-CODE_SEG equ 0x08
-DATA_SEG equ 0x10
+; Disk address packet for the stage 2 read
+stage2_dap:
+    db 0x10, 0              ; Packet size, reserved
+    dw STAGE2_SECTORS       ; Sectors to read
+    dw STAGE2_ADDR, 0x0000  ; Buffer offset, segment
+    dq 1                    ; Starting LBA
 
 ; Data
+boot_drive db 0
 disk_tries db 0
 
 ; Messages
-msg_start db "PhantomOS Simple Bootloader Starting...", 13, 10, 0
-msg_loading db "Loading kernel from disk...", 13, 10, 0
-msg_loaded db "Kernel loaded successfully", 13, 10, 0
-msg_disk_error db "Disk read error after retries!", 13, 10, 0
-msg_a20 db "Enabling A20 line...", 13, 10, 0
-msg_pmode db "Entering protected mode, jumping to kernel...", 13, 10, 0
+msg_start db "PhantomOS Bootloader", 13, 10, 0
+msg_disk_error db "Disk read error!", 13, 10, 0
+msg_no_lba db "BIOS has no LBA disk support!", 13, 10, 0
 
 ; Boot signature
 times 510 - ($ - $$) db 0
-dw 0xaa55 
+dw 0xaa55
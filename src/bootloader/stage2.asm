@@ -0,0 +1,511 @@
+[org 0x7E00]
+bits 16
+
+; Stage 2: collect the memory map, then load the kernel ELF image above 1MB.
+; Its PT_LOAD segments are read in large chunks with BIOS extended reads into
+; a low bounce buffer and copied to their physical addresses in unreal mode.
+; STAGE2_SECTORS, KERNEL_LBA and PFS_START_LBA are passed in by the Makefile.
+
+E820_MAP equ 0x8800         ; Memory map handed to kernel_main (count + entries)
+E820_MAX_ENTRIES equ 32
+BOOT_TSC equ 0x0500         ; Stage 1 start time stamp
+BOOT_MAGIC equ 0x54424850   ; "PHBT" - tells the kernel the map is at E820_MAP
+
+KERNEL_ADDR equ 0x100000    ; Lowest address a segment may load to
+KERNEL_MAX_SECTORS equ PFS_START_LBA - KERNEL_LBA
+BOUNCE_SEG equ 0x1000       ; Bounce buffer at 0x10000
+CHUNK_SECTORS equ 64        ; Sectors per BIOS read (32KB)
+
+; ELF32 fields checked by the loader
+ELF_MAGIC equ 0x464C457F    ; 0x7F "ELF"
+ELF_CLASS32_LSB equ 0x0101  ; 32-bit, little endian
+ELF_MACHINE_386 equ 3
+ELF_PHDR_SIZE equ 32
+ELF_MAX_PHDRS equ 8
+ELF_PT_LOAD equ 1
+
+stage2_start:
+    mov [boot_drive], dl
+    rdtsc
+    mov [tsc_stage2], eax
+    mov [tsc_stage2 + 4], edx
+
+    ; Collect BIOS E820 memory map for the kernel
+    call detect_memory
+
+    ; Enable A20 line
+    call enable_a20
+    rdtsc
+    mov [tsc_setup], eax
+    mov [tsc_setup + 4], edx
+
+    ; Load kernel from disk
+    call load_kernel
+    rdtsc
+    mov [tsc_loaded], eax
+    mov [tsc_loaded + 4], edx
+
+    call report_timings
+
+    ; Enter protected mode (32-bit)
+    call enter_protected_mode
+
+; Query the BIOS E820 memory map into E820_MAP
+; Layout: dword entry count, then 24-byte entries
+detect_memory:
+    xor ax, ax
+    mov es, ax
+    mov di, E820_MAP + 4
+    xor ebx, ebx
+    xor ebp, ebp            ; Entry count
+
+.next:
+    mov eax, 0xE820
+    mov ecx, 24
+    mov edx, 0x534D4150     ; 'SMAP'
+    mov dword [es:di + 20], 1  ; Valid ACPI 3.0 attribute if BIOS returns 20 bytes
+    int 0x15
+    jc .done                ; Carry = unsupported or end of list
+    cmp eax, 0x534D4150
+    jne .done
+    inc ebp
+    add di, 24
+    test ebx, ebx           ; EBX = 0 means last entry
+    jz .done
+    cmp bp, E820_MAX_ENTRIES
+    jb .next
+
+.done:
+    mov [E820_MAP], ebp
+    ret
+
+; Enable A20 line
+enable_a20:
+    mov si, msg_a20
+    call print_both
+
+    ; Try fast A20 gate
+    in al, 0x92
+    or al, 2
+    out 0x92, al
+    ret
+
+; Read CX sectors at LBA EAX into the bounce buffer, with retries
+read_sectors:
+    mov [dap_count], cx
+    mov [dap_lba], eax
+    mov byte [disk_tries], 3
+
+.retry:
+    mov si, dap
+    mov ah, 0x42            ; Extended read
+    mov dl, [boot_drive]
+    int 0x13
+    jnc .done
+
+    ; Reset the disk system and retry
+    xor ah, ah
+    mov dl, [boot_drive]
+    int 0x13
+    dec byte [disk_tries]
+    jnz .retry
+
+    mov si, msg_disk_error
+    jmp fatal
+
+.done:
+    ret
+
+; Load the kernel ELF image: each PT_LOAD segment is copied to its physical
+; address and the rest of its memory size (.bss) is zeroed. Nothing else in
+; the file (symbols, section headers) is read.
+load_kernel:
+    mov si, msg_loading
+    call print_both
+
+    ; The ELF header and program headers must fit in the first sector
+    mov eax, KERNEL_LBA
+    mov cx, 1
+    call read_sectors
+    mov ax, BOUNCE_SEG
+    mov fs, ax
+    cmp dword [fs:0], ELF_MAGIC
+    jne bad_kernel
+    cmp word [fs:4], ELF_CLASS32_LSB
+    jne bad_kernel
+    cmp word [fs:18], ELF_MACHINE_386
+    jne bad_kernel
+    cmp word [fs:42], ELF_PHDR_SIZE
+    jne bad_kernel
+    mov eax, [fs:24]        ; e_entry
+    mov [kernel_entry], eax
+
+    movzx ecx, word [fs:44] ; e_phnum
+    test cx, cx
+    jz bad_kernel
+    cmp cx, ELF_MAX_PHDRS
+    ja bad_kernel
+    mov [phdr_count], cx
+    shl cx, 5               ; Bytes of program headers
+    mov esi, [fs:28]        ; e_phoff
+    lea eax, [esi + ecx]
+    cmp eax, 512
+    ja bad_kernel
+
+    ; Keep the program headers; the bounce buffer is reused for the segments
+    mov di, phdr_table
+.copy_phdrs:
+    mov al, [fs:si]
+    mov [di], al
+    inc si
+    inc di
+    loop .copy_phdrs
+
+    mov bx, phdr_table
+    mov cx, [phdr_count]
+.segment:
+    cmp dword [bx], ELF_PT_LOAD
+    jne .next
+    push bx
+    push cx
+    call load_segment
+    pop cx
+    pop bx
+.next:
+    add bx, ELF_PHDR_SIZE
+    loop .segment
+
+    mov si, msg_loaded
+    call print_both
+    ret
+
+bad_kernel:
+    mov si, msg_bad_kernel
+    jmp fatal
+
+; Load the segment described by the program header at BX
+load_segment:
+    mov eax, [bx + 12]      ; p_paddr
+    cmp eax, KERNEL_ADDR
+    jb bad_kernel
+    mov [seg_addr], eax
+    mov eax, [bx + 4]       ; p_offset
+    mov [seg_offset], eax
+    mov eax, [bx + 16]      ; p_filesz
+    mov [seg_left], eax
+    add [kernel_bytes], eax
+    add eax, [seg_offset]
+    cmp eax, KERNEL_MAX_SECTORS * 512
+    ja bad_kernel           ; The file data must end before the file system
+    mov eax, [bx + 20]      ; p_memsz
+    sub eax, [bx + 16]
+    jb bad_kernel
+    mov [seg_zero], eax
+    add [kernel_zeroed], eax
+
+.chunk:
+    cmp dword [seg_left], 0
+    je .zero
+
+    ; Read up to CHUNK_SECTORS from the sector holding the next byte
+    mov eax, [seg_offset]
+    mov edx, eax
+    and edx, 511            ; Bytes to skip in the first sector
+    shr eax, 9
+    add eax, KERNEL_LBA
+    mov ecx, [seg_left]
+    add ecx, edx
+    add ecx, 511
+    shr ecx, 9
+    cmp ecx, CHUNK_SECTORS
+    jbe .read
+    mov ecx, CHUNK_SECTORS
+.read:
+    push edx
+    push cx
+    call read_sectors
+    pop cx
+    pop edx
+
+    movzx ecx, cx
+    shl ecx, 9
+    sub ecx, edx
+    cmp ecx, [seg_left]
+    jbe .copy
+    mov ecx, [seg_left]
+.copy:
+    add [seg_offset], ecx
+    sub [seg_left], ecx
+
+    ; Copy the chunk above 1MB; the BIOS may have reset the segment
+    ; limits, so enter unreal mode again each time
+    call enter_unreal
+    lea esi, [edx + BOUNCE_SEG * 16]
+    mov edi, [seg_addr]
+    cld
+    mov edx, ecx
+    shr ecx, 2
+    a32 rep movsd
+    mov ecx, edx
+    and ecx, 3
+    a32 rep movsb
+    mov [seg_addr], edi
+    jmp .chunk
+
+.zero:
+    ; Zero the rest of the segment (.bss) in one pass
+    call enter_unreal
+    mov edi, [seg_addr]
+    mov ecx, [seg_zero]
+    xor eax, eax
+    cld
+    mov edx, ecx
+    shr ecx, 2
+    a32 rep stosd
+    mov ecx, edx
+    and ecx, 3
+    a32 rep stosb
+    ret
+
+; Load DS and ES with 4GB limits, then return to real mode keeping them
+enter_unreal:
+    push ds
+    push es
+    cli
+    lgdt [gdt_descriptor]
+    mov eax, cr0
+    or al, 1
+    mov cr0, eax
+    jmp .pmode              ; Flush the prefetch queue
+.pmode:
+    mov bx, DATA_SEG
+    mov ds, bx
+    mov es, bx
+    and al, 0xFE
+    mov cr0, eax
+    pop es
+    pop ds
+    sti
+    ret
+
+; Print how long each boot stage took (in thousands of TSC cycles) to serial
+report_timings:
+    mov si, msg_timing_stage1
+    call print_serial
+    mov eax, [tsc_stage2]
+    mov edx, [tsc_stage2 + 4]
+    mov ebx, BOOT_TSC
+    call print_elapsed
+
+    mov si, msg_timing_setup
+    call print_serial
+    mov eax, [tsc_setup]
+    mov edx, [tsc_setup + 4]
+    mov ebx, tsc_stage2
+    call print_elapsed
+
+    mov si, msg_timing_load
+    call print_serial
+    mov eax, [tsc_loaded]
+    mov edx, [tsc_loaded + 4]
+    mov ebx, tsc_setup
+    call print_elapsed
+
+    mov si, msg_timing_size
+    call print_serial
+    mov eax, [kernel_bytes]
+    shr eax, 10
+    call print_decimal
+    mov si, msg_timing_bss
+    call print_serial
+    mov eax, [kernel_zeroed]
+    shr eax, 10
+    call print_decimal
+    mov si, msg_timing_end
+    call print_serial
+    ret
+
+; Print (EDX:EAX - the time stamp at [BX]) / 1000
+print_elapsed:
+    sub eax, [bx]
+    sbb edx, [bx + 4]
+    mov ecx, 1000
+    div ecx
+    ; Fall through
+
+; Print EAX in decimal to serial
+print_decimal:
+    mov ecx, 10
+    xor bx, bx
+.divide:
+    xor edx, edx
+    div ecx
+    push dx
+    inc bx
+    test eax, eax
+    jnz .divide
+.print:
+    pop ax
+    add al, '0'
+    call serial_write
+    dec bx
+    jnz .print
+    ret
+
+; Print a message and stop
+fatal:
+    call print_both
+    cli
+    hlt
+
+; Enter 32-bit protected mode
+enter_protected_mode:
+    mov si, msg_pmode
+    call print_both
+
+    cli
+    lgdt [gdt_descriptor]
+
+    mov eax, cr0
+    or eax, 1
+    mov cr0, eax
+
+    jmp CODE_SEG:protected_mode_start
+
+; Print to both VGA and serial
+print_both:
+    call print_vga
+    call print_serial
+    ret
+
+; Print to VGA
+print_vga:
+    push si
+.loop:
+    lodsb
+    or al, al
+    jz .done
+    mov ah, 0x0e
+    int 0x10
+    jmp .loop
+.done:
+    pop si
+    ret
+
+; Print to serial
+print_serial:
+.loop:
+    lodsb
+    or al, al
+    jz .done
+    call serial_write
+    jmp .loop
+.done:
+    ret
+
+; Write character to serial
+serial_write:
+    push dx
+    push ax
+    mov dx, 0x3FD
+.wait:
+    in al, dx
+    test al, 0x20
+    jz .wait
+    pop ax
+    mov dx, 0x3F8
+    out dx, al
+    pop dx
+    ret
+
+bits 32
+protected_mode_start:
+    ; Set up 32-bit segments
+    mov ax, DATA_SEG
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+    mov esp, 0x90000  ; Set up stack
+
+    ; Identify this loader in EAX and pass the memory map in EBX, the way
+    ; Multiboot loaders pass their magic and information
+    mov eax, BOOT_MAGIC
+    mov ebx, E820_MAP
+
+    ; Jump to the kernel's ELF entry point
+    mov ecx, [kernel_entry]
+    jmp ecx
+
+; GDT for 32-bit protected mode (and the unreal mode segment limits)
+gdt_start:
+    ; Null descriptor
+    dq 0x0
+
+    ; Code segment (32-bit)
+    dw 0xFFFF       ; Limit low
+    dw 0x0000       ; Base low
+    db 0x00         ; Base mid
+    db 0x9A         ; Access: Present, Ring 0, Code, Execute/Read
+    db 0xCF         ; Flags: 4KB granularity, 32-bit
+    db 0x00         ; Base high
+
+    ; Data segment (32-bit)
+    dw 0xFFFF       ; Limit low
+    dw 0x0000       ; Base low
+    db 0x00         ; Base mid
+    db 0x92         ; Access: Present, Ring 0, Data, Read/Write
+    db 0xCF         ; Flags: 4KB granularity, 32-bit
+    db 0x00         ; Base high
+gdt_end:
+
+gdt_descriptor:
+    dw gdt_end - gdt_start - 1
+    dd gdt_start
+
+CODE_SEG equ 0x08
+DATA_SEG equ 0x10
+
+; Disk address packet for extended reads into the bounce buffer
+dap:
+    db 0x10, 0              ; Packet size, reserved
+dap_count:
+    dw 0                    ; Sectors to read
+    dw 0x0000, BOUNCE_SEG   ; Buffer offset, segment
+dap_lba:
+    dq 0                    ; Starting LBA
+
+; Data
+boot_drive db 0
+disk_tries db 0
+kernel_entry dd 0
+kernel_bytes dd 0           ; File bytes loaded
+kernel_zeroed dd 0          ; .bss bytes zeroed
+phdr_count dw 0
+seg_offset dd 0
+seg_addr dd 0
+seg_left dd 0
+seg_zero dd 0
+tsc_stage2 dq 0
+tsc_setup dq 0
+tsc_loaded dq 0
+
+phdr_table times ELF_MAX_PHDRS * ELF_PHDR_SIZE db 0
+
+; Messages
+msg_loading db "Loading kernel from disk...", 13, 10, 0
+msg_loaded db "Kernel loaded successfully", 13, 10, 0
+msg_disk_error db "Disk read error!", 13, 10, 0
+msg_bad_kernel db "Invalid kernel ELF image!", 13, 10, 0
+msg_a20 db "Enabling A20 line...", 13, 10, 0
+msg_pmode db "Entering protected mode...", 13, 10, 0
+msg_timing_stage1 db "Boot timings (K cycles): stage 1 ", 0
+msg_timing_setup db ", memory map + A20 ", 0
+msg_timing_load db ", kernel load ", 0
+msg_timing_size db " (", 0
+msg_timing_bss db " KB read, ", 0
+msg_timing_end db " KB zeroed)", 13, 10, 0
+
+; Pad to the sectors stage 1 loads
+times STAGE2_SECTORS * 512 - ($ - $$) db 0
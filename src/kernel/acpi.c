@@ -0,0 +1,199 @@
+// PhantomOS ACPI Tables
+// Only as much ACPI as interrupt routing needs: find the RSDP, walk the
+// RSDT/XSDT to the MADT ("APIC") and record the local APIC address, the
+// processors, the IOAPICs and the ISA interrupt source overrides. The
+// kernel runs without paging, so table addresses are used as they are.
+
+#include "acpi.h"
+
+#define EBDA_SEGMENT_PTR 0x40E      // BIOS data area: EBDA segment
+#define BIOS_ROM_START 0xE0000
+#define BIOS_ROM_END 0x100000
+
+#define MADT_PCAT_COMPAT 0x1        // MADT flags: dual 8259s installed
+
+// MADT entry types
+#define MADT_LAPIC 0
+#define MADT_IOAPIC 1
+#define MADT_OVERRIDE 2
+#define MADT_LAPIC_ADDRESS 5
+#define MADT_LAPIC_ENABLED 0x1
+
+typedef struct {
+    char signature[8];              // "RSD PTR "
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;               // 0 for ACPI 1.0, 2 if the fields below exist
+    uint32_t rsdt_address;
+    uint32_t length;
+    uint64_t xsdt_address;
+    uint8_t extended_checksum;
+    uint8_t reserved[3];
+} __attribute__((packed)) acpi_rsdp_t;
+
+typedef struct {
+    char signature[4];
+    uint32_t length;                // Including this header
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed)) acpi_header_t;
+
+typedef struct {
+    acpi_header_t header;
+    uint32_t lapic_address;
+    uint32_t flags;
+} __attribute__((packed)) acpi_madt_header_t;
+
+static acpi_madt_t madt;
+static int madt_found = 0;
+
+static uint8_t acpi_checksum(const void* data, uint32_t length) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < length; i++) {
+        sum += bytes[i];
+    }
+    return sum;
+}
+
+static int acpi_signature_is(const char* signature, const char* name, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        if (signature[i] != name[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// The RSDP sits on a 16-byte boundary in the given range
+static acpi_rsdp_t* acpi_scan_rsdp(uint32_t start, uint32_t end) {
+    for (uint32_t address = start; address + 20 <= end; address += 16) {
+        acpi_rsdp_t* rsdp = (acpi_rsdp_t*)address;
+        if (acpi_signature_is(rsdp->signature, "RSD PTR ", 8) && acpi_checksum(rsdp, 20) == 0) {
+            return rsdp;
+        }
+    }
+    return NULL;
+}
+
+// First 1KB of the EBDA, then the BIOS ROM
+static acpi_rsdp_t* acpi_find_rsdp(void) {
+    uint32_t ebda = (uint32_t)(*(volatile uint16_t*)EBDA_SEGMENT_PTR) << 4;
+    acpi_rsdp_t* rsdp = NULL;
+    if (ebda >= 0x80000 && ebda < 0xA0000) {
+        rsdp = acpi_scan_rsdp(ebda, ebda + 1024);
+    }
+    return rsdp ? rsdp : acpi_scan_rsdp(BIOS_ROM_START, BIOS_ROM_END);
+}
+
+static acpi_header_t* acpi_check_table(uint32_t address, const char* signature) {
+    acpi_header_t* table = (acpi_header_t*)address;
+    if (!address || !acpi_signature_is(table->signature, signature, 4)) {
+        return NULL;
+    }
+    return acpi_checksum(table, table->length) == 0 ? table : NULL;
+}
+
+// Look `signature` up in the RSDT (32-bit entries) or XSDT (64-bit entries)
+static acpi_header_t* acpi_find_table(acpi_rsdp_t* rsdp, const char* signature) {
+    if (rsdp->revision >= 2 && rsdp->xsdt_address && (rsdp->xsdt_address >> 32) == 0) {
+        acpi_header_t* xsdt = acpi_check_table((uint32_t)rsdp->xsdt_address, "XSDT");
+        if (xsdt) {
+            uint32_t entries = (xsdt->length - sizeof(acpi_header_t)) / 8;
+            uint64_t* tables = (uint64_t*)(xsdt + 1);
+            for (uint32_t i = 0; i < entries; i++) {
+                if ((tables[i] >> 32) != 0) {
+                    continue;
+                }
+                acpi_header_t* table = acpi_check_table((uint32_t)tables[i], signature);
+                if (table) {
+                    return table;
+                }
+            }
+            return NULL;
+        }
+    }
+
+    acpi_header_t* rsdt = acpi_check_table(rsdp->rsdt_address, "RSDT");
+    if (!rsdt) {
+        return NULL;
+    }
+    uint32_t entries = (rsdt->length - sizeof(acpi_header_t)) / 4;
+    uint32_t* tables = (uint32_t*)(rsdt + 1);
+    for (uint32_t i = 0; i < entries; i++) {
+        acpi_header_t* table = acpi_check_table(tables[i], signature);
+        if (table) {
+            return table;
+        }
+    }
+    return NULL;
+}
+
+static void acpi_parse_madt(acpi_madt_header_t* header) {
+    memset(&madt, 0, sizeof(madt));
+    madt.lapic_address = header->lapic_address;
+    madt.legacy_pics = (header->flags & MADT_PCAT_COMPAT) != 0;
+    for (uint32_t irq = 0; irq < ACPI_ISA_IRQS; irq++) {
+        madt.irq_gsi[irq] = irq;    // Identity unless overridden
+    }
+
+    uint8_t* entry = (uint8_t*)(header + 1);
+    uint8_t* end = (uint8_t*)header + header->header.length;
+    while (entry + 2 <= end && entry[1] >= 2 && entry + entry[1] <= end) {
+        switch (entry[0]) {
+        case MADT_LAPIC:
+            if ((*(uint32_t*)(entry + 4) & MADT_LAPIC_ENABLED) && madt.cpu_count < ACPI_MAX_CPUS) {
+                madt.cpu_apic_ids[madt.cpu_count++] = entry[3];
+            }
+            break;
+        case MADT_IOAPIC:
+            if (madt.ioapic_count < ACPI_MAX_IOAPICS) {
+                acpi_ioapic_t* ioapic = &madt.ioapics[madt.ioapic_count++];
+                ioapic->id = entry[2];
+                ioapic->address = *(uint32_t*)(entry + 4);
+                ioapic->gsi_base = *(uint32_t*)(entry + 8);
+            }
+            break;
+        case MADT_OVERRIDE:
+            // Bus 0 is ISA
+            if (entry[2] == 0 && entry[3] < ACPI_ISA_IRQS) {
+                madt.irq_gsi[entry[3]] = *(uint32_t*)(entry + 4);
+                madt.irq_flags[entry[3]] = *(uint16_t*)(entry + 8);
+            }
+            break;
+        case MADT_LAPIC_ADDRESS:
+            if ((*(uint64_t*)(entry + 4) >> 32) == 0) {
+                madt.lapic_address = (uint32_t)*(uint64_t*)(entry + 4);
+            }
+            break;
+        }
+        entry += entry[1];
+    }
+}
+
+int acpi_init(void) {
+    madt_found = 0;
+
+    acpi_rsdp_t* rsdp = acpi_find_rsdp();
+    if (!rsdp) {
+        return -1;
+    }
+    acpi_madt_header_t* header = (acpi_madt_header_t*)acpi_find_table(rsdp, "APIC");
+    if (!header) {
+        return -1;
+    }
+
+    acpi_parse_madt(header);
+    madt_found = 1;
+    return 0;
+}
+
+// The parsed MADT, or NULL if acpi_init found none
+const acpi_madt_t* acpi_get_madt(void) {
+    return madt_found ? &madt : NULL;
+}
@@ -0,0 +1,39 @@
+#ifndef ACPI_H
+#define ACPI_H
+
+#include "kernel.h"
+
+#define ACPI_MAX_CPUS 16
+#define ACPI_MAX_IOAPICS 4
+#define ACPI_ISA_IRQS 16
+
+// Interrupt source override flags (MPS INTI flags)
+#define ACPI_POLARITY_MASK 0x3
+#define ACPI_POLARITY_LOW 0x3
+#define ACPI_TRIGGER_MASK 0xC
+#define ACPI_TRIGGER_LEVEL 0xC
+
+typedef struct {
+    uint8_t id;
+    uint32_t address;
+    uint32_t gsi_base;              // First global system interrupt it serves
+} acpi_ioapic_t;
+
+// What the MADT says about the interrupt hardware
+typedef struct {
+    uint32_t lapic_address;
+    int legacy_pics;                // 8259s present (PC-AT compatible)
+    uint32_t cpu_count;
+    uint8_t cpu_apic_ids[ACPI_MAX_CPUS];
+    uint32_t ioapic_count;
+    acpi_ioapic_t ioapics[ACPI_MAX_IOAPICS];
+    uint32_t irq_gsi[ACPI_ISA_IRQS];    // ISA IRQ -> global system interrupt
+    uint16_t irq_flags[ACPI_ISA_IRQS];  // Polarity/trigger, 0 for ISA defaults
+} acpi_madt_t;
+
+// Finds the RSDP in the BIOS areas and reads the MADT from the RSDT (or
+// an XSDT below 4GB). Returns -1 if there is no ACPI or no MADT.
+int acpi_init(void);
+const acpi_madt_t* acpi_get_madt(void);
+
+#endif // ACPI_H
@@ -0,0 +1,258 @@
+// PhantomOS APIC Driver
+// Replaces the 8259 PIC when the MADT lists a local APIC and an IOAPIC.
+// Each ISA IRQ is routed, following the MADT's interrupt source overrides,
+// to IRQ_VECTOR(irq) on the boot CPU, so handlers do not care which
+// controller delivered them; acknowledging is a single local APIC write.
+// The local APIC timer can take over the tick from the PIT.
+
+#include "apic.h"
+#include "acpi.h"
+#include "timer.h"
+#include "spinlock.h"
+
+// Local APIC registers (offsets from the MMIO base)
+#define LAPIC_ID 0x020
+#define LAPIC_TPR 0x080
+#define LAPIC_EOI 0x0B0
+#define LAPIC_SVR 0x0F0
+#define LAPIC_ESR 0x280
+#define LAPIC_ICR_LOW 0x300
+#define LAPIC_ICR_HIGH 0x310
+#define LAPIC_LVT_TIMER 0x320
+#define LAPIC_LVT_LINT0 0x350
+#define LAPIC_LVT_LINT1 0x360
+#define LAPIC_LVT_ERROR 0x370
+#define LAPIC_TIMER_INITIAL 0x380
+#define LAPIC_TIMER_CURRENT 0x390
+#define LAPIC_TIMER_DIVIDE 0x3E0
+
+#define LAPIC_SVR_ENABLE 0x100
+#define LAPIC_LVT_MASKED 0x10000
+#define LAPIC_LVT_NMI 0x400
+#define LAPIC_TIMER_PERIODIC 0x20000
+#define LAPIC_DIVIDE_BY_16 0x3
+#define LAPIC_CALIBRATE_MS 10
+
+// Interrupt command register: delivery modes, level assert, send status
+#define LAPIC_ICR_FIXED 0x000
+#define LAPIC_ICR_INIT 0x500
+#define LAPIC_ICR_STARTUP 0x600
+#define LAPIC_ICR_ASSERT 0x4000
+#define LAPIC_ICR_PENDING 0x1000
+#define LAPIC_ICR_TIMEOUT 100000
+
+#define IA32_APIC_BASE_MSR 0x1B
+#define IA32_APIC_BASE_ENABLE 0x800
+
+// IOAPIC registers: select with IOREGSEL, access through IOWIN
+#define IOAPIC_IOREGSEL 0x00
+#define IOAPIC_IOWIN 0x10
+#define IOAPIC_VERSION 0x01
+#define IOAPIC_REDIRECTION 0x10     // Two registers per pin
+
+#define IOAPIC_ACTIVE_LOW 0x2000
+#define IOAPIC_LEVEL 0x8000
+#define IOAPIC_MASKED 0x10000
+
+static int apic_active = 0;
+static volatile uint32_t* lapic = NULL;
+static uint32_t ioapic_count = 0;
+static uint32_t ioapic_pins[ACPI_MAX_IOAPICS];
+static uint32_t lapic_timer_count = 0;   // Initial count for TIMER_HZ, once calibrated
+static spinlock_t ioapic_lock = SPINLOCK_INIT;   // IOREGSEL/IOWIN pairs
+
+static uint32_t lapic_read(uint32_t reg) {
+    return lapic[reg / 4];
+}
+
+static void lapic_write(uint32_t reg, uint32_t value) {
+    lapic[reg / 4] = value;
+}
+
+static uint32_t ioapic_read(uint32_t base, uint32_t reg) {
+    *(volatile uint32_t*)(base + IOAPIC_IOREGSEL) = reg;
+    return *(volatile uint32_t*)(base + IOAPIC_IOWIN);
+}
+
+static void ioapic_write(uint32_t base, uint32_t reg, uint32_t value) {
+    *(volatile uint32_t*)(base + IOAPIC_IOREGSEL) = reg;
+    *(volatile uint32_t*)(base + IOAPIC_IOWIN) = value;
+}
+
+static int cpu_has_apic(void) {
+    // CPUID exists if the ID flag (bit 21) in EFLAGS can be toggled
+    uint32_t before, after;
+    asm volatile ("pushf; pop %0; mov %0, %1; xor $0x200000, %1; push %1; popf; pushf; pop %1; push %0; popf"
+                  : "=&r"(before), "=&r"(after));
+    if (!((before ^ after) & 0x200000)) {
+        return 0;
+    }
+
+    uint32_t eax = 1, ebx, ecx, edx;
+    asm volatile ("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    return (edx & 0x200) != 0;
+}
+
+// Find the IOAPIC serving an ISA IRQ and the pin it arrives on
+static int ioapic_lookup(uint32_t irq, uint32_t* base, uint32_t* pin) {
+    const acpi_madt_t* madt = acpi_get_madt();
+    uint32_t gsi = madt->irq_gsi[irq];
+    for (uint32_t i = 0; i < ioapic_count; i++) {
+        if (gsi >= madt->ioapics[i].gsi_base && gsi < madt->ioapics[i].gsi_base + ioapic_pins[i]) {
+            *base = madt->ioapics[i].address;
+            *pin = gsi - madt->ioapics[i].gsi_base;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Enable this CPU's local APIC (every CPU runs this for itself)
+void lapic_init_cpu(void) {
+    uint32_t low, high;
+    asm volatile ("rdmsr" : "=a"(low), "=d"(high) : "c"(IA32_APIC_BASE_MSR));
+    if (!(low & IA32_APIC_BASE_ENABLE)) {
+        low |= IA32_APIC_BASE_ENABLE;
+        asm volatile ("wrmsr" : : "a"(low), "d"(high), "c"(IA32_APIC_BASE_MSR));
+    }
+
+    // Devices come through the IOAPIC now, not the PIC on LINT0; keep NMIs
+    lapic_write(LAPIC_LVT_LINT0, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_LVT_LINT1, LAPIC_LVT_NMI);
+    lapic_write(LAPIC_LVT_ERROR, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_ESR, 0);
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | SPURIOUS_VECTOR);
+    lapic_write(LAPIC_EOI, 0);
+}
+
+int apic_init(void) {
+    const acpi_madt_t* madt = acpi_get_madt();
+    if (!madt || !madt->lapic_address || madt->ioapic_count == 0 || !cpu_has_apic()) {
+        return -1;
+    }
+
+    lapic = (volatile uint32_t*)madt->lapic_address;
+    lapic_init_cpu();
+
+    ioapic_count = madt->ioapic_count;
+    for (uint32_t i = 0; i < ioapic_count; i++) {
+        ioapic_pins[i] = ((ioapic_read(madt->ioapics[i].address, IOAPIC_VERSION) >> 16) & 0xFF) + 1;
+    }
+
+    // IRQ2 is the PIC cascade; the PIT usually shows up on GSI 2 instead
+    uint32_t destination = lapic_id() << 24;
+    for (uint32_t irq = 0; irq < IRQ_COUNT; irq++) {
+        uint32_t base, pin;
+        if (irq == 2 || ioapic_lookup(irq, &base, &pin) != 0) {
+            continue;
+        }
+
+        // ISA lines default to active high and edge triggered
+        uint32_t entry = IRQ_VECTOR(irq) | IOAPIC_MASKED;
+        uint16_t flags = madt->irq_flags[irq];
+        if ((flags & ACPI_POLARITY_MASK) == ACPI_POLARITY_LOW) {
+            entry |= IOAPIC_ACTIVE_LOW;
+        }
+        if ((flags & ACPI_TRIGGER_MASK) == ACPI_TRIGGER_LEVEL) {
+            entry |= IOAPIC_LEVEL;
+        }
+        ioapic_write(base, IOAPIC_REDIRECTION + 2 * pin + 1, destination);
+        ioapic_write(base, IOAPIC_REDIRECTION + 2 * pin, entry);
+    }
+
+    apic_active = 1;
+    irq_use_apic();
+    return 0;
+}
+
+int apic_enabled(void) {
+    return apic_active;
+}
+
+uint32_t lapic_id(void) {
+    return lapic_read(LAPIC_ID) >> 24;
+}
+
+void lapic_eoi(void) {
+    lapic_write(LAPIC_EOI, 0);
+}
+
+// Send an interprocessor interrupt; -1 if the APIC never accepted it
+static int lapic_send(uint32_t apic_id, uint32_t command) {
+    if (!apic_active) {
+        return -1;
+    }
+    lapic_write(LAPIC_ICR_HIGH, apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, command);
+    for (uint32_t i = 0; i < LAPIC_ICR_TIMEOUT; i++) {
+        if (!(lapic_read(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING)) {
+            return 0;
+        }
+        asm volatile ("pause");
+    }
+    return -1;
+}
+
+int lapic_send_ipi(uint32_t apic_id, uint32_t vector) {
+    return lapic_send(apic_id, LAPIC_ICR_ASSERT | LAPIC_ICR_FIXED | vector);
+}
+
+// INIT puts the target into wait-for-SIPI; STARTUP starts it in real mode
+// at page:0000 (page = physical address >> 12)
+int lapic_send_init(uint32_t apic_id) {
+    return lapic_send(apic_id, LAPIC_ICR_ASSERT | LAPIC_ICR_INIT);
+}
+
+int lapic_send_startup(uint32_t apic_id, uint32_t page) {
+    return lapic_send(apic_id, LAPIC_ICR_STARTUP | (page & 0xFF));
+}
+
+void ioapic_set_masked(uint32_t irq, int masked) {
+    uint32_t base, pin;
+    if (!apic_active || irq >= IRQ_COUNT || ioapic_lookup(irq, &base, &pin) != 0) {
+        return;
+    }
+    uint32_t irq_state = spin_lock_irqsave(&ioapic_lock);
+    uint32_t entry = ioapic_read(base, IOAPIC_REDIRECTION + 2 * pin);
+    entry = masked ? entry | IOAPIC_MASKED : entry & ~IOAPIC_MASKED;
+    ioapic_write(base, IOAPIC_REDIRECTION + 2 * pin, entry);
+    spin_unlock_irqrestore(&ioapic_lock, irq_state);
+}
+
+uint32_t ioapic_get_count(void) {
+    return ioapic_count;
+}
+
+// Count the timer down for LAPIC_CALIBRATE_MS of the monotonic clock
+static uint32_t lapic_timer_calibrate(uint32_t hz) {
+    lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_DIVIDE_BY_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_TIMER_INITIAL, 0xFFFFFFFF);
+
+    uint64_t end = timer_monotonic_ns() + LAPIC_CALIBRATE_MS * 1000000ULL;
+    while (timer_monotonic_ns() < end) {
+    }
+    uint32_t elapsed = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CURRENT);
+    lapic_write(LAPIC_TIMER_INITIAL, 0);
+
+    return elapsed / LAPIC_CALIBRATE_MS * 1000 / hz;
+}
+
+int lapic_timer_start(uint32_t hz) {
+    if (!apic_active) {
+        return -1;
+    }
+    if (!lapic_timer_count) {
+        lapic_timer_count = lapic_timer_calibrate(hz);
+        if (!lapic_timer_count) {
+            return -1;
+        }
+    }
+
+    lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_DIVIDE_BY_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_PERIODIC | LAPIC_TIMER_VECTOR);
+    lapic_write(LAPIC_TIMER_INITIAL, lapic_timer_count);
+    return 0;
+}
@@ -0,0 +1,31 @@
+#ifndef APIC_H
+#define APIC_H
+
+#include "kernel.h"
+#include "idt.h"
+
+#define LAPIC_TIMER_VECTOR LOCAL_VECTOR_BASE
+
+// Local APIC and IOAPIC, set up from the ACPI MADT (acpi_init first).
+// apic_init returns -1 when either is missing; the 8259 PIC stays in
+// charge then. Otherwise ISA IRQs are routed through the IOAPIC to the
+// same vectors the PIC used, all masked until irq_register.
+int apic_init(void);
+int apic_enabled(void);
+void lapic_init_cpu(void);
+uint32_t lapic_id(void);
+void lapic_eoi(void);
+void ioapic_set_masked(uint32_t irq, int masked);
+uint32_t ioapic_get_count(void);
+
+// Interprocessor interrupts: a vector, or the INIT/STARTUP pair that boots
+// an application processor
+int lapic_send_ipi(uint32_t apic_id, uint32_t vector);
+int lapic_send_init(uint32_t apic_id);
+int lapic_send_startup(uint32_t apic_id, uint32_t page);
+
+// Periodic local APIC timer on LAPIC_TIMER_VECTOR, calibrated once against
+// the TSC clock (timer_monotonic_ns); -1 without an APIC
+int lapic_timer_start(uint32_t hz);
+
+#endif // APIC_H
@@ -0,0 +1,563 @@
+// PhantomOS ATA Driver
+// Primary master drive with 28-bit LBA addressing. Transfers are queued in
+// LBA order and adjacent ones are merged into a single command, which runs as
+// a PIIX bus-master DMA transfer when the IDE controller supports it and as
+// polled PIO otherwise. DMA completion is signalled by IRQ14, or found by
+// polling the bus-master status when interrupts are off.
+
+#include "ata.h"
+#include "idt.h"
+#include "io.h"
+#include "pci.h"
+
+// Primary and secondary bus ports
+#define ATA_IO_BASE 0x1F0
+#define ATA_CONTROL 0x3F6
+#define ATA_SECONDARY_IO_BASE 0x170
+
+// Task file registers (offsets from ATA_IO_BASE)
+#define ATA_REG_DATA 0
+#define ATA_REG_ERROR 1
+#define ATA_REG_SECCOUNT 2
+#define ATA_REG_LBA_LOW 3
+#define ATA_REG_LBA_MID 4
+#define ATA_REG_LBA_HIGH 5
+#define ATA_REG_DRIVE 6
+#define ATA_REG_STATUS 7
+#define ATA_REG_COMMAND 7
+
+// Status bits
+#define ATA_SR_BSY 0x80
+#define ATA_SR_DRDY 0x40
+#define ATA_SR_DF 0x20
+#define ATA_SR_DRQ 0x08
+#define ATA_SR_ERR 0x01
+
+// Commands
+#define ATA_CMD_READ_SECTORS 0x20
+#define ATA_CMD_WRITE_SECTORS 0x30
+#define ATA_CMD_READ_DMA 0xC8
+#define ATA_CMD_WRITE_DMA 0xCA
+#define ATA_CMD_CACHE_FLUSH 0xE7
+#define ATA_CMD_IDENTIFY 0xEC
+
+#define ATA_CONTROL_NIEN 0x02     // Disable drive interrupts (PIO polls)
+#define ATA_MAX_LBA28 0x0FFFFFFF
+#define ATA_TIMEOUT 1000000       // Status polls before giving up
+#define ATA_IDENTIFY_DMA 0x0100   // IDENTIFY word 49: DMA supported
+
+// Bus-master IDE registers (offsets from BAR4, primary channel)
+#define BM_COMMAND 0
+#define BM_STATUS 2
+#define BM_PRDT 4
+
+#define BM_CMD_START 0x01
+#define BM_CMD_READ 0x08          // Device to memory
+#define BM_SR_ACTIVE 0x01
+#define BM_SR_ERROR 0x02
+#define BM_SR_IRQ 0x04
+#define IDE_PROG_IF_NATIVE 0x01   // Primary channel not at the legacy ports
+#define IDE_PROG_IF_BUS_MASTER 0x80
+
+// Physical region descriptors: a region may not cross a 64KB boundary, and
+// each sector of a merged command may straddle one
+#define PRD_EOT 0x8000
+#define PRD_BOUNDARY 0x10000
+#define ATA_MAX_PRDS (2 * ATA_MAX_SECTORS)
+
+#define ATA_PRIMARY_IRQ 14
+#define ATA_SECONDARY_IRQ 15
+
+typedef struct {
+    uint32_t address;
+    uint16_t byte_count;            // 0 means 64KB
+    uint16_t flags;
+} ata_prd_t;
+
+typedef struct ata_request {
+    uint32_t lba;
+    uint32_t count;
+    uint8_t* buffer;
+    int write;
+    struct ata_request* next;
+} ata_request_t;
+
+static int ata_present = 0;
+static uint32_t ata_sectors = 0;
+static uint16_t bm_base = 0;        // 0 when DMA is unavailable
+static ata_stats_t stats;
+
+// The kernel runs without paging, so buffer addresses are physical. A 4KB
+// aligned table never crosses a 64KB boundary either.
+static ata_prd_t prd_table[ATA_MAX_PRDS] __attribute__((aligned(4096)));
+
+static ata_request_t request_pool[ATA_QUEUE_DEPTH];
+static ata_request_t* free_requests = NULL;
+static ata_request_t* queue_head = NULL;
+static ata_request_t* queue_tail = NULL;
+
+// DMA completion, set by ata_dma_complete
+static volatile int dma_active = 0;
+static volatile int dma_done = 0;
+static volatile int dma_result = 0;
+
+static void ata_irq_handler(interrupt_frame_t* frame);
+
+// Reading the alternate status register four times gives the drive its 400ns
+static void ata_delay(void) {
+    for (int i = 0; i < 4; i++) {
+        inb(ATA_CONTROL);
+    }
+}
+
+static int interrupts_enabled(void) {
+    uint32_t flags;
+    asm volatile ("pushfl; popl %0" : "=r"(flags));
+    return (flags & 0x200) != 0;
+}
+
+// Wait until the drive is no longer busy; returns the final status or -1
+static int ata_wait_not_busy(void) {
+    for (uint32_t i = 0; i < ATA_TIMEOUT; i++) {
+        uint8_t status = inb(ATA_IO_BASE + ATA_REG_STATUS);
+        if (!(status & ATA_SR_BSY)) {
+            return status;
+        }
+    }
+    return -1;
+}
+
+// Wait for the drive to be ready to transfer a sector
+static int ata_wait_data(void) {
+    ata_delay();
+
+    int status = ata_wait_not_busy();
+    if (status < 0 || (status & (ATA_SR_ERR | ATA_SR_DF)) || !(status & ATA_SR_DRQ)) {
+        return -1;
+    }
+    return 0;
+}
+
+// Select the master drive and program the address of a transfer
+// (a count of ATA_MAX_SECTORS is sent as 0, which the drive reads as 256)
+static int ata_setup(uint32_t lba, uint32_t count, uint8_t command) {
+    if (ata_wait_not_busy() < 0) {
+        return -1;
+    }
+
+    outb(ATA_IO_BASE + ATA_REG_DRIVE, 0xE0 | ((lba >> 24) & 0x0F));
+    ata_delay();
+    outb(ATA_IO_BASE + ATA_REG_SECCOUNT, (uint8_t)count);
+    outb(ATA_IO_BASE + ATA_REG_LBA_LOW, lba & 0xFF);
+    outb(ATA_IO_BASE + ATA_REG_LBA_MID, (lba >> 8) & 0xFF);
+    outb(ATA_IO_BASE + ATA_REG_LBA_HIGH, (lba >> 16) & 0xFF);
+    outb(ATA_IO_BASE + ATA_REG_COMMAND, command);
+    return 0;
+}
+
+// Check that a request lies inside the disk
+static int ata_check_range(uint32_t lba, size_t count) {
+    if (!ata_present || count == 0) {
+        return -1;
+    }
+    if (lba >= ata_sectors || count > ata_sectors - lba) {
+        return -1;
+    }
+    return 0;
+}
+
+// Find the bus-master registers of the IDE controller and enable DMA
+static void ata_init_dma(const uint16_t* identify) {
+    pci_device_t ide;
+
+    bm_base = 0;
+    if (!(identify[49] & ATA_IDENTIFY_DMA) ||
+        pci_find_class(PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, &ide) != 0) {
+        return;
+    }
+
+    // The primary channel must be at the legacy ports we drive, and BAR4 must
+    // hold the bus-master I/O range
+    uint8_t prog_if = pci_config_read8(&ide, PCI_PROG_IF);
+    uint32_t bar4 = pci_config_read32(&ide, PCI_BAR4);
+    if (!(prog_if & IDE_PROG_IF_BUS_MASTER) || (prog_if & IDE_PROG_IF_NATIVE) ||
+        !(bar4 & 1) || (bar4 & 0xFFFC) == 0) {
+        return;
+    }
+
+    pci_config_write16(&ide, PCI_COMMAND,
+                       pci_config_read16(&ide, PCI_COMMAND) | PCI_COMMAND_IO | PCI_COMMAND_BUS_MASTER);
+    bm_base = (uint16_t)(bar4 & 0xFFFC);
+    outb(bm_base + BM_COMMAND, 0);
+    outb(bm_base + BM_STATUS, BM_SR_ERROR | BM_SR_IRQ);
+
+    // DMA completion is reported through the drive's interrupt line
+    outb(ATA_CONTROL, 0);
+}
+
+// Detect the primary master drive with IDENTIFY
+int ata_init(void) {
+    ata_present = 0;
+    ata_sectors = 0;
+    bm_base = 0;
+    memset(&stats, 0, sizeof(stats));
+
+    queue_head = NULL;
+    queue_tail = NULL;
+    free_requests = NULL;
+    for (size_t i = 0; i < ATA_QUEUE_DEPTH; i++) {
+        request_pool[i].next = free_requests;
+        free_requests = &request_pool[i];
+    }
+
+    // A floating bus reads as 0xFF - nothing attached
+    if (inb(ATA_IO_BASE + ATA_REG_STATUS) == 0xFF) {
+        return -1;
+    }
+
+    outb(ATA_CONTROL, ATA_CONTROL_NIEN);
+    outb(ATA_IO_BASE + ATA_REG_DRIVE, 0xA0);
+    ata_delay();
+    outb(ATA_IO_BASE + ATA_REG_SECCOUNT, 0);
+    outb(ATA_IO_BASE + ATA_REG_LBA_LOW, 0);
+    outb(ATA_IO_BASE + ATA_REG_LBA_MID, 0);
+    outb(ATA_IO_BASE + ATA_REG_LBA_HIGH, 0);
+    outb(ATA_IO_BASE + ATA_REG_COMMAND, ATA_CMD_IDENTIFY);
+
+    if (inb(ATA_IO_BASE + ATA_REG_STATUS) == 0) {
+        return -1; // No drive
+    }
+    if (ata_wait_not_busy() < 0) {
+        return -1;
+    }
+
+    // ATAPI and SATA devices set the LBA mid/high signature - not a plain ATA disk
+    if (inb(ATA_IO_BASE + ATA_REG_LBA_MID) != 0 || inb(ATA_IO_BASE + ATA_REG_LBA_HIGH) != 0) {
+        return -1;
+    }
+    if (ata_wait_data() != 0) {
+        return -1;
+    }
+
+    uint16_t identify[256];
+    for (int i = 0; i < 256; i++) {
+        identify[i] = inw(ATA_IO_BASE + ATA_REG_DATA);
+    }
+
+    // Words 60-61: number of user-addressable sectors in LBA28 mode
+    ata_sectors = identify[60] | ((uint32_t)identify[61] << 16);
+    if (ata_sectors == 0) {
+        return -1; // CHS-only drive
+    }
+    if (ata_sectors > ATA_MAX_LBA28) {
+        ata_sectors = ATA_MAX_LBA28;
+    }
+
+    ata_init_dma(identify);
+    stats.dma = bm_base != 0;
+    ata_present = 1;
+
+    // The secondary channel's IRQ only needs its status read
+    irq_register(ATA_PRIMARY_IRQ, ata_irq_handler, "ata0");
+    irq_register(ATA_SECONDARY_IRQ, ata_irq_handler, "ata1");
+    return 0;
+}
+
+// Describe the buffers of a merged command in the PRD table
+// Returns -1 if they cannot be used for DMA (odd address or too many regions)
+static int ata_build_prds(ata_request_t* first, uint32_t sectors) {
+    size_t prds = 0;
+
+    for (ata_request_t* req = first; sectors > 0; req = req->next) {
+        uint32_t address = (uint32_t)req->buffer;
+        uint32_t remaining = req->count * ATA_SECTOR_SIZE;
+        if (address & 1) {
+            return -1;
+        }
+        sectors -= req->count;
+
+        while (remaining > 0) {
+            uint32_t length = PRD_BOUNDARY - (address & (PRD_BOUNDARY - 1));
+            if (length > remaining) {
+                length = remaining;
+            }
+
+            // Extend the previous region when the buffers happen to be contiguous
+            ata_prd_t* last = prds > 0 ? &prd_table[prds - 1] : NULL;
+            uint32_t last_length = last ? (last->byte_count ? last->byte_count : PRD_BOUNDARY) : 0;
+            if (last && last->address + last_length == address &&
+                (last->address & ~(PRD_BOUNDARY - 1)) == (address & ~(PRD_BOUNDARY - 1))) {
+                last->byte_count = (uint16_t)(last_length + length);
+            } else {
+                if (prds == ATA_MAX_PRDS) {
+                    return -1;
+                }
+                prd_table[prds].address = address;
+                prd_table[prds].byte_count = (uint16_t)length;
+                prd_table[prds].flags = 0;
+                prds++;
+            }
+
+            address += length;
+            remaining -= length;
+        }
+    }
+
+    prd_table[prds - 1].flags = PRD_EOT;
+    return 0;
+}
+
+// Finish a DMA transfer: stop the engine and collect its result
+static void ata_dma_complete(void) {
+    uint8_t bm_status = inb(bm_base + BM_STATUS);
+    outb(bm_base + BM_COMMAND, 0);
+
+    // Reading the status register also acknowledges the drive's interrupt
+    uint8_t status = inb(ATA_IO_BASE + ATA_REG_STATUS);
+    outb(bm_base + BM_STATUS, BM_SR_ERROR | BM_SR_IRQ);
+
+    dma_result = ((bm_status & BM_SR_ERROR) || (status & (ATA_SR_ERR | ATA_SR_DF))) ? -1 : 0;
+    dma_active = 0;
+    dma_done = 1;
+}
+
+// Wait for the current DMA transfer. With interrupts enabled IRQ14 completes
+// it; with interrupts off (during boot, or inside another interrupt handler)
+// the bus-master interrupt bit is polled instead.
+static int ata_dma_wait(void) {
+    for (uint32_t i = 0; i < ATA_TIMEOUT; i++) {
+        if (dma_done) {
+            return dma_result;
+        }
+        uint8_t bm_status = inb(bm_base + BM_STATUS);
+        if ((bm_status & BM_SR_IRQ) && !interrupts_enabled()) {
+            ata_dma_complete();
+        }
+    }
+
+    outb(bm_base + BM_COMMAND, 0);
+    dma_active = 0;
+    return -1;
+}
+
+// Run a merged command as one bus-master DMA transfer
+static int ata_dma_transfer(uint32_t lba, uint32_t sectors, int write) {
+    uint8_t direction = write ? 0 : BM_CMD_READ;
+
+    outl(bm_base + BM_PRDT, (uint32_t)prd_table);
+    outb(bm_base + BM_COMMAND, direction);
+    outb(bm_base + BM_STATUS, BM_SR_ERROR | BM_SR_IRQ);
+
+    dma_done = 0;
+    dma_active = 1;
+    if (ata_setup(lba, sectors, write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA) != 0) {
+        dma_active = 0;
+        return -1;
+    }
+    outb(bm_base + BM_COMMAND, direction | BM_CMD_START);
+
+    stats.dma_commands++;
+    return ata_dma_wait();
+}
+
+// Run a merged command with PIO, one sector at a time from each request
+static int ata_pio_transfer(ata_request_t* first, uint32_t sectors, int write) {
+    if (ata_setup(first->lba, sectors, write ? ATA_CMD_WRITE_SECTORS : ATA_CMD_READ_SECTORS) != 0) {
+        return -1;
+    }
+
+    for (ata_request_t* req = first; sectors > 0; req = req->next) {
+        uint16_t* data = (uint16_t*)req->buffer;
+        for (uint32_t s = 0; s < req->count; s++) {
+            if (ata_wait_data() != 0) {
+                return -1;
+            }
+            for (int i = 0; i < ATA_SECTOR_SIZE / 2; i++) {
+                if (write) {
+                    outw(ATA_IO_BASE + ATA_REG_DATA, *data++);
+                } else {
+                    *data++ = inw(ATA_IO_BASE + ATA_REG_DATA);
+                }
+            }
+        }
+        sectors -= req->count;
+    }
+
+    // The drive reports errors in a write only after the last sector
+    if (write) {
+        int status = ata_wait_not_busy();
+        if (status < 0 || (status & (ATA_SR_ERR | ATA_SR_DF))) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int ata_flush_cache(void) {
+    if (ata_wait_not_busy() < 0) {
+        return -1;
+    }
+    outb(ATA_IO_BASE + ATA_REG_COMMAND, ATA_CMD_CACHE_FLUSH);
+    ata_delay();
+
+    int status = ata_wait_not_busy();
+    if (status < 0 || (status & (ATA_SR_ERR | ATA_SR_DF))) {
+        return -1;
+    }
+    return 0;
+}
+
+// Queue a transfer of `count` sectors at `lba` for the next ata_run_queue
+int ata_submit(uint32_t lba, size_t count, void* buffer, int write) {
+    if (ata_check_range(lba, count) != 0 || count > ATA_MAX_SECTORS || !free_requests) {
+        return -1;
+    }
+
+    ata_request_t* req = free_requests;
+    free_requests = req->next;
+    req->lba = lba;
+    req->count = count;
+    req->buffer = (uint8_t*)buffer;
+    req->write = write;
+    req->next = NULL;
+    stats.requests++;
+
+    // Keep the queue in LBA order, but never move a request ahead of one it
+    // overlaps. Callers mostly submit in order, so try the tail first.
+    if (!queue_head) {
+        queue_head = req;
+        queue_tail = req;
+        return 0;
+    }
+    if (queue_tail->lba <= lba) {
+        queue_tail->next = req;
+        queue_tail = req;
+        return 0;
+    }
+
+    ata_request_t* after = NULL;
+    for (ata_request_t* cur = queue_head; cur; cur = cur->next) {
+        int overlaps = cur->lba < lba + count && lba < cur->lba + cur->count;
+        if (cur->lba <= lba || overlaps) {
+            after = cur;
+        }
+    }
+    if (after) {
+        req->next = after->next;
+        after->next = req;
+    } else {
+        req->next = queue_head;
+        queue_head = req;
+    }
+    if (!req->next) {
+        queue_tail = req;
+    }
+    return 0;
+}
+
+// Run every queued request, merging runs of adjacent requests in the same
+// direction into one command. Returns the number of commands issued, or -1
+// if any of them failed (the queue is empty either way).
+int ata_run_queue(void) {
+    int commands = 0;
+    int failed = 0;
+    int wrote = 0;
+
+    while (queue_head) {
+        ata_request_t* first = queue_head;
+        ata_request_t* last = first;
+        uint32_t sectors = first->count;
+        while (last->next && last->next->write == first->write &&
+               last->next->lba == first->lba + sectors &&
+               sectors + last->next->count <= ATA_MAX_SECTORS) {
+            last = last->next;
+            sectors += last->count;
+        }
+        queue_head = last->next;
+
+        int result;
+        if (bm_base && ata_build_prds(first, sectors) == 0) {
+            result = ata_dma_transfer(first->lba, sectors, first->write);
+        } else {
+            result = ata_pio_transfer(first, sectors, first->write);
+        }
+
+        commands++;
+        stats.commands++;
+        if (result != 0) {
+            failed = 1;
+            stats.errors++;
+        } else if (first->write) {
+            stats.sectors_written += sectors;
+        } else {
+            stats.sectors_read += sectors;
+        }
+        wrote |= first->write;
+
+        last->next = free_requests;
+        free_requests = first;
+    }
+    queue_tail = NULL;
+
+    // One cache flush covers every write in the batch
+    if (wrote && ata_flush_cache() != 0) {
+        failed = 1;
+        stats.errors++;
+    }
+    return failed ? -1 : commands;
+}
+
+// Queue a range in chunks of at most ATA_MAX_SECTORS and run it
+static int ata_transfer_range(uint32_t lba, size_t count, uint8_t* buffer, int write) {
+    if (ata_check_range(lba, count) != 0) {
+        return -1;
+    }
+
+    while (count > 0) {
+        size_t chunk = count > ATA_MAX_SECTORS ? ATA_MAX_SECTORS : count;
+        if (ata_submit(lba, chunk, buffer, write) != 0) {
+            // Queue full - drain it and try again
+            if (ata_run_queue() < 0 || ata_submit(lba, chunk, buffer, write) != 0) {
+                ata_run_queue();
+                return -1;
+            }
+        }
+        lba += chunk;
+        buffer += chunk * ATA_SECTOR_SIZE;
+        count -= chunk;
+    }
+
+    return ata_run_queue() < 0 ? -1 : 0;
+}
+
+// Read `count` sectors starting at `lba`
+int ata_read_sectors(uint32_t lba, size_t count, void* buffer) {
+    return ata_transfer_range(lba, count, (uint8_t*)buffer, 0);
+}
+
+// Write `count` sectors starting at `lba` and flush the drive's write cache
+int ata_write_sectors(uint32_t lba, size_t count, const void* buffer) {
+    return ata_transfer_range(lba, count, (uint8_t*)buffer, 1);
+}
+
+// IRQ14 (channel 0) and IRQ15 (channel 1); spurious IRQ15s never get here
+static void ata_irq_handler(interrupt_frame_t* frame) {
+    uint32_t channel = frame->vector == IRQ_VECTOR(ATA_SECONDARY_IRQ);
+
+    stats.interrupts++;
+    if (channel == 0 && dma_active && (inb(bm_base + BM_STATUS) & BM_SR_IRQ)) {
+        ata_dma_complete();
+    } else {
+        // Nothing waits for it; reading the status acknowledges the drive
+        inb((channel == 0 ? ATA_IO_BASE : ATA_SECONDARY_IO_BASE) + ATA_REG_STATUS);
+    }
+}
+
+// Size of the drive in sectors (0 if no drive was found)
+uint32_t ata_get_sector_count(void) {
+    return ata_sectors;
+}
+
+void ata_get_stats(ata_stats_t* out) {
+    memcpy(out, &stats, sizeof(ata_stats_t));
+}
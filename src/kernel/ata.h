@@ -0,0 +1,35 @@
+#ifndef ATA_H
+#define ATA_H
+
+#include "kernel.h"
+
+#define ATA_SECTOR_SIZE 512
+#define ATA_MAX_SECTORS 256         // Per request and per merged command
+#define ATA_QUEUE_DEPTH 256         // Requests waiting for ata_run_queue
+
+// Driver statistics
+typedef struct {
+    int dma;                        // Bus-master DMA in use (otherwise PIO)
+    uint32_t requests;
+    uint32_t commands;              // Commands issued after merging
+    uint32_t dma_commands;
+    uint32_t sectors_read;
+    uint32_t sectors_written;
+    uint32_t interrupts;
+    uint32_t errors;
+} ata_stats_t;
+
+// ATA driver for the primary master drive (the disk we booted from)
+int ata_init(void);
+int ata_read_sectors(uint32_t lba, size_t count, void* buffer);
+int ata_write_sectors(uint32_t lba, size_t count, const void* buffer);
+uint32_t ata_get_sector_count(void);
+void ata_get_stats(ata_stats_t* stats);
+
+// Request queue: submitted transfers wait, sorted by LBA, until
+// ata_run_queue merges neighbours into single commands and runs them.
+// The buffers must stay untouched until then.
+int ata_submit(uint32_t lba, size_t count, void* buffer, int write);
+int ata_run_queue(void);
+
+#endif // ATA_H
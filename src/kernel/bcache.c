@@ -0,0 +1,349 @@
+// PhantomOS Buffer Cache
+// Caches device sectors in LRU order. Writes only mark a buffer dirty; dirty
+// buffers reach the device in sorted, merged runs when the cache is synced,
+// when too many are dirty, or when one is evicted. Sequential reads pull in
+// the following sectors with a single device request.
+
+#include "bcache.h"
+#include "heap.h"
+
+// Buffer flags
+#define BUF_VALID 0x01
+#define BUF_DIRTY 0x02
+#define BUF_READAHEAD 0x04  // Prefetched and not read yet
+
+typedef struct bcache_buf {
+    uint32_t lba;
+    uint32_t flags;
+    struct bcache_buf* hash_next;
+    struct bcache_buf* lru_prev;    // Towards the most recently used
+    struct bcache_buf* lru_next;    // Towards the least recently used
+    uint8_t data[BCACHE_BLOCK_SIZE];
+} bcache_buf_t;
+
+static block_device_t* bdev = NULL;
+static bcache_buf_t* buffers = NULL;
+static bcache_buf_t** flush_order = NULL;  // Scratch list for bcache_sync
+static size_t buffer_count = 0;
+static bcache_buf_t* hash_table[BCACHE_HASH_SIZE];
+static bcache_buf_t* lru_head = NULL;
+static bcache_buf_t* lru_tail = NULL;
+static uint32_t next_sequential = 0;       // LBA a sequential reader would miss next
+static bcache_stats_t stats;
+
+// Staging area for multi-sector device requests (word aligned for DMA)
+static uint8_t staging[BCACHE_READAHEAD * BCACHE_BLOCK_SIZE] __attribute__((aligned(4)));
+
+static inline size_t bcache_hash(uint32_t lba) {
+    return (lba * 2654435761u) >> 23 & (BCACHE_HASH_SIZE - 1);
+}
+
+static bcache_buf_t* bcache_lookup(uint32_t lba) {
+    for (bcache_buf_t* buf = hash_table[bcache_hash(lba)]; buf; buf = buf->hash_next) {
+        if (buf->lba == lba) {
+            return buf;
+        }
+    }
+    return NULL;
+}
+
+static void bcache_hash_remove(bcache_buf_t* buf) {
+    bcache_buf_t** link = &hash_table[bcache_hash(buf->lba)];
+    while (*link && *link != buf) {
+        link = &(*link)->hash_next;
+    }
+    if (*link) {
+        *link = buf->hash_next;
+    }
+    buf->hash_next = NULL;
+}
+
+static void bcache_lru_unlink(bcache_buf_t* buf) {
+    if (buf->lru_prev) {
+        buf->lru_prev->lru_next = buf->lru_next;
+    } else {
+        lru_head = buf->lru_next;
+    }
+    if (buf->lru_next) {
+        buf->lru_next->lru_prev = buf->lru_prev;
+    } else {
+        lru_tail = buf->lru_prev;
+    }
+}
+
+// Mark a buffer as most recently used
+static void bcache_touch(bcache_buf_t* buf) {
+    if (buf == lru_head) {
+        return;
+    }
+    bcache_lru_unlink(buf);
+    buf->lru_prev = NULL;
+    buf->lru_next = lru_head;
+    lru_head->lru_prev = buf;
+    lru_head = buf;
+}
+
+// Write one dirty buffer to the device
+static int bcache_flush_buffer(bcache_buf_t* buf) {
+    if (bdev->write(buf->lba, 1, buf->data) != 0) {
+        return -1;
+    }
+    buf->flags &= ~BUF_DIRTY;
+    stats.dirty--;
+    stats.flushes++;
+    stats.blocks_flushed++;
+    return 0;
+}
+
+// Take the least recently used buffer that can be reused and give it `lba`
+static bcache_buf_t* bcache_claim(uint32_t lba) {
+    bcache_buf_t* buf = lru_tail;
+
+    // A dirty buffer that fails to write back keeps its data; try the next one
+    while (buf && (buf->flags & BUF_DIRTY) && bcache_flush_buffer(buf) != 0) {
+        buf = buf->lru_prev;
+    }
+    if (!buf) {
+        return NULL;
+    }
+
+    if (buf->flags & BUF_VALID) {
+        bcache_hash_remove(buf);
+        stats.cached--;
+        stats.evictions++;
+    }
+
+    buf->lba = lba;
+    buf->flags = BUF_VALID;
+    size_t bucket = bcache_hash(lba);
+    buf->hash_next = hash_table[bucket];
+    hash_table[bucket] = buf;
+    stats.cached++;
+    bcache_touch(buf);
+    return buf;
+}
+
+// Set up the cache in front of `device`, writing back any previous device first
+int bcache_init(block_device_t* device) {
+    if (buffers) {
+        bcache_sync();
+        kfree(buffers);
+        kfree(flush_order);
+    }
+
+    bdev = NULL;
+    buffers = NULL;
+    flush_order = NULL;
+    memset(hash_table, 0, sizeof(hash_table));
+    memset(&stats, 0, sizeof(stats));
+    lru_head = NULL;
+    lru_tail = NULL;
+    next_sequential = 0;
+
+    // Settle for a smaller cache when memory is short
+    for (buffer_count = BCACHE_BUFFERS; buffer_count >= BCACHE_MIN_BUFFERS; buffer_count /= 2) {
+        buffers = (bcache_buf_t*)kmalloc(buffer_count * sizeof(bcache_buf_t));
+        flush_order = (bcache_buf_t**)kmalloc(buffer_count * sizeof(bcache_buf_t*));
+        if (buffers && flush_order) {
+            break;
+        }
+        kfree(buffers);
+        kfree(flush_order);
+        buffers = NULL;
+        flush_order = NULL;
+    }
+    if (!buffers) {
+        buffer_count = 0;
+        return -1;
+    }
+
+    for (size_t i = 0; i < buffer_count; i++) {
+        bcache_buf_t* buf = &buffers[i];
+        buf->flags = 0;
+        buf->hash_next = NULL;
+        buf->lru_prev = i > 0 ? &buffers[i - 1] : NULL;
+        buf->lru_next = i + 1 < buffer_count ? &buffers[i + 1] : NULL;
+    }
+    lru_head = &buffers[0];
+    lru_tail = &buffers[buffer_count - 1];
+
+    bdev = device;
+    stats.buffers = buffer_count;
+    return 0;
+}
+
+// Read one sector through the cache
+int bcache_read(uint32_t lba, void* buffer) {
+    if (!bdev || lba >= bdev->sector_count) {
+        return -1;
+    }
+
+    bcache_buf_t* buf = bcache_lookup(lba);
+    if (buf) {
+        stats.hits++;
+        if (buf->flags & BUF_READAHEAD) {
+            buf->flags &= ~BUF_READAHEAD;
+            stats.readahead_hits++;
+        }
+        bcache_touch(buf);
+        memcpy(buffer, buf->data, BCACHE_BLOCK_SIZE);
+        return 0;
+    }
+
+    stats.misses++;
+
+    // A miss right where the last one left off looks sequential: fetch ahead,
+    // stopping short of sectors that are already cached (they may be dirty)
+    size_t count = 1;
+    if (lba == next_sequential) {
+        while (count < BCACHE_READAHEAD && lba + count < bdev->sector_count &&
+               !bcache_lookup(lba + count)) {
+            count++;
+        }
+    }
+
+    if (bdev->read(lba, count, staging) != 0) {
+        return -1;
+    }
+    next_sequential = lba + count;
+
+    // Install the prefetched sectors first so the requested one ends up most recent
+    for (size_t i = count; i-- > 0;) {
+        buf = bcache_claim(lba + i);
+        if (!buf) {
+            break; // Every buffer is dirty and unwritable - just don't cache
+        }
+        memcpy(buf->data, &staging[i * BCACHE_BLOCK_SIZE], BCACHE_BLOCK_SIZE);
+        if (i > 0) {
+            buf->flags |= BUF_READAHEAD;
+            stats.readahead_blocks++;
+        }
+    }
+
+    memcpy(buffer, staging, BCACHE_BLOCK_SIZE);
+    return 0;
+}
+
+// Write one sector into the cache; it reaches the device on write-back
+int bcache_write(uint32_t lba, const void* buffer) {
+    if (!bdev || lba >= bdev->sector_count) {
+        return -1;
+    }
+
+    bcache_buf_t* buf = bcache_lookup(lba);
+    if (buf) {
+        bcache_touch(buf);
+    } else {
+        buf = bcache_claim(lba);
+        if (!buf) {
+            return -1;
+        }
+    }
+
+    memcpy(buf->data, buffer, BCACHE_BLOCK_SIZE);
+    buf->flags &= ~BUF_READAHEAD;
+    if (!(buf->flags & BUF_DIRTY)) {
+        buf->flags |= BUF_DIRTY;
+        stats.dirty++;
+    }
+    stats.writes++;
+
+    if (stats.dirty >= BCACHE_DIRTY_LIMIT) {
+        bcache_sync();
+    }
+    return 0;
+}
+
+// Mark flush_order[start..end) as written
+static void bcache_mark_clean(size_t start, size_t end) {
+    for (size_t i = start; i < end; i++) {
+        flush_order[i]->flags &= ~BUF_DIRTY;
+    }
+    stats.dirty -= end - start;
+    stats.blocks_flushed += end - start;
+}
+
+// Hand the sorted dirty buffers straight to the device queue, which merges
+// neighbours itself and transfers from the buffers without a copy
+static int bcache_flush_queued(size_t count) {
+    size_t start = 0;
+    while (start < count) {
+        size_t end = start;
+        while (end < count && bdev->submit(flush_order[end]->lba, 1, flush_order[end]->data, 1) == 0) {
+            end++;
+        }
+
+        int commands = bdev->run_queue();
+        if (end == start || commands < 0) {
+            return -1; // Leave them dirty for the next attempt
+        }
+        stats.flushes += commands;
+        bcache_mark_clean(start, end);
+        start = end;
+    }
+    return (int)count;
+}
+
+// Copy runs of adjacent dirty buffers into the staging area, one request each
+static int bcache_flush_merged(size_t count) {
+    int written = 0;
+    int failed = 0;
+    size_t start = 0;
+    while (start < count) {
+        size_t run = 1;
+        while (start + run < count && run < BCACHE_READAHEAD &&
+               flush_order[start + run]->lba == flush_order[start]->lba + run) {
+            run++;
+        }
+
+        for (size_t i = 0; i < run; i++) {
+            memcpy(&staging[i * BCACHE_BLOCK_SIZE], flush_order[start + i]->data, BCACHE_BLOCK_SIZE);
+        }
+
+        stats.flushes++;
+        if (bdev->write(flush_order[start]->lba, run, staging) == 0) {
+            bcache_mark_clean(start, start + run);
+            written += run;
+        } else {
+            failed = 1; // Leave them dirty for the next attempt
+        }
+        start += run;
+    }
+
+    return failed ? -1 : written;
+}
+
+// Write every dirty buffer back, merging adjacent sectors into one request
+// Returns the number of sectors written, or -1 if any write failed
+int bcache_sync(void) {
+    if (!bdev || stats.dirty == 0) {
+        return 0;
+    }
+
+    // Collect the dirty buffers in LBA order (insertion sort; the list is short)
+    size_t count = 0;
+    for (size_t i = 0; i < buffer_count; i++) {
+        if (!(buffers[i].flags & BUF_DIRTY)) {
+            continue;
+        }
+        size_t pos = count++;
+        while (pos > 0 && flush_order[pos - 1]->lba > buffers[i].lba) {
+            flush_order[pos] = flush_order[pos - 1];
+            pos--;
+        }
+        flush_order[pos] = &buffers[i];
+    }
+
+    return bdev->submit ? bcache_flush_queued(count) : bcache_flush_merged(count);
+}
+
+// Periodic write-back, run by writeback_thread in kernel.c under fs_lock
+void bcache_writeback(void) {
+    if (stats.dirty > 0) {
+        bcache_sync();
+    }
+}
+
+void bcache_get_stats(bcache_stats_t* out) {
+    memcpy(out, &stats, sizeof(bcache_stats_t));
+}
@@ -0,0 +1,49 @@
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include "kernel.h"
+
+// Buffer cache constants
+#define BCACHE_BLOCK_SIZE 512
+#define BCACHE_BUFFERS 256          // 128 KB of cached sectors (fewer if memory is short)
+#define BCACHE_MIN_BUFFERS 64
+#define BCACHE_HASH_SIZE 512        // Power of two
+#define BCACHE_READAHEAD 16         // Sectors fetched per sequential miss
+#define BCACHE_DIRTY_LIMIT 128      // Dirty buffers that force a write-back
+
+// Block device driven by the cache
+typedef struct {
+    const char* name;
+    uint32_t sector_count;
+    int (*read)(uint32_t lba, size_t count, void* buffer);
+    int (*write)(uint32_t lba, size_t count, const void* buffer);
+    // Optional request queue: submit() holds a transfer until run_queue(),
+    // which merges neighbours and returns the commands issued (or -1)
+    int (*submit)(uint32_t lba, size_t count, void* buffer, int write);
+    int (*run_queue)(void);
+} block_device_t;
+
+// Buffer cache statistics
+typedef struct {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t readahead_blocks;      // Sectors fetched ahead of a read
+    uint32_t readahead_hits;        // ...that were later read
+    uint32_t writes;
+    uint32_t flushes;               // Device write requests
+    uint32_t blocks_flushed;
+    uint32_t evictions;
+    size_t buffers;
+    size_t cached;
+    size_t dirty;
+} bcache_stats_t;
+
+// Write-back buffer cache in front of a block device
+int bcache_init(block_device_t* device);
+int bcache_read(uint32_t lba, void* buffer);
+int bcache_write(uint32_t lba, const void* buffer);
+int bcache_sync(void);
+void bcache_writeback(void);
+void bcache_get_stats(bcache_stats_t* stats);
+
+#endif // BCACHE_H
@@ -0,0 +1,173 @@
+// PhantomOS Boot Information
+// The kernel can be started by its own stage 2 loader (E820 map at a fixed
+// low address) or by any Multiboot / Multiboot 2 loader such as QEMU's
+// -kernel option or GRUB. Each hands over a memory map in its own format;
+// this converts them to boot_memory_map_t and keeps the command line.
+
+#include "bootinfo.h"
+#include "multiboot.h"
+
+static const char* boot_loader = "unknown";
+static char boot_cmdline[BOOT_CMDLINE_MAX];
+static boot_memory_map_t boot_memory_map;
+
+static void boot_add_region(uint32_t base_low, uint32_t base_high,
+                            uint32_t length_low, uint32_t length_high, uint32_t type) {
+    if (boot_memory_map.entry_count >= E820_MAX_ENTRIES) {
+        return;
+    }
+    e820_entry_t* entry = &boot_memory_map.entries[boot_memory_map.entry_count++];
+    entry->base_low = base_low;
+    entry->base_high = base_high;
+    entry->length_low = length_low;
+    entry->length_high = length_high;
+    entry->type = type;
+    entry->acpi_attributes = 0;
+}
+
+static void boot_copy_cmdline(const char* cmdline) {
+    // At most BOOT_CMDLINE_MAX - 1 bytes, always terminated
+    size_t i = 0;
+    if (cmdline) {
+        for (; i < BOOT_CMDLINE_MAX - 1 && cmdline[i] != '\0'; i++) {
+            boot_cmdline[i] = cmdline[i];
+        }
+    }
+    boot_cmdline[i] = '\0';
+}
+
+static void boot_parse_multiboot(multiboot_info_t* info) {
+    if (info->flags & MULTIBOOT_INFO_CMDLINE) {
+        boot_copy_cmdline((const char*)info->cmdline);
+    }
+
+    if (info->flags & MULTIBOOT_INFO_MEM_MAP) {
+        uint32_t offset = 0;
+        while (offset + sizeof(multiboot_mmap_entry_t) <= info->mmap_length) {
+            multiboot_mmap_entry_t* entry = (multiboot_mmap_entry_t*)(info->mmap_addr + offset);
+            boot_add_region(entry->base_low, entry->base_high,
+                            entry->length_low, entry->length_high, entry->type);
+            offset += entry->size + sizeof(entry->size);
+        }
+    } else if (info->flags & MULTIBOOT_INFO_MEMORY) {
+        // Only the sizes of low and extended memory (in KB) are known
+        boot_add_region(0, 0, info->mem_lower * 1024, 0, E820_TYPE_USABLE);
+        boot_add_region(0x100000, 0, info->mem_upper * 1024, 0, E820_TYPE_USABLE);
+    }
+}
+
+static void boot_parse_multiboot2(uint32_t info) {
+    uint32_t total_size = *(uint32_t*)info;
+    uint32_t offset = 8;
+
+    while (offset + sizeof(multiboot2_tag_t) <= total_size) {
+        multiboot2_tag_t* tag = (multiboot2_tag_t*)(info + offset);
+        if (tag->type == MULTIBOOT2_TAG_END || tag->size < sizeof(multiboot2_tag_t)) {
+            break;
+        }
+
+        if (tag->type == MULTIBOOT2_TAG_CMDLINE) {
+            boot_copy_cmdline((const char*)(tag + 1));
+        } else if (tag->type == MULTIBOOT2_TAG_MMAP) {
+            // Entries have the same layout as E820 ones (base, length, type, reserved)
+            multiboot2_tag_mmap_t* mmap = (multiboot2_tag_mmap_t*)tag;
+            if (mmap->entry_size >= sizeof(e820_entry_t)) {
+                for (uint32_t pos = sizeof(multiboot2_tag_mmap_t);
+                     pos + mmap->entry_size <= tag->size; pos += mmap->entry_size) {
+                    e820_entry_t* entry = (e820_entry_t*)((uint32_t)tag + pos);
+                    boot_add_region(entry->base_low, entry->base_high,
+                                    entry->length_low, entry->length_high, entry->type);
+                }
+            }
+        }
+
+        offset += (tag->size + 7) & ~7;  // Tags are 8-byte aligned
+    }
+}
+
+// Record what the loader passed in EAX (magic) and EBX (info); returns -1
+// if the loader is not recognized (the kernel then has no memory map)
+int boot_info_init(uint32_t magic, uint32_t info) {
+    boot_cmdline[0] = '\0';
+    boot_memory_map.entry_count = 0;
+
+    if (magic == BOOT_MAGIC_STAGE2) {
+        boot_loader = "stage2";
+        boot_memory_map_t* map = (boot_memory_map_t*)info;
+        size_t count = map->entry_count < E820_MAX_ENTRIES ? map->entry_count : E820_MAX_ENTRIES;
+        boot_memory_map.entry_count = count;
+        memcpy(boot_memory_map.entries, map->entries, count * sizeof(e820_entry_t));
+    } else if (magic == MULTIBOOT_BOOTLOADER_MAGIC) {
+        boot_loader = "multiboot";
+        boot_parse_multiboot((multiboot_info_t*)info);
+    } else if (magic == MULTIBOOT2_BOOTLOADER_MAGIC) {
+        boot_loader = "multiboot2";
+        boot_parse_multiboot2(info);
+    } else {
+        boot_loader = "unknown";
+        return -1;
+    }
+    return 0;
+}
+
+boot_memory_map_t* boot_get_memory_map(void) {
+    return &boot_memory_map;
+}
+
+const char* boot_get_loader(void) {
+    return boot_loader;
+}
+
+const char* boot_get_cmdline(void) {
+    return boot_cmdline;
+}
+
+// Find `name` as a whole word of the command line and copy its value
+int boot_get_option(const char* name, char* value, size_t size) {
+    size_t name_len = strlen(name);
+    const char* word = boot_cmdline;
+
+    while (*word) {
+        while (*word == ' ') {
+            word++;
+        }
+        const char* end = word;
+        while (*end && *end != ' ') {
+            end++;
+        }
+
+        if ((size_t)(end - word) >= name_len && strncmp(word, name, name_len) == 0 &&
+            (word + name_len == end || word[name_len] == '=')) {
+            const char* start = word + name_len + (word + name_len < end ? 1 : 0);
+            size_t len = end - start;
+            if (size > 0) {
+                if (len >= size) {
+                    len = size - 1;
+                }
+                memcpy(value, start, len);
+                value[len] = '\0';
+            }
+            return 0;
+        }
+        word = end;
+    }
+    return -1;
+}
+
+// Read a decimal option value; -1 if it is missing or not a number
+int boot_get_option_number(const char* name, uint32_t* value) {
+    char text[16];
+    if (boot_get_option(name, text, sizeof(text)) != 0 || text[0] == '\0') {
+        return -1;
+    }
+
+    uint32_t number = 0;
+    for (const char* c = text; *c; c++) {
+        if (*c < '0' || *c > '9' || number > (0xFFFFFFFF - 9) / 10) {
+            return -1;
+        }
+        number = number * 10 + (*c - '0');
+    }
+    *value = number;
+    return 0;
+}
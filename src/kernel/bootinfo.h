@@ -0,0 +1,24 @@
+#ifndef BOOTINFO_H
+#define BOOTINFO_H
+
+#include "kernel.h"
+#include "pmm.h"
+
+// EAX value the stage 2 loader hands to the kernel ("PHBT"); Multiboot
+// loaders pass their own magic numbers (see multiboot.h)
+#define BOOT_MAGIC_STAGE2 0x54424850
+#define BOOT_CMDLINE_MAX 256
+
+// Boot information, copied out of the loader's structures before the
+// memory they live in is handed to the frame allocator
+int boot_info_init(uint32_t magic, uint32_t info);
+boot_memory_map_t* boot_get_memory_map(void);
+const char* boot_get_loader(void);
+const char* boot_get_cmdline(void);
+
+// Command line options are space-separated "name=value" words (or just
+// "name"). Both return 0 if the option is present, -1 otherwise.
+int boot_get_option(const char* name, char* value, size_t size);
+int boot_get_option_number(const char* name, uint32_t* value);
+
+#endif // BOOTINFO_H
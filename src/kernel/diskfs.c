@@ -0,0 +1,771 @@
+// PhantomOS Disk File System
+// Persists the in-memory file system on a PhantomFS volume (see pfs.h) that
+// lives on the boot disk after the kernel. The whole tree is loaded at mount;
+// from then on every change is written through the buffer cache by the hooks
+// below.
+
+#include "diskfs.h"
+#include "ata.h"
+#include "bcache.h"
+#include "heap.h"
+
+static pfs_superblock_t superblock;
+static uint8_t* block_bitmap = NULL;   // In-memory copy of the on-disk bitmap
+static uint8_t* inode_bitmap = NULL;   // Built at mount from the inode table
+static uint8_t* loaded_bitmap = NULL;  // Inodes already loaded (mount only)
+static uint32_t free_blocks = 0;
+static uint32_t free_inodes = 0;
+static uint32_t block_hint = 0;        // Data block index to start the next search from
+static int mounted = 0;
+
+// The boot disk, accessed through the buffer cache
+static block_device_t boot_disk = {
+    "ata0", 0, ata_read_sectors, ata_write_sectors, ata_submit, ata_run_queue
+};
+
+static inline int bitmap_test(const uint8_t* map, uint32_t bit) {
+    return (map[bit / 8] >> (bit % 8)) & 1;
+}
+
+static inline void bitmap_set(uint8_t* map, uint32_t bit) {
+    map[bit / 8] |= (uint8_t)(1 << (bit % 8));
+}
+
+static inline void bitmap_clear(uint8_t* map, uint32_t bit) {
+    map[bit / 8] &= (uint8_t)~(1 << (bit % 8));
+}
+
+static int pfs_read_block(uint32_t block, void* buffer) {
+    if (block >= superblock.total_blocks) {
+        return -1;
+    }
+    return bcache_read(PFS_START_LBA + block, buffer);
+}
+
+static int pfs_write_block(uint32_t block, const void* buffer) {
+    if (block >= superblock.total_blocks) {
+        return -1;
+    }
+    return bcache_write(PFS_START_LBA + block, buffer);
+}
+
+// Write back the bitmap block holding the bit for `block`
+static int pfs_flush_bitmap(uint32_t block) {
+    uint32_t index = block / PFS_BITS_PER_BLOCK;
+    return pfs_write_block(superblock.bitmap_start + index, &block_bitmap[index * PFS_BLOCK_SIZE]);
+}
+
+// Allocate a data block; returns 0 when the disk is full
+static uint32_t pfs_alloc_block(void) {
+    if (free_blocks == 0) {
+        return 0;
+    }
+
+    uint32_t span = superblock.total_blocks - superblock.data_start;
+    for (uint32_t i = 0; i < span; i++) {
+        uint32_t index = (block_hint + i) % span;
+        uint32_t block = superblock.data_start + index;
+        if (bitmap_test(block_bitmap, block)) {
+            continue;
+        }
+
+        bitmap_set(block_bitmap, block);
+        if (pfs_flush_bitmap(block) != 0) {
+            bitmap_clear(block_bitmap, block);
+            return 0;
+        }
+        free_blocks--;
+        block_hint = (index + 1) % span;
+        return block;
+    }
+
+    return 0;
+}
+
+static void pfs_free_block(uint32_t block) {
+    if (block < superblock.data_start || block >= superblock.total_blocks ||
+        !bitmap_test(block_bitmap, block)) {
+        return;
+    }
+
+    bitmap_clear(block_bitmap, block);
+    pfs_flush_bitmap(block);
+    free_blocks++;
+}
+
+// Allocate a block and fill it with zeros (for pointer tables)
+static uint32_t pfs_alloc_zeroed_block(void) {
+    uint8_t zero[PFS_BLOCK_SIZE];
+    uint32_t block = pfs_alloc_block();
+
+    if (block) {
+        memset(zero, 0, sizeof(zero));
+        if (pfs_write_block(block, zero) != 0) {
+            pfs_free_block(block);
+            return 0;
+        }
+    }
+    return block;
+}
+
+static int pfs_read_inode(uint32_t number, pfs_inode_t* inode) {
+    uint8_t buffer[PFS_BLOCK_SIZE];
+
+    if (number == 0 || number >= superblock.inode_count ||
+        pfs_read_block(superblock.inode_start + number / PFS_INODES_PER_BLOCK, buffer) != 0) {
+        return -1;
+    }
+    memcpy(inode, &buffer[(number % PFS_INODES_PER_BLOCK) * sizeof(pfs_inode_t)], sizeof(pfs_inode_t));
+    return 0;
+}
+
+static int pfs_write_inode(uint32_t number, const pfs_inode_t* inode) {
+    uint8_t buffer[PFS_BLOCK_SIZE];
+    uint32_t block = superblock.inode_start + number / PFS_INODES_PER_BLOCK;
+
+    if (number == 0 || number >= superblock.inode_count || pfs_read_block(block, buffer) != 0) {
+        return -1;
+    }
+    memcpy(&buffer[(number % PFS_INODES_PER_BLOCK) * sizeof(pfs_inode_t)], inode, sizeof(pfs_inode_t));
+    return pfs_write_block(block, buffer);
+}
+
+// Look up entry `index` of the pointer table `*table`. With `allocate` set, a
+// missing table or entry is allocated; entries that are tables start zeroed.
+static uint32_t pfs_table_entry(uint32_t* table, uint32_t index, int allocate, int entry_is_table) {
+    uint32_t pointers[PFS_PTRS_PER_BLOCK];
+
+    if (*table == 0) {
+        if (!allocate) {
+            return 0;
+        }
+        *table = pfs_alloc_zeroed_block();
+        if (*table == 0) {
+            return 0;
+        }
+        memset(pointers, 0, sizeof(pointers));
+    } else if (pfs_read_block(*table, pointers) != 0) {
+        return 0;
+    }
+
+    if (pointers[index] == 0 && allocate) {
+        pointers[index] = entry_is_table ? pfs_alloc_zeroed_block() : pfs_alloc_block();
+        if (pointers[index] == 0 || pfs_write_block(*table, pointers) != 0) {
+            return 0;
+        }
+    }
+    return pointers[index];
+}
+
+// Map block `index` of a file to its disk block (0 for a hole)
+static uint32_t pfs_bmap(pfs_inode_t* inode, uint32_t index, int allocate) {
+    if (index < PFS_DIRECT_BLOCKS) {
+        if (inode->direct[index] == 0 && allocate) {
+            inode->direct[index] = pfs_alloc_block();
+        }
+        return inode->direct[index];
+    }
+
+    index -= PFS_DIRECT_BLOCKS;
+    if (index < PFS_PTRS_PER_BLOCK) {
+        return pfs_table_entry(&inode->indirect, index, allocate, 0);
+    }
+
+    index -= PFS_PTRS_PER_BLOCK;
+    if (index < PFS_PTRS_PER_BLOCK * PFS_PTRS_PER_BLOCK) {
+        uint32_t table = pfs_table_entry(&inode->double_indirect, index / PFS_PTRS_PER_BLOCK, allocate, 1);
+        if (table == 0) {
+            return 0;
+        }
+        return pfs_table_entry(&table, index % PFS_PTRS_PER_BLOCK, allocate, 0);
+    }
+
+    return 0; // Past the largest file PhantomFS can hold
+}
+
+// Free the blocks a pointer table maps from index `first` on; a table of
+// depth 2 points at depth 1 tables. The table itself goes once it is empty.
+static void pfs_free_table(uint32_t* table, uint32_t first, int depth) {
+    uint32_t pointers[PFS_PTRS_PER_BLOCK];
+
+    if (*table == 0 || pfs_read_block(*table, pointers) != 0) {
+        return;
+    }
+
+    uint32_t span = depth == 2 ? PFS_PTRS_PER_BLOCK : 1;
+    int changed = 0;
+    int in_use = 0;
+
+    for (uint32_t i = 0; i < PFS_PTRS_PER_BLOCK; i++) {
+        if (pointers[i] != 0 && (i + 1) * span > first) {
+            if (depth == 2) {
+                uint32_t before = pointers[i];
+                pfs_free_table(&pointers[i], first > i * span ? first - i * span : 0, 1);
+                changed |= pointers[i] != before;
+            } else {
+                pfs_free_block(pointers[i]);
+                pointers[i] = 0;
+                changed = 1;
+            }
+        }
+        if (pointers[i] != 0) {
+            in_use = 1;
+        }
+    }
+
+    if (!in_use) {
+        pfs_free_block(*table);
+        *table = 0;
+    } else if (changed) {
+        pfs_write_block(*table, pointers);
+    }
+}
+
+// Free every block of an inode from file block `first` onwards
+static void pfs_free_blocks(pfs_inode_t* inode, uint32_t first) {
+    for (uint32_t i = first; i < PFS_DIRECT_BLOCKS; i++) {
+        if (inode->direct[i]) {
+            pfs_free_block(inode->direct[i]);
+            inode->direct[i] = 0;
+        }
+    }
+
+    uint32_t rest = first > PFS_DIRECT_BLOCKS ? first - PFS_DIRECT_BLOCKS : 0;
+    pfs_free_table(&inode->indirect, rest, 1);
+    rest = rest > PFS_PTRS_PER_BLOCK ? rest - PFS_PTRS_PER_BLOCK : 0;
+    pfs_free_table(&inode->double_indirect, rest, 2);
+}
+
+// Add an entry to a directory, reusing a free slot if there is one
+static int pfs_add_dirent(uint32_t dir_number, const char* name, uint32_t number) {
+    uint8_t buffer[PFS_BLOCK_SIZE];
+    pfs_dirent_t* entries = (pfs_dirent_t*)buffer;
+    pfs_inode_t dir;
+    uint32_t block = 0;
+    uint32_t slot;
+
+    if (pfs_read_inode(dir_number, &dir) != 0) {
+        return -1;
+    }
+
+    uint32_t slots = dir.size / sizeof(pfs_dirent_t);
+    for (slot = 0; slot < slots; slot++) {
+        if (slot % PFS_DIRENTS_PER_BLOCK == 0) {
+            block = pfs_bmap(&dir, slot / PFS_DIRENTS_PER_BLOCK, 0);
+            if (block == 0 || pfs_read_block(block, buffer) != 0) {
+                return -1;
+            }
+        }
+        if (entries[slot % PFS_DIRENTS_PER_BLOCK].inode == 0) {
+            break;
+        }
+    }
+
+    if (slot == slots) {
+        // No free slot - append one, starting a new block when the last is full
+        if (slot % PFS_DIRENTS_PER_BLOCK == 0) {
+            block = pfs_bmap(&dir, slot / PFS_DIRENTS_PER_BLOCK, 1);
+            if (block == 0) {
+                pfs_write_inode(dir_number, &dir); // Keep any table that was allocated
+                return -1;
+            }
+            memset(buffer, 0, sizeof(buffer));
+        }
+        dir.size += sizeof(pfs_dirent_t);
+    }
+
+    pfs_dirent_t* entry = &entries[slot % PFS_DIRENTS_PER_BLOCK];
+    memset(entry, 0, sizeof(pfs_dirent_t));
+    entry->inode = number;
+    strncpy(entry->name, name, PFS_NAME_LENGTH);
+    dir.modification_time = get_current_time();
+
+    if (pfs_write_block(block, buffer) != 0) {
+        return -1;
+    }
+    return pfs_write_inode(dir_number, &dir);
+}
+
+// Clear the directory entry that links `number` under `name`
+static int pfs_remove_dirent(uint32_t dir_number, const char* name, uint32_t number) {
+    uint8_t buffer[PFS_BLOCK_SIZE];
+    pfs_dirent_t* entries = (pfs_dirent_t*)buffer;
+    pfs_inode_t dir;
+    uint32_t block = 0;
+
+    if (pfs_read_inode(dir_number, &dir) != 0) {
+        return -1;
+    }
+
+    uint32_t slots = dir.size / sizeof(pfs_dirent_t);
+    for (uint32_t slot = 0; slot < slots; slot++) {
+        if (slot % PFS_DIRENTS_PER_BLOCK == 0) {
+            block = pfs_bmap(&dir, slot / PFS_DIRENTS_PER_BLOCK, 0);
+            if (block == 0 || pfs_read_block(block, buffer) != 0) {
+                return -1;
+            }
+        }
+
+        pfs_dirent_t* entry = &entries[slot % PFS_DIRENTS_PER_BLOCK];
+        if (entry->inode == number && strncmp(entry->name, name, PFS_NAME_LENGTH) == 0) {
+            memset(entry, 0, sizeof(pfs_dirent_t));
+            dir.modification_time = get_current_time();
+            if (pfs_write_block(block, buffer) != 0) {
+                return -1;
+            }
+            return pfs_write_inode(dir_number, &dir);
+        }
+    }
+
+    return -1;
+}
+
+// Give a node a fresh on-disk inode
+static int pfs_create_inode(fs_node_t* node) {
+    pfs_inode_t inode;
+    uint32_t number;
+
+    for (number = 1; number < superblock.inode_count; number++) {
+        if (!bitmap_test(inode_bitmap, number)) {
+            break;
+        }
+    }
+    if (number >= superblock.inode_count) {
+        return -1; // Out of inodes
+    }
+
+    memset(&inode, 0, sizeof(inode));
+    inode.type = node->type == FILE_TYPE_DIRECTORY ? PFS_TYPE_DIR : PFS_TYPE_FILE;
+    inode.creation_time = node->creation_time;
+    inode.modification_time = node->modification_time;
+    if (pfs_write_inode(number, &inode) != 0) {
+        return -1;
+    }
+
+    bitmap_set(inode_bitmap, number);
+    free_inodes--;
+    node->inode = number;
+    return 0;
+}
+
+// Load a regular file's data into memory
+static int pfs_load_data(fs_node_t* node, pfs_inode_t* inode) {
+    uint8_t buffer[PFS_BLOCK_SIZE];
+    uint32_t blocks = (inode->size + PFS_BLOCK_SIZE - 1) / PFS_BLOCK_SIZE;
+
+    for (uint32_t i = 0; i < blocks; i++) {
+        uint32_t block = pfs_bmap(inode, i, 0);
+        if (block == 0) {
+            continue; // Hole
+        }
+
+        size_t chunk = inode->size - i * PFS_BLOCK_SIZE;
+        if (chunk > PFS_BLOCK_SIZE) {
+            chunk = PFS_BLOCK_SIZE;
+        }
+        if (pfs_read_block(block, buffer) != 0 ||
+            fs_write_at(node, i * PFS_BLOCK_SIZE, (const char*)buffer, chunk) != (int)chunk) {
+            return -1;
+        }
+    }
+
+    return fs_truncate(node, inode->size);
+}
+
+// Create the node for one directory entry; bad entries are skipped
+static int pfs_load_entry(fs_node_t* dir, pfs_dirent_t* entry) {
+    pfs_inode_t inode;
+
+    entry->name[PFS_NAME_LENGTH - 1] = '\0';
+    if (entry->inode >= superblock.inode_count || bitmap_test(loaded_bitmap, entry->inode) ||
+        pfs_read_inode(entry->inode, &inode) != 0 ||
+        (inode.type != PFS_TYPE_FILE && inode.type != PFS_TYPE_DIR) ||
+        inode.size / PFS_BLOCK_SIZE >= PFS_MAX_FILE_BLOCKS) {
+        terminal_writestring("diskfs: skipping bad entry '");
+        terminal_writestring(entry->name);
+        terminal_writestring("'\n");
+        return 0;
+    }
+    bitmap_set(loaded_bitmap, entry->inode);
+
+    fs_node_t* node = fs_create_file(entry->name, inode.type == PFS_TYPE_DIR ? FILE_TYPE_DIRECTORY : FILE_TYPE_REGULAR);
+    if (!node) {
+        return -1;
+    }
+    node->inode = entry->inode;
+
+    if (inode.type == PFS_TYPE_FILE && pfs_load_data(node, &inode) != 0) {
+        fs_delete_node(node);
+        return -1;
+    }
+    if (fs_add_child(dir, node) != 0) {
+        terminal_writestring("diskfs: skipping duplicate entry '");
+        terminal_writestring(entry->name);
+        terminal_writestring("'\n");
+        fs_delete_node(node);
+        return 0;
+    }
+
+    node->creation_time = inode.creation_time;
+    node->modification_time = inode.modification_time;
+    return 0;
+}
+
+// Load the entries of a directory as children of `dir`
+static int pfs_load_dir(fs_node_t* dir) {
+    uint8_t buffer[PFS_BLOCK_SIZE];
+    pfs_dirent_t* entries = (pfs_dirent_t*)buffer;
+    pfs_inode_t inode;
+
+    if (pfs_read_inode(dir->inode, &inode) != 0 || inode.type != PFS_TYPE_DIR) {
+        return -1;
+    }
+
+    uint32_t slots = inode.size / sizeof(pfs_dirent_t);
+    for (uint32_t slot = 0; slot < slots; slot++) {
+        if (slot % PFS_DIRENTS_PER_BLOCK == 0) {
+            uint32_t block = pfs_bmap(&inode, slot / PFS_DIRENTS_PER_BLOCK, 0);
+            if (block == 0 || pfs_read_block(block, buffer) != 0) {
+                return -1;
+            }
+        }
+
+        pfs_dirent_t* entry = &entries[slot % PFS_DIRENTS_PER_BLOCK];
+        if (entry->inode != 0 && pfs_load_entry(dir, entry) != 0) {
+            return -1;
+        }
+    }
+
+    dir->creation_time = inode.creation_time;
+    dir->modification_time = inode.modification_time;
+    return 0;
+}
+
+// Load every directory under `root`, walking the tree in preorder as it is built
+static int pfs_load_tree(fs_node_t* root) {
+    fs_node_t* node = root;
+
+    while (node) {
+        if (node->type == FILE_TYPE_DIRECTORY && pfs_load_dir(node) != 0) {
+            return -1;
+        }
+
+        if (node->first_child) {
+            node = node->first_child;
+        } else {
+            while (node != root && !node->next_sibling) {
+                node = node->parent;
+            }
+            node = node == root ? NULL : node->next_sibling;
+        }
+    }
+
+    return 0;
+}
+
+// Sanity-check the superblock against a disk of `disk_blocks` blocks
+static int pfs_check_superblock(uint32_t disk_blocks) {
+    pfs_superblock_t* sb = &superblock;
+
+    if (sb->magic != PFS_MAGIC || sb->version != PFS_VERSION || sb->block_size != PFS_BLOCK_SIZE) {
+        return -1;
+    }
+    if (sb->total_blocks > disk_blocks || sb->bitmap_start == 0 ||
+        sb->bitmap_start >= sb->total_blocks || sb->bitmap_blocks > sb->total_blocks ||
+        sb->inode_blocks > sb->total_blocks ||
+        sb->inode_start < sb->bitmap_start + sb->bitmap_blocks ||
+        sb->data_start < sb->inode_start + sb->inode_blocks ||
+        sb->data_start >= sb->total_blocks) {
+        return -1;
+    }
+    if (sb->bitmap_blocks < (sb->total_blocks + PFS_BITS_PER_BLOCK - 1) / PFS_BITS_PER_BLOCK ||
+        sb->inode_count > sb->inode_blocks * PFS_INODES_PER_BLOCK ||
+        sb->root_inode == 0 || sb->root_inode >= sb->inode_count) {
+        return -1;
+    }
+    return 0;
+}
+
+// Read the block bitmap and build the inode bitmap from the inode table
+static int pfs_load_bitmaps(void) {
+    uint8_t buffer[PFS_BLOCK_SIZE];
+    size_t inode_bytes = (superblock.inode_count + 7) / 8;
+
+    block_bitmap = (uint8_t*)kmalloc(superblock.bitmap_blocks * PFS_BLOCK_SIZE);
+    inode_bitmap = (uint8_t*)kmalloc(inode_bytes);
+    loaded_bitmap = (uint8_t*)kmalloc(inode_bytes);
+    if (!block_bitmap || !inode_bitmap || !loaded_bitmap) {
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < superblock.bitmap_blocks; i++) {
+        if (pfs_read_block(superblock.bitmap_start + i, &block_bitmap[i * PFS_BLOCK_SIZE]) != 0) {
+            return -1;
+        }
+    }
+
+    free_blocks = 0;
+    for (uint32_t block = superblock.data_start; block < superblock.total_blocks; block++) {
+        if (!bitmap_test(block_bitmap, block)) {
+            free_blocks++;
+        }
+    }
+
+    memset(inode_bitmap, 0, inode_bytes);
+    memset(loaded_bitmap, 0, inode_bytes);
+    bitmap_set(inode_bitmap, 0); // Inode 0 means "no inode"
+    free_inodes = superblock.inode_count - 1;
+
+    for (uint32_t i = 0; i < superblock.inode_blocks; i++) {
+        if (pfs_read_block(superblock.inode_start + i, buffer) != 0) {
+            return -1;
+        }
+        pfs_inode_t* inodes = (pfs_inode_t*)buffer;
+        for (uint32_t j = 0; j < PFS_INODES_PER_BLOCK; j++) {
+            uint32_t number = i * PFS_INODES_PER_BLOCK + j;
+            if (number != 0 && number < superblock.inode_count && inodes[j].type != PFS_TYPE_FREE) {
+                bitmap_set(inode_bitmap, number);
+                free_inodes--;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static void pfs_free_bitmaps(void) {
+    kfree(block_bitmap);
+    kfree(inode_bitmap);
+    kfree(loaded_bitmap);
+    block_bitmap = NULL;
+    inode_bitmap = NULL;
+    loaded_bitmap = NULL;
+}
+
+// Mount the PhantomFS volume on the boot disk and load it under `root`
+int diskfs_mount(fs_node_t* root) {
+    uint8_t buffer[PFS_BLOCK_SIZE];
+
+    mounted = 0;
+    block_hint = 0;
+    pfs_free_bitmaps();
+
+    if (ata_init() != 0 || ata_get_sector_count() <= PFS_START_LBA) {
+        return -1;
+    }
+
+    boot_disk.sector_count = ata_get_sector_count();
+    if (bcache_init(&boot_disk) != 0 || bcache_read(PFS_START_LBA, buffer) != 0) {
+        return -1;
+    }
+
+    memcpy(&superblock, buffer, sizeof(superblock));
+    if (pfs_check_superblock(ata_get_sector_count() - PFS_START_LBA) != 0) {
+        superblock.total_blocks = 0;
+        return -1;
+    }
+
+    if (pfs_load_bitmaps() != 0 || !bitmap_test(inode_bitmap, superblock.root_inode)) {
+        pfs_free_bitmaps();
+        return -1;
+    }
+
+    root->inode = superblock.root_inode;
+    bitmap_set(loaded_bitmap, root->inode);
+    int result = pfs_load_tree(root);
+    kfree(loaded_bitmap);
+    loaded_bitmap = NULL;
+
+    if (result != 0) {
+        // Whatever was loaded stays in memory but nothing is written back
+        root->inode = 0;
+        pfs_free_bitmaps();
+        return -1;
+    }
+
+    superblock.mount_count++;
+    memcpy(buffer, &superblock, sizeof(superblock));
+    pfs_write_block(0, buffer);
+
+    mounted = 1;
+    return 0;
+}
+
+int diskfs_is_mounted(void) {
+    return mounted;
+}
+
+void diskfs_get_stats(diskfs_stats_t* stats) {
+    memset(stats, 0, sizeof(diskfs_stats_t));
+    stats->mounted = mounted;
+    if (mounted) {
+        stats->total_blocks = superblock.total_blocks;
+        stats->free_blocks = free_blocks;
+        stats->inode_count = superblock.inode_count - 1;
+        stats->free_inodes = free_inodes;
+        stats->mount_count = superblock.mount_count;
+    }
+}
+
+// Link `child` into `parent` on disk, creating its inode the first time
+int diskfs_link(fs_node_t* parent, fs_node_t* child) {
+    if (!mounted || !parent->inode) {
+        return 0;
+    }
+
+    int created = 0;
+    if (!child->inode) {
+        if (pfs_create_inode(child) != 0) {
+            return -1;
+        }
+        created = 1;
+    }
+
+    // A new file may already have data (cp builds the clone before linking it)
+    if ((created && child->type == FILE_TYPE_REGULAR && diskfs_write(child, 0, child->size) != 0) ||
+        pfs_add_dirent(parent->inode, child->name, child->inode) != 0) {
+        if (created) {
+            diskfs_release(child);
+        }
+        return -1;
+    }
+
+    return 0;
+}
+
+// Remove `child`'s entry from `parent` on disk (its inode is kept)
+void diskfs_unlink(fs_node_t* parent, fs_node_t* child) {
+    if (mounted && parent->inode && child->inode) {
+        pfs_remove_dirent(parent->inode, child->name, child->inode);
+    }
+}
+
+// Free a node's inode and all of its blocks
+void diskfs_release(fs_node_t* node) {
+    pfs_inode_t inode;
+
+    if (!mounted || !node->inode) {
+        return;
+    }
+
+    if (pfs_read_inode(node->inode, &inode) == 0) {
+        pfs_free_blocks(&inode, 0);
+        memset(&inode, 0, sizeof(inode));
+        pfs_write_inode(node->inode, &inode);
+    }
+
+    bitmap_clear(inode_bitmap, node->inode);
+    free_inodes++;
+    node->inode = 0;
+}
+
+// Allocate every block a write of `size` bytes at `offset` will need, so
+// that a full disk fails the write before the file changes in memory. On
+// failure the blocks just added past the end of the file are freed again;
+// holes inside it that were filled are zeroed so they still read as holes.
+int diskfs_reserve(fs_node_t* file, size_t offset, size_t size) {
+    uint8_t zero[PFS_BLOCK_SIZE];
+    pfs_inode_t inode;
+    int result = 0;
+
+    if (!mounted || !file->inode || size == 0) {
+        return 0;
+    }
+    if (pfs_read_inode(file->inode, &inode) != 0) {
+        return -1;
+    }
+
+    memset(zero, 0, sizeof(zero));
+    uint32_t keep = (inode.size + PFS_BLOCK_SIZE - 1) / PFS_BLOCK_SIZE;
+    uint32_t first = offset / PFS_BLOCK_SIZE;
+    uint32_t end = (offset + size + PFS_BLOCK_SIZE - 1) / PFS_BLOCK_SIZE;
+
+    for (uint32_t i = first; i < end && result == 0; i++) {
+        if (i < keep && pfs_bmap(&inode, i, 0) == 0) {
+            uint32_t block = pfs_bmap(&inode, i, 1);
+            if (block == 0 || pfs_write_block(block, zero) != 0) {
+                result = -1;
+            }
+        } else if (pfs_bmap(&inode, i, 1) == 0) {
+            result = -1; // Disk full
+        }
+    }
+
+    if (result != 0) {
+        pfs_free_blocks(&inode, keep);
+    }
+    if (pfs_write_inode(file->inode, &inode) != 0) {
+        result = -1;
+    }
+    return result;
+}
+
+// Write `size` bytes of a file starting at `offset` through to disk
+int diskfs_write(fs_node_t* file, size_t offset, size_t size) {
+    uint8_t zero[PFS_BLOCK_SIZE];
+    pfs_inode_t inode;
+    int result = 0;
+
+    if (!mounted || !file->inode) {
+        return 0;
+    }
+    if (pfs_read_inode(file->inode, &inode) != 0) {
+        return -1;
+    }
+
+    memset(zero, 0, sizeof(zero));
+    uint32_t first = offset / PFS_BLOCK_SIZE;
+    uint32_t end = (offset + size + PFS_BLOCK_SIZE - 1) / PFS_BLOCK_SIZE;
+
+    for (uint32_t i = first; i < end && result == 0; i++) {
+        fs_block_t* data = i < file->block_capacity ? file->blocks[i] : NULL;
+        uint32_t block = pfs_bmap(&inode, i, data != NULL);
+
+        if (data) {
+            if (block == 0 || pfs_write_block(block, data->data) != 0) {
+                result = -1; // Disk full or write error
+            }
+        } else if (block != 0 && pfs_write_block(block, zero) != 0) {
+            result = -1;
+        }
+    }
+
+    inode.size = file->size;
+    inode.modification_time = file->modification_time;
+    if (pfs_write_inode(file->inode, &inode) != 0) {
+        result = -1;
+    }
+    return result;
+}
+
+// Bring a file's on-disk size and blocks in line after fs_truncate
+int diskfs_truncate(fs_node_t* file) {
+    pfs_inode_t inode;
+    int result = 0;
+
+    if (!mounted || !file->inode) {
+        return 0;
+    }
+    if (pfs_read_inode(file->inode, &inode) != 0) {
+        return -1;
+    }
+
+    uint32_t keep = (file->size + PFS_BLOCK_SIZE - 1) / PFS_BLOCK_SIZE;
+    pfs_free_blocks(&inode, keep);
+
+    // Shrinking zeroed the tail of the last kept block in memory
+    if (file->size < inode.size && file->size % PFS_BLOCK_SIZE != 0 &&
+        keep <= file->block_capacity && file->blocks[keep - 1]) {
+        uint32_t block = pfs_bmap(&inode, keep - 1, 0);
+        if (block != 0 && pfs_write_block(block, file->blocks[keep - 1]->data) != 0) {
+            result = -1;
+        }
+    }
+
+    inode.size = file->size;
+    inode.modification_time = file->modification_time;
+    if (pfs_write_inode(file->inode, &inode) != 0) {
+        result = -1;
+    }
+    return result;
+}
@@ -0,0 +1,31 @@
+#ifndef DISKFS_H
+#define DISKFS_H
+
+#include "kernel.h"
+#include "filesystem.h"
+#include "pfs.h"
+
+// Disk usage statistics
+typedef struct {
+    int mounted;
+    uint32_t total_blocks;
+    uint32_t free_blocks;
+    uint32_t inode_count;
+    uint32_t free_inodes;
+    uint32_t mount_count;
+} diskfs_stats_t;
+
+// Mount the PhantomFS volume on the boot disk and load it under `root`
+int diskfs_mount(fs_node_t* root);
+int diskfs_is_mounted(void);
+void diskfs_get_stats(diskfs_stats_t* stats);
+
+// Write-through hooks called by the in-memory file system
+int diskfs_link(fs_node_t* parent, fs_node_t* child);
+void diskfs_unlink(fs_node_t* parent, fs_node_t* child);
+void diskfs_release(fs_node_t* node);
+int diskfs_reserve(fs_node_t* file, size_t offset, size_t size);
+int diskfs_write(fs_node_t* file, size_t offset, size_t size);
+int diskfs_truncate(fs_node_t* file);
+
+#endif // DISKFS_H
@@ -12,22 +12,290 @@
 #define SCANCODE_LEFT 0x4B
 #define SCANCODE_RIGHT 0x4D
 
+// Control characters (the keyboard handler turns Ctrl+letter into these)
+#define KEY_CTRL_R 0x12
+
+#define EDITOR_UNDO_INSERT 0
+#define EDITOR_UNDO_DELETE 1
+#define EDITOR_UNDO_RUN_MAX 256     // Longest record that keystrokes keep extending
+
+#define EDITOR_STATUS_ROW EDITOR_SCREEN_LINES
+#define EDITOR_MESSAGE_ROW (EDITOR_SCREEN_LINES + 1)
+#define EDITOR_SCREEN_COLUMNS 80
+#define EDITOR_TEXT_COLUMN 5         // After the line number
+#define EDITOR_TEXT_COLUMNS (EDITOR_SCREEN_COLUMNS - EDITOR_TEXT_COLUMN)
+
+// Note that screen columns `from` to `to` (exclusive) of buffer line `line`
+// changed
+static void editor_mark_span(editor_state_t* editor, int line, int from, int to) {
+    int row = line - editor->view_start_line;
+    if (row < 0 || row >= EDITOR_SCREEN_LINES) {
+        return;
+    }
+    if (to > EDITOR_SCREEN_COLUMNS) {
+        to = EDITOR_SCREEN_COLUMNS;
+    }
+    if (!(editor->dirty_rows & (1u << row))) {
+        editor->dirty_rows |= 1u << row;
+        editor->dirty_from[row] = from;
+        editor->dirty_to[row] = to;
+        return;
+    }
+    if (from < editor->dirty_from[row]) {
+        editor->dirty_from[row] = from;
+    }
+    if (to > editor->dirty_to[row]) {
+        editor->dirty_to[row] = to;
+    }
+}
+
+// Note that text columns `from` to `to` (exclusive) of buffer line `line`
+// changed
+static void editor_mark_text(editor_state_t* editor, int line, int from, int to) {
+    from -= editor->view_start_column;
+    to -= editor->view_start_column;
+    if (from < 0) {
+        from = 0;
+    }
+    if (to > from) {
+        editor_mark_span(editor, line, from + EDITOR_TEXT_COLUMN, to + EDITOR_TEXT_COLUMN);
+    }
+}
+
+static inline int editor_line_count(editor_state_t* editor) {
+    return textbuf_line_count(&editor->text);
+}
+
+static inline int editor_line_length(editor_state_t* editor, int line) {
+    return textbuf_line_length(&editor->text, line);
+}
+
+// Text offset of the cursor
+static inline uint32_t editor_cursor_offset(editor_state_t* editor) {
+    return textbuf_line_start(&editor->text, editor->cursor_y) + editor->cursor_x;
+}
+
+// Note that buffer lines `first` to `last` changed; a `last` of -1 also
+// takes in every line below, for lines inserted or removed
+static void editor_mark_lines(editor_state_t* editor, int first, int last) {
+    int top = first - editor->view_start_line;
+    int bottom = last < 0 ? EDITOR_SCREEN_LINES - 1 : last - editor->view_start_line;
+    if (top < 0) {
+        top = 0;
+    }
+    if (bottom >= EDITOR_SCREEN_LINES) {
+        bottom = EDITOR_SCREEN_LINES - 1;
+    }
+    for (int row = top; row <= bottom; row++) {
+        editor_mark_span(editor, row + editor->view_start_line, 0, EDITOR_SCREEN_COLUMNS);
+    }
+}
+
+// Undo record: this header, the inserted or deleted text, then the
+// record's size as a uint16_t so the log can be walked backwards
+typedef struct {
+    uint32_t pos;
+    uint16_t length;
+    uint16_t type;
+} editor_undo_t;
+
+static inline uint32_t editor_undo_size(uint32_t length) {
+    return (sizeof(editor_undo_t) + length + sizeof(uint16_t) + 3) & ~3u;
+}
+
+static inline char* editor_undo_text(editor_undo_t* record) {
+    return (char*)(record + 1);
+}
+
+static void editor_undo_seal(editor_state_t* editor, uint32_t offset, editor_undo_t* record) {
+    uint32_t size = editor_undo_size(record->length);
+    *(uint16_t*)(editor->undo_log + offset + size - sizeof(uint16_t)) = size;
+    editor->undo_used = offset + size;
+    editor->undo_end = editor->undo_used;
+}
+
+// Last record undo would take back, if keystrokes may still extend it
+static editor_undo_t* editor_undo_mergeable(editor_state_t* editor, uint16_t type) {
+    if (!editor->undo_merge || editor->undo_used == 0) {
+        return NULL;
+    }
+    uint16_t size = *(uint16_t*)(editor->undo_log + editor->undo_used - sizeof(uint16_t));
+    editor_undo_t* record = (editor_undo_t*)(editor->undo_log + editor->undo_used - size);
+    if (record->type != type || record->length >= EDITOR_UNDO_RUN_MAX ||
+        editor->undo_used - size + editor_undo_size(record->length + 1) > EDITOR_UNDO_SIZE) {
+        return NULL;
+    }
+    return record;
+}
+
+// Start a record for a change of `length` bytes at `pos` and return it,
+// dropping the changes redo would replay and, if the log is full, the
+// oldest ones. A change that cannot be recorded empties the log, since
+// the records before it would no longer apply.
+static editor_undo_t* editor_undo_push(editor_state_t* editor, uint16_t type,
+                                       uint32_t pos, uint32_t length) {
+    uint32_t size = editor_undo_size(length);
+    editor->undo_end = editor->undo_used;
+    editor->undo_merge = 0;
+    if (size > EDITOR_UNDO_SIZE) {
+        editor->undo_used = editor->undo_end = 0;
+        return NULL;
+    }
+    if (!editor->undo_log) {
+        editor->undo_log = (char*)kmalloc(EDITOR_UNDO_SIZE);
+        if (!editor->undo_log) {
+            editor->undo_used = editor->undo_end = 0;
+            return NULL;
+        }
+    }
+    
+    if (editor->undo_used + size > EDITOR_UNDO_SIZE) {
+        // Free a quarter of the log beyond what is needed, so this stays rare
+        uint32_t wanted = editor->undo_used + size - EDITOR_UNDO_SIZE + EDITOR_UNDO_SIZE / 4;
+        uint32_t dropped = 0;
+        while (dropped < wanted && dropped < editor->undo_used) {
+            dropped += editor_undo_size(((editor_undo_t*)(editor->undo_log + dropped))->length);
+        }
+        for (uint32_t i = dropped; i < editor->undo_used; i++) {
+            editor->undo_log[i - dropped] = editor->undo_log[i];
+        }
+        editor->undo_used -= dropped;
+    }
+    
+    editor_undo_t* record = (editor_undo_t*)(editor->undo_log + editor->undo_used);
+    record->pos = pos;
+    record->length = length;
+    record->type = type;
+    editor_undo_seal(editor, editor->undo_used, record);
+    return record;
+}
+
+// Insert text and record it; typed characters extend the record of the
+// ones typed just before them
+static int editor_text_insert(editor_state_t* editor, uint32_t pos, const char* text,
+                              uint32_t length, int typed) {
+    if (textbuf_insert(&editor->text, pos, text, length) != 0) {
+        return -1;
+    }
+    
+    editor_undo_t* record = typed ? editor_undo_mergeable(editor, EDITOR_UNDO_INSERT) : NULL;
+    if (record && length == 1 && pos == record->pos + record->length) {
+        editor_undo_text(record)[record->length++] = text[0];
+        editor_undo_seal(editor, (char*)record - editor->undo_log, record);
+    } else {
+        record = editor_undo_push(editor, EDITOR_UNDO_INSERT, pos, length);
+        if (record) {
+            memcpy(editor_undo_text(record), text, length);
+        }
+    }
+    editor->undo_merge = typed;
+    return 0;
+}
+
+// Delete text and record it; backspace and x runs share a record
+static void editor_text_delete(editor_state_t* editor, uint32_t pos, uint32_t length, int typed) {
+    editor_undo_t* record = typed ? editor_undo_mergeable(editor, EDITOR_UNDO_DELETE) : NULL;
+    if (record && length == 1 && pos + 1 == record->pos) {
+        // Backspace: the character goes in front
+        char* text = editor_undo_text(record);
+        for (uint32_t i = record->length; i > 0; i--) {
+            text[i] = text[i - 1];
+        }
+        text[0] = textbuf_char_at(&editor->text, pos);
+        record->pos = pos;
+        record->length++;
+        editor_undo_seal(editor, (char*)record - editor->undo_log, record);
+    } else if (record && length == 1 && pos == record->pos) {
+        // x: the character goes after the ones deleted before it
+        editor_undo_text(record)[record->length++] = textbuf_char_at(&editor->text, pos);
+        editor_undo_seal(editor, (char*)record - editor->undo_log, record);
+    } else {
+        record = editor_undo_push(editor, EDITOR_UNDO_DELETE, pos, length);
+        if (record) {
+            textbuf_read(&editor->text, pos, editor_undo_text(record), length);
+        }
+    }
+    editor->undo_merge = typed;
+    textbuf_delete(&editor->text, pos, length);
+}
+
+// Put the cursor at a text offset after undo or redo changed the text there
+static void editor_undo_show(editor_state_t* editor, uint32_t pos) {
+    editor->cursor_y = textbuf_line_of(&editor->text, pos);
+    editor->cursor_x = pos - textbuf_line_start(&editor->text, editor->cursor_y);
+    editor_mark_lines(editor, editor->cursor_y, -1);
+    editor->modified = 1;
+    editor->undo_merge = 0;
+    editor_move_cursor(editor, 0, 0);
+}
+
+// Take back the last change
+void editor_undo(editor_state_t* editor) {
+    if (editor->undo_used == 0) {
+        editor_set_status(editor, "Already at oldest change");
+        return;
+    }
+    uint16_t size = *(uint16_t*)(editor->undo_log + editor->undo_used - sizeof(uint16_t));
+    editor_undo_t* record = (editor_undo_t*)(editor->undo_log + editor->undo_used - size);
+    
+    if (record->type == EDITOR_UNDO_INSERT) {
+        textbuf_delete(&editor->text, record->pos, record->length);
+    } else if (textbuf_insert(&editor->text, record->pos, editor_undo_text(record),
+                              record->length) != 0) {
+        editor_set_status(editor, "Out of memory");
+        return;
+    }
+    editor->undo_used -= size;
+    editor_undo_show(editor, record->pos);
+}
+
+// Make the last change undo took back again
+void editor_redo(editor_state_t* editor) {
+    if (editor->undo_used == editor->undo_end) {
+        editor_set_status(editor, "Already at newest change");
+        return;
+    }
+    editor_undo_t* record = (editor_undo_t*)(editor->undo_log + editor->undo_used);
+    
+    if (record->type == EDITOR_UNDO_DELETE) {
+        textbuf_delete(&editor->text, record->pos, record->length);
+    } else if (textbuf_insert(&editor->text, record->pos, editor_undo_text(record),
+                              record->length) != 0) {
+        editor_set_status(editor, "Out of memory");
+        return;
+    }
+    editor->undo_used += editor_undo_size(record->length);
+    editor_undo_show(editor, record->pos);
+}
+
 // Initialize editor state
 void editor_init(editor_state_t* editor) {
-    editor->line_count = 1;
+    textbuf_init(&editor->text);
     editor->cursor_x = 0;
     editor->cursor_y = 0;
     editor->view_start_line = 0;
+    editor->view_start_column = 0;
     editor->mode = MODE_NORMAL;
     editor->filename[0] = '\0';
     editor->modified = 0;
     editor->command_length = 0;
     editor->command_buffer[0] = '\0';
+    editor->dirty_rows = 0;
+    editor->redraw_all = 1;
+    editor->drawn_cursor_y = -1;
+    editor->undo_log = NULL;
+    editor->undo_used = 0;
+    editor->undo_end = 0;
+    editor->undo_merge = 0;
     editor_set_status(editor, "-- NORMAL --");
-    
-    // Initialize buffer with empty lines
-    for (int i = 0; i < EDITOR_MAX_LINES; i++) {
-        editor->buffer[i][0] = '\0';
+}
+
+// Release the text when the editor closes
+void editor_free(editor_state_t* editor) {
+    textbuf_free(&editor->text);
+    if (editor->undo_log) {
+        kfree(editor->undo_log);
+        editor->undo_log = NULL;
     }
 }
 
@@ -38,141 +306,192 @@ void editor_open(editor_state_t* editor, const char* filename) {
     // Try to read the file
     fs_node_t* node = fs_resolve_path(filename);
     if (node && node->type == FILE_TYPE_REGULAR) {
-        char* content = fs_read_file(node);
-        if (content) {
-            // Parse content into lines
-            int line = 0;
-            int col = 0;
-            
-            for (int i = 0; content[i] != '\0' && line < EDITOR_MAX_LINES; i++) {
-                if (content[i] == '\n') {
-                    editor->buffer[line][col] = '\0';
-                    line++;
-                    col = 0;
-                } else if (col < EDITOR_MAX_LINE_LENGTH - 1) {
-                    editor->buffer[line][col] = content[i];
-                    col++;
+        // Append the file block by block, leaving out NUL bytes
+        char chunk[FS_BLOCK_SIZE];
+        size_t offset = 0;
+        int count;
+        
+        while ((count = fs_read_file(node, offset, chunk, sizeof(chunk))) > 0) {
+            int run = 0;
+            for (int i = 0; i <= count; i++) {
+                if (i < count && chunk[i] != '\0') {
+                    continue;
                 }
+                if (i > run && textbuf_insert(&editor->text, textbuf_length(&editor->text),
+                                              &chunk[run], i - run) != 0) {
+                    editor_set_status(editor, "Out of memory, file only partly loaded");
+                    editor->redraw_all = 1;
+                    return;
+                }
+                run = i + 1;
             }
-            
-            if (col > 0) {
-                editor->buffer[line][col] = '\0';
-                line++;
-            }
-            
-            editor->line_count = line > 0 ? line : 1;
+            offset += count;
+        }
+        
+        // The final newline ends the last line rather than starting one
+        uint32_t length = textbuf_length(&editor->text);
+        if (length > 0 && textbuf_char_at(&editor->text, length - 1) == '\n') {
+            textbuf_delete(&editor->text, length - 1, 1);
         }
     }
+    editor->redraw_all = 1;
 }
 
 // Set status message
 void editor_set_status(editor_state_t* editor, const char* message) {
     strcpy(editor->status_message, message);
+    editor->status_dirty = 1;
 }
 
-// Draw the editor screen
-void editor_draw(editor_state_t* editor) {
-    terminal_clear();
+// Repaint columns `from` to `to` (exclusive) of a text row: line number,
+// then the line, blank past its end
+static void editor_draw_row(editor_state_t* editor, int row, int from, int to) {
+    uint8_t number_color = vga_entry_color(VGA_COLOR_DARK_GREY, VGA_COLOR_BLACK);
+    uint8_t text_color = vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+    int line_num = row + editor->view_start_line;
     
-    // Draw text buffer (lines 0-22)
-    for (int y = 0; y < 23 && y + editor->view_start_line < editor->line_count; y++) {
-        int line_num = y + editor->view_start_line;
-        
-        // Draw line number in gray
-        terminal_setcolor(vga_entry_color(VGA_COLOR_DARK_GREY, VGA_COLOR_BLACK));
-        
-        // Simple number to string conversion
-        char num_str[5];
-        int num = line_num + 1;
-        int i = 3;
-        num_str[4] = '\0';
-        
-        for (int j = 0; j < 4; j++) {
-            num_str[j] = ' ';
-        }
-        
-        while (num > 0 && i >= 0) {
-            num_str[i] = '0' + (num % 10);
-            num /= 10;
-            i--;
-        }
-        
-        for (int j = 0; j < 4; j++) {
-            terminal_putentryat(num_str[j], 
-                vga_entry_color(VGA_COLOR_DARK_GREY, VGA_COLOR_BLACK), j, y);
-        }
-        
-        // Draw text content
-        terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
-        char* line_text = editor->buffer[line_num];
-        for (int x = 0; x < strlen(line_text) && x < 75; x++) {
-            terminal_putentryat(line_text[x], 
-                vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK), x + 5, y);
+    if (line_num >= editor_line_count(editor)) {
+        for (int x = from; x < to; x++) {
+            terminal_putentryat(' ', text_color, x, row);
         }
+        return;
     }
     
-    // Draw status line (line 23)
-    terminal_setcolor(vga_entry_color(VGA_COLOR_BLACK, VGA_COLOR_WHITE));
-    for (int x = 0; x < 80; x++) {
-        terminal_putentryat(' ', vga_entry_color(VGA_COLOR_BLACK, VGA_COLOR_WHITE), x, 23);
+    // Line number, right-aligned in four columns
+    char num_str[4];
+    int num = line_num + 1;
+    for (int i = 3; i >= 0; i--) {
+        num_str[i] = num > 0 ? '0' + (num % 10) : ' ';
+        num /= 10;
     }
     
-    // Show filename and mode
-    char status[80];
-    if (editor->modified) {
-        status[0] = '[';
-        status[1] = '+';
-        status[2] = ']';
-        status[3] = ' ';
-        strcpy(&status[4], editor->filename[0] ? editor->filename : "[No Name]");
-    } else {
-        strcpy(status, editor->filename[0] ? editor->filename : "[No Name]");
+    // The visible part of the line
+    char line_text[EDITOR_TEXT_COLUMNS];
+    int len = 0;
+    if (editor->view_start_column < editor_line_length(editor, line_num)) {
+        uint32_t length = editor_line_length(editor, line_num) - editor->view_start_column;
+        len = textbuf_read(&editor->text,
+                           textbuf_line_start(&editor->text, line_num) + editor->view_start_column,
+                           line_text, length < EDITOR_TEXT_COLUMNS ? length : EDITOR_TEXT_COLUMNS);
     }
-    
-    for (int i = 0; i < strlen(status); i++) {
-        terminal_putentryat(status[i], 
-            vga_entry_color(VGA_COLOR_BLACK, VGA_COLOR_WHITE), i, 23);
+    for (int x = from; x < to; x++) {
+        int column = x - EDITOR_TEXT_COLUMN;
+        if (x < 4) {
+            terminal_putentryat(num_str[x], number_color, x, row);
+        } else {
+            terminal_putentryat(column >= 0 && column < len ? line_text[column] : ' ',
+                text_color, x, row);
+        }
     }
-    
-    // Show mode on right side
+}
+
+// Repaint the status bar (file name and mode) and the line below it
+// (command being typed or status message)
+static void editor_draw_status(editor_state_t* editor) {
+    uint8_t bar_color = vga_entry_color(VGA_COLOR_BLACK, VGA_COLOR_WHITE);
+    uint8_t text_color = vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+    const char* name = editor->filename[0] ? editor->filename : "[No Name]";
     const char* mode_str = editor->mode == MODE_INSERT ? "-- INSERT --" : 
                           editor->mode == MODE_COMMAND ? ":" : "-- NORMAL --";
-    int mode_len = strlen(mode_str);
-    for (int i = 0; i < mode_len; i++) {
-        terminal_putentryat(mode_str[i], 
-            vga_entry_color(VGA_COLOR_BLACK, VGA_COLOR_WHITE), 80 - mode_len + i, 23);
+    int mode_start = EDITOR_SCREEN_COLUMNS - strlen(mode_str);
+    int x = 0;
+    
+    if (editor->modified) {
+        for (const char* c = "[+] "; *c; c++, x++) {
+            terminal_putentryat(*c, bar_color, x, EDITOR_STATUS_ROW);
+        }
+    }
+    for (int i = 0; name[i] && x < mode_start; i++, x++) {
+        terminal_putentryat(name[i], bar_color, x, EDITOR_STATUS_ROW);
+    }
+    for (; x < mode_start; x++) {
+        terminal_putentryat(' ', bar_color, x, EDITOR_STATUS_ROW);
+    }
+    for (int i = 0; x < EDITOR_SCREEN_COLUMNS; i++, x++) {
+        terminal_putentryat(mode_str[i], bar_color, x, EDITOR_STATUS_ROW);
     }
     
-    // Draw command line (line 24)
+    x = 0;
     if (editor->mode == MODE_COMMAND) {
-        terminal_putentryat(':', vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK), 0, 24);
-        for (int i = 0; i < editor->command_length; i++) {
-            terminal_putentryat(editor->command_buffer[i], 
-                vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK), i + 1, 24);
+        terminal_putentryat(':', text_color, x++, EDITOR_MESSAGE_ROW);
+        for (int i = 0; i < editor->command_length; i++, x++) {
+            terminal_putentryat(editor->command_buffer[i], text_color, x, EDITOR_MESSAGE_ROW);
         }
         // Show cursor in command line
-        terminal_putentryat('_', vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK), 
-            editor->command_length + 1, 24);
+        terminal_putentryat('_', text_color, x++, EDITOR_MESSAGE_ROW);
     } else {
-        // Show status message
-        for (int i = 0; i < strlen(editor->status_message); i++) {
-            terminal_putentryat(editor->status_message[i], 
-                vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK), i, 24);
+        for (int i = 0; editor->status_message[i] && x < EDITOR_SCREEN_COLUMNS; i++, x++) {
+            terminal_putentryat(editor->status_message[i], text_color, x, EDITOR_MESSAGE_ROW);
         }
     }
+    for (; x < EDITOR_SCREEN_COLUMNS; x++) {
+        terminal_putentryat(' ', text_color, x, EDITOR_MESSAGE_ROW);
+    }
+}
+
+// Draw the editor screen. Only the rows marked by editor_mark_lines, the
+// status lines if they changed and the cursor's old and new cells are
+// repainted; scrolling or opening a file repaints everything.
+void editor_draw(editor_state_t* editor) {
+    uint8_t text_color = vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+    
+    if (editor->redraw_all || editor->view_start_line != editor->drawn_view_start ||
+        editor->view_start_column != editor->drawn_view_column) {
+        editor->dirty_rows = 0;
+        editor_mark_lines(editor, editor->view_start_line, -1);
+        editor->status_dirty = 1;
+        editor->drawn_cursor_y = -1;
+        editor->drawn_view_start = editor->view_start_line;
+        editor->drawn_view_column = editor->view_start_column;
+        editor->redraw_all = 0;
+    }
+    
+    // The cursor is shown in text mode only, and only on screen
+    int cursor_row = editor->cursor_y - editor->view_start_line;
+    int cursor_x = editor->cursor_x - editor->view_start_column + EDITOR_TEXT_COLUMN;
+    int cursor_y = editor->cursor_y;
+    if (editor->mode == MODE_COMMAND || cursor_row < 0 || cursor_row >= EDITOR_SCREEN_LINES ||
+        cursor_x >= EDITOR_SCREEN_COLUMNS) {
+        cursor_y = -1;
+    }
+    int cursor_moved = cursor_y != editor->drawn_cursor_y || cursor_x != editor->drawn_cursor_x;
+    
+    // Put back the text under the old cursor
+    if (cursor_moved && editor->drawn_cursor_y >= 0) {
+        editor_mark_span(editor, editor->drawn_cursor_y, editor->drawn_cursor_x,
+                         editor->drawn_cursor_x + 1);
+    }
     
-    // Position hardware cursor (blinking cursor)
-    if (editor->mode != MODE_COMMAND) {
-        int screen_y = editor->cursor_y - editor->view_start_line;
-        if (screen_y >= 0 && screen_y < 23) {
-            terminal_putentryat('_', vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK), 
-                editor->cursor_x + 5, screen_y);
+    uint32_t repainted = editor->dirty_rows;
+    for (int row = 0; repainted && row < EDITOR_SCREEN_LINES; row++) {
+        if (repainted & (1u << row)) {
+            editor_draw_row(editor, row, editor->dirty_from[row], editor->dirty_to[row]);
         }
     }
+    editor->dirty_rows = 0;
+    
+    if (editor->status_dirty || editor->modified != editor->drawn_modified ||
+        editor->mode != editor->drawn_mode) {
+        editor_draw_status(editor);
+        editor->status_dirty = 0;
+        editor->drawn_modified = editor->modified;
+        editor->drawn_mode = editor->mode;
+    }
+    
+    // Position the cursor (blinking underscore)
+    if (cursor_y >= 0 && (cursor_moved || ((repainted & (1u << cursor_row)) &&
+        cursor_x >= editor->dirty_from[cursor_row] && cursor_x < editor->dirty_to[cursor_row]))) {
+        terminal_putentryat('_', text_color, cursor_x, cursor_row);
+    }
+    editor->drawn_cursor_x = cursor_x;
+    editor->drawn_cursor_y = cursor_y;
 }
 
 // Move cursor with bounds checking
 void editor_move_cursor(editor_state_t* editor, int dx, int dy) {
+    if (dx || dy) {
+        editor->undo_merge = 0; // Typing elsewhere starts a new undo step
+    }
     editor->cursor_y += dy;
     editor->cursor_x += dx;
     
@@ -180,12 +499,12 @@ void editor_move_cursor(editor_state_t* editor, int dx, int dy) {
     if (editor->cursor_y < 0) {
         editor->cursor_y = 0;
     }
-    if (editor->cursor_y >= editor->line_count) {
-        editor->cursor_y = editor->line_count - 1;
+    if (editor->cursor_y >= editor_line_count(editor)) {
+        editor->cursor_y = editor_line_count(editor) - 1;
     }
     
     // Horizontal bounds
-    int line_len = strlen(editor->buffer[editor->cursor_y]);
+    int line_len = editor_line_length(editor, editor->cursor_y);
     if (editor->cursor_x < 0) {
         editor->cursor_x = 0;
     }
@@ -197,116 +516,89 @@ void editor_move_cursor(editor_state_t* editor, int dx, int dy) {
     if (editor->cursor_y < editor->view_start_line) {
         editor->view_start_line = editor->cursor_y;
     }
-    if (editor->cursor_y >= editor->view_start_line + 23) {
-        editor->view_start_line = editor->cursor_y - 22;
+    if (editor->cursor_y >= editor->view_start_line + EDITOR_SCREEN_LINES) {
+        editor->view_start_line = editor->cursor_y - (EDITOR_SCREEN_LINES - 1);
+    }
+    if (editor->cursor_x < editor->view_start_column) {
+        editor->view_start_column = editor->cursor_x;
+    }
+    if (editor->cursor_x >= editor->view_start_column + EDITOR_TEXT_COLUMNS) {
+        editor->view_start_column = editor->cursor_x - (EDITOR_TEXT_COLUMNS - 1);
     }
 }
 
 // Insert a character at cursor position
 void editor_insert_char(editor_state_t* editor, char c) {
-    if (editor->cursor_y >= EDITOR_MAX_LINES) return;
+    int len = editor_line_length(editor, editor->cursor_y);
     
-    char* line = editor->buffer[editor->cursor_y];
-    int len = strlen(line);
+    if (editor_text_insert(editor, editor_cursor_offset(editor), &c, 1, c != '\n') != 0) {
+        editor_set_status(editor, "Out of memory");
+        return;
+    }
+    editor->modified = 1;
     
     if (c == '\n') {
-        // Split line at cursor
-        if (editor->line_count < EDITOR_MAX_LINES - 1) {
-            // Shift lines down
-            for (int i = editor->line_count; i > editor->cursor_y + 1; i--) {
-                strcpy(editor->buffer[i], editor->buffer[i - 1]);
-            }
-            
-            // Split current line
-            strcpy(editor->buffer[editor->cursor_y + 1], &line[editor->cursor_x]);
-            line[editor->cursor_x] = '\0';
-            
-            editor->line_count++;
-            editor->cursor_y++;
-            editor->cursor_x = 0;
-            editor->modified = 1;
-        }
-    } else if (len < EDITOR_MAX_LINE_LENGTH - 1) {
-        // Insert character
-        for (int i = len; i >= editor->cursor_x; i--) {
-            line[i + 1] = line[i];
-        }
-        line[editor->cursor_x] = c;
+        // The line was split at the cursor
+        editor_mark_lines(editor, editor->cursor_y, -1);
+        editor->cursor_y++;
+        editor->cursor_x = 0;
+    } else {
+        editor_mark_text(editor, editor->cursor_y, editor->cursor_x, len + 1);
         editor->cursor_x++;
-        editor->modified = 1;
     }
+    editor_move_cursor(editor, 0, 0); // Keep the cursor on screen
 }
 
 // Delete character before cursor
 void editor_delete_char(editor_state_t* editor) {
     if (editor->cursor_x == 0 && editor->cursor_y == 0) return;
     
+    uint32_t offset = editor_cursor_offset(editor);
     if (editor->cursor_x == 0) {
-        // Join with previous line
-        if (editor->cursor_y > 0) {
-            char* prev_line = editor->buffer[editor->cursor_y - 1];
-            char* curr_line = editor->buffer[editor->cursor_y];
-            int prev_len = strlen(prev_line);
-            
-            // Append current line to previous
-            strcpy(&prev_line[prev_len], curr_line);
-            
-            // Shift lines up
-            for (int i = editor->cursor_y; i < editor->line_count - 1; i++) {
-                strcpy(editor->buffer[i], editor->buffer[i + 1]);
-            }
-            
-            editor->line_count--;
-            editor->cursor_y--;
-            editor->cursor_x = prev_len;
-            editor->modified = 1;
-        }
+        // Join with previous line by deleting its newline
+        int prev_len = editor_line_length(editor, editor->cursor_y - 1);
+        editor_text_delete(editor, offset - 1, 1, 1);
+        
+        editor_mark_lines(editor, editor->cursor_y - 1, -1);
+        editor->cursor_y--;
+        editor->cursor_x = prev_len;
     } else {
         // Delete character in current line
-        char* line = editor->buffer[editor->cursor_y];
-        int len = strlen(line);
-        
-        for (int i = editor->cursor_x - 1; i < len; i++) {
-            line[i] = line[i + 1];
-        }
+        int len = editor_line_length(editor, editor->cursor_y);
+        editor_text_delete(editor, offset - 1, 1, 1);
         
+        editor_mark_text(editor, editor->cursor_y, editor->cursor_x - 1, len);
         editor->cursor_x--;
-        editor->modified = 1;
     }
+    editor->modified = 1;
+    editor_move_cursor(editor, 0, 0); // Keep the cursor on screen
 }
 
 // Save file
 void editor_save_file(editor_state_t* editor) {
-    // Build file content
-    char content[EDITOR_MAX_LINES * EDITOR_MAX_LINE_LENGTH];
-    int pos = 0;
-    
-    for (int i = 0; i < editor->line_count; i++) {
-        char* line = editor->buffer[i];
-        int len = strlen(line);
-        
-        for (int j = 0; j < len; j++) {
-            content[pos++] = line[j];
-        }
-        
-        if (i < editor->line_count - 1) {
-            content[pos++] = '\n';
-        }
-    }
-    content[pos] = '\0';
-    
     // Save to file
     fs_node_t* node = fs_resolve_path(editor->filename);
     if (!node) {
         // Create new file
         fs_node_t* parent = fs_get_current_dir();
         node = fs_create_file(editor->filename, FILE_TYPE_REGULAR);
-        if (node) {
-            fs_add_child(parent, node);
+        if (node && fs_add_child(parent, node) != 0) {
+            // Not linked anywhere (a full disk), so nothing would keep the text
+            fs_delete_node(node);
+            node = NULL;
         }
     }
     
-    if (node && fs_write_file(node, content, pos) == 0) {
+    // The text on both sides of the gap goes straight into the file
+    fs_iovec_t iov[2];
+    uint32_t first_size, second_size;
+    textbuf_segments(&editor->text, &iov[0].data, &first_size, &iov[1].data, &second_size);
+    iov[0].size = first_size;
+    iov[1].size = second_size;
+    
+    // fs_writev_file returns the bytes written, which is all of them only
+    // if nothing failed
+    if (node && fs_writev_file(node, iov, 2) == (int)(first_size + second_size)) {
         editor->modified = 0;
         editor_set_status(editor, "File saved");
     } else {
@@ -348,31 +640,31 @@ void editor_process_key(editor_state_t* editor, char key, uint8_t scancode) {
         // Normal mode commands
         switch (key) {
             case 'i':
+                editor->undo_merge = 0;
                 editor->mode = MODE_INSERT;
                 editor_set_status(editor, "-- INSERT --");
                 break;
             case 'a':
+                editor->undo_merge = 0;
                 editor->cursor_x++;
                 editor_move_cursor(editor, 0, 0); // Bounds check
                 editor->mode = MODE_INSERT;
                 editor_set_status(editor, "-- INSERT --");
                 break;
             case 'o':
-                // Insert line below
-                if (editor->line_count < EDITOR_MAX_LINES - 1) {
+                // Insert line below: a newline at the end of this one
+                if (editor_text_insert(editor, textbuf_line_start(&editor->text, editor->cursor_y) +
+                                       editor_line_length(editor, editor->cursor_y), "\n", 1, 0) != 0) {
+                    editor_set_status(editor, "Out of memory");
+                } else {
                     editor->cursor_x = 0;
                     editor->cursor_y++;
-                    
-                    // Shift lines down
-                    for (int i = editor->line_count; i >= editor->cursor_y; i--) {
-                        strcpy(editor->buffer[i], editor->buffer[i - 1]);
-                    }
-                    editor->buffer[editor->cursor_y][0] = '\0';
-                    editor->line_count++;
+                    editor_mark_lines(editor, editor->cursor_y, -1);
                     
                     editor->mode = MODE_INSERT;
                     editor->modified = 1;
                     editor_set_status(editor, "-- INSERT --");
+                    editor_move_cursor(editor, 0, 0); // Scroll to the new line
                 }
                 break;
             case 'h':
@@ -387,6 +679,12 @@ void editor_process_key(editor_state_t* editor, char key, uint8_t scancode) {
             case 'l':
                 editor_move_cursor(editor, 1, 0);
                 break;
+            case 'u':
+                editor_undo(editor);
+                break;
+            case KEY_CTRL_R:
+                editor_redo(editor);
+                break;
             case ':':
                 editor->mode = MODE_COMMAND;
                 editor->command_length = 0;
@@ -394,28 +692,30 @@ void editor_process_key(editor_state_t* editor, char key, uint8_t scancode) {
                 break;
             case 'x':
                 // Delete character under cursor
-                if (editor->cursor_x < strlen(editor->buffer[editor->cursor_y])) {
-                    char* line = editor->buffer[editor->cursor_y];
-                    int len = strlen(line);
-                    for (int i = editor->cursor_x; i < len; i++) {
-                        line[i] = line[i + 1];
-                    }
+                if (editor->cursor_x < editor_line_length(editor, editor->cursor_y)) {
+                    int len = editor_line_length(editor, editor->cursor_y);
+                    editor_text_delete(editor, editor_cursor_offset(editor), 1, 1);
+                    editor_mark_text(editor, editor->cursor_y, editor->cursor_x, len);
                     editor->modified = 1;
                 }
                 break;
             case 'd':
                 // dd - delete line (simplified)
-                if (editor->line_count > 1) {
-                    // Shift lines up
-                    for (int i = editor->cursor_y; i < editor->line_count - 1; i++) {
-                        strcpy(editor->buffer[i], editor->buffer[i + 1]);
+                if (editor_line_count(editor) > 1) {
+                    // The line and its newline; the last line takes the
+                    // newline before it instead
+                    uint32_t start = textbuf_line_start(&editor->text, editor->cursor_y);
+                    if (editor->cursor_y == editor_line_count(editor) - 1) {
+                        start--;
                     }
-                    editor->line_count--;
-                    if (editor->cursor_y >= editor->line_count) {
-                        editor->cursor_y = editor->line_count - 1;
+                    editor_text_delete(editor, start, editor_line_length(editor, editor->cursor_y) + 1, 0);
+                    editor_mark_lines(editor, editor->cursor_y, -1);
+                    if (editor->cursor_y >= editor_line_count(editor)) {
+                        editor->cursor_y = editor_line_count(editor) - 1;
                     }
                     editor->cursor_x = 0;
                     editor->modified = 1;
+                    editor_move_cursor(editor, 0, 0); // Scroll back if it left the screen
                 }
                 break;
         }
@@ -431,7 +731,7 @@ void editor_process_key(editor_state_t* editor, char key, uint8_t scancode) {
         if (scancode == SCANCODE_ESC) {
             editor->mode = MODE_NORMAL;
             editor_set_status(editor, "-- NORMAL --");
-            if (editor->cursor_x > 0) editor->cursor_x--;
+            editor_move_cursor(editor, -1, 0); // Scrolls back if the cursor leaves the view
         } else if (scancode == SCANCODE_BACKSPACE) {
             editor_delete_char(editor);
         } else if (scancode == SCANCODE_ENTER) {
@@ -444,12 +744,13 @@ void editor_process_key(editor_state_t* editor, char key, uint8_t scancode) {
             editor_move_cursor(editor, -1, 0);
         } else if (scancode == SCANCODE_RIGHT) {
             editor_move_cursor(editor, 1, 0);
-        } else if (key != 0) {
+        } else if (key >= ' ') {
             editor_insert_char(editor, key);
         }
         
     } else if (editor->mode == MODE_COMMAND) {
-        // Command mode
+        // Command mode; every key changes the message line
+        editor->status_dirty = 1;
         if (scancode == SCANCODE_ESC) {
             editor->mode = MODE_NORMAL;
             editor->command_length = 0;
@@ -464,7 +765,7 @@ void editor_process_key(editor_state_t* editor, char key, uint8_t scancode) {
                 editor->command_length--;
                 editor->command_buffer[editor->command_length] = '\0';
             }
-        } else if (key != 0 && editor->command_length < 78) {
+        } else if (key >= ' ' && editor->command_length < 78) {
             editor->command_buffer[editor->command_length++] = key;
             editor->command_buffer[editor->command_length] = '\0';
         }
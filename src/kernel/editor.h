@@ -3,11 +3,12 @@
 
 #include "kernel.h"
 #include "filesystem.h"
+#include "textbuf.h"
 
 // Editor constants
-#define EDITOR_MAX_LINES 50
-#define EDITOR_MAX_LINE_LENGTH 76
 #define EDITOR_TAB_SIZE 4
+#define EDITOR_SCREEN_LINES 23      // Text rows; the status bar and message line follow
+#define EDITOR_UNDO_SIZE 16384      // Bytes of undo history; the oldest changes go first
 
 // Editor modes
 typedef enum {
@@ -18,21 +19,42 @@ typedef enum {
 
 // Editor state structure
 typedef struct {
-    char buffer[EDITOR_MAX_LINES][EDITOR_MAX_LINE_LENGTH];
-    int line_count;
+    textbuf_t text;       // Any number of lines of any length
     int cursor_x;
     int cursor_y;
     int view_start_line;  // For scrolling
+    int view_start_column;
     editor_mode_t mode;
     char filename[MAX_FILENAME_LENGTH];
     int modified;
     char command_buffer[80];
     int command_length;
     char status_message[80];
+
+    // What is on screen, so editor_draw repaints only what changed
+    uint32_t dirty_rows;        // Text rows to repaint, one bit per screen row
+    uint8_t dirty_from[EDITOR_SCREEN_LINES];  // Columns to repaint in those rows
+    uint8_t dirty_to[EDITOR_SCREEN_LINES];
+    int redraw_all;             // Repaint everything (after opening a file)
+    int status_dirty;           // Repaint the status bar and message line
+    int drawn_view_start;
+    int drawn_view_column;
+    int drawn_cursor_x;
+    int drawn_cursor_y;         // Buffer line of the drawn cursor; -1 if none
+    int drawn_modified;
+    editor_mode_t drawn_mode;
+    
+    // Undo log: a record per change, oldest first, in an arena allocated
+    // on the first change
+    char* undo_log;
+    uint32_t undo_used;         // End of the records undo can take back
+    uint32_t undo_end;          // End of those redo can replay after them
+    int undo_merge;             // The last record may take in the next keystroke
 } editor_state_t;
 
 // Function declarations
 void editor_init(editor_state_t* editor);
+void editor_free(editor_state_t* editor);
 void editor_open(editor_state_t* editor, const char* filename);
 void editor_draw(editor_state_t* editor);
 void editor_process_key(editor_state_t* editor, char key, uint8_t scancode);
@@ -42,5 +64,7 @@ void editor_save_file(editor_state_t* editor);
 void editor_set_status(editor_state_t* editor, const char* message);
 void editor_move_cursor(editor_state_t* editor, int dx, int dy);
 void editor_process_command(editor_state_t* editor);
+void editor_undo(editor_state_t* editor);
+void editor_redo(editor_state_t* editor);
 
 #endif // EDITOR_H 
\ No newline at end of file
@@ -1,30 +1,24 @@
 #include "filesystem.h"
-
-// Simple memory allocator for file system
-static char memory_pool[64 * 1024]; // 64KB memory pool
-static size_t memory_offset = 0;
-static uint32_t time_counter = 0;
+#include "heap.h"
+#include "diskfs.h"
+#include "timer.h"
+#include "thread.h"
 
 // Global file system instance
 static filesystem_t fs;
+static mutex_t fs_mutex = MUTEX_INIT;
 
-// Forward declarations
-char* strcat(char* dest, const char* src);
+// Slab caches for file system nodes and file data blocks
+static kmem_cache_t fs_node_cache;
+static kmem_cache_t fs_block_cache;
 
-// Simple memory allocation
-void* kmalloc(size_t size) {
-    if (memory_offset + size >= sizeof(memory_pool)) {
-        return NULL; // Out of memory
-    }
-    void* ptr = &memory_pool[memory_offset];
-    memory_offset += size;
-    return ptr;
-}
+// Initial number of entries in a file's block table
+#define FS_BLOCK_TABLE_MIN 4
 
-void kfree(void* ptr) {
-    // Simple allocator - no deallocation for now
-    (void)ptr;
-}
+// Forward declarations
+char* strcat(char* dest, const char* src);
+static fs_node_t* fs_find_child_n(fs_node_t* parent, const char* name, size_t length);
+static void fs_crc32_init(void);
 
 // Memory utility functions
 void* memset(void* ptr, int value, size_t size) {
@@ -63,13 +57,17 @@ char* strcat(char* dest, const char* src) {
     return dest;
 }
 
+// File timestamps are wall-clock seconds since 1970
 uint32_t get_current_time(void) {
-    return ++time_counter;
+    return timer_wall_clock();
 }
 
 // Initialize the file system
 void fs_init(void) {
     memset(&fs, 0, sizeof(filesystem_t));
+    kmem_cache_init(&fs_node_cache, "fs_node", sizeof(fs_node_t));
+    kmem_cache_init(&fs_block_cache, "fs_block", sizeof(fs_block_t));
+    fs_crc32_init();
     
     // Create root directory
     fs.root = fs_create_file("/", FILE_TYPE_DIRECTORY);
@@ -81,60 +79,159 @@ void fs_init(void) {
     fs.current_dir = fs.root;
     fs.root->parent = fs.root; // Root is its own parent
     strcpy(fs.current_path, "/");
+    fs.current_path_valid = 1;
+    fs.dcache_generation = 1;
+    
+    // Load the persistent volume, if the boot disk has one
+    if (diskfs_mount(fs.root) == 0) {
+        terminal_writestring("Mounted PhantomFS volume from disk\n");
+    } else {
+        terminal_writestring("No PhantomFS volume found - files are kept in RAM only\n");
+    }
     
     terminal_writestring("File system initialized\n");
 }
 
+void fs_lock(void) {
+    mutex_lock(&fs_mutex);
+}
+
+void fs_unlock(void) {
+    mutex_unlock(&fs_mutex);
+}
+
 // Create a new file or directory
 fs_node_t* fs_create_file(const char* name, file_type_t type) {
-    if (fs.total_files >= MAX_TOTAL_FILES) {
-        return NULL; // Too many files
-    }
-    
-    fs_node_t* node = (fs_node_t*)kmalloc(sizeof(fs_node_t));
+    fs_node_t* node = (fs_node_t*)kmem_cache_alloc(&fs_node_cache);
     if (!node) {
         return NULL;
     }
     
     memset(node, 0, sizeof(fs_node_t));
     strncpy(node->name, name, MAX_FILENAME_LENGTH - 1);
+    node->name_hash = fs_hash_name(node->name);
     node->type = type;
     node->creation_time = get_current_time();
     node->modification_time = node->creation_time;
     
-    if (type == FILE_TYPE_DIRECTORY) {
-        node->data = NULL; // Children array is embedded in struct
-        node->size = 0;
-    } else {
-        // Allocate data buffer for regular files
-        node->data = kmalloc(MAX_FILE_SIZE);
-        if (node->data) {
-            memset(node->data, 0, MAX_FILE_SIZE);
-        }
-        node->size = 0;
-    }
+    // Regular files start empty; data blocks are allocated as they are written
+    node->blocks = NULL;
+    node->block_capacity = 0;
+    node->size = 0;
     
     // Add to global file list
     node->next = fs.file_list_head;
+    if (fs.file_list_head) {
+        fs.file_list_head->prev = node;
+    }
     fs.file_list_head = node;
     fs.total_files++;
     
     return node;
 }
 
+// FNV-1a hash of the first `length` bytes of a file name
+uint32_t fs_hash_name_n(const char* name, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (uint8_t)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+uint32_t fs_hash_name(const char* name) {
+    return fs_hash_name_n(name, strlen(name));
+}
+
+// CRC-32 (IEEE 802.3, as used by zip and Ethernet), table driven
+static uint32_t crc32_table[256];
+
+static void fs_crc32_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+        }
+        crc32_table[i] = crc;
+    }
+}
+
+uint32_t fs_crc32(uint32_t crc, const void* data, size_t size) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++) {
+        crc = crc32_table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+// CRC-32 of a file's contents, read straight from its blocks. Only reads,
+// so several CPUs may checksum files at once while the caller holds fs_lock.
+uint32_t fs_checksum_file(fs_node_t* file) {
+    static const char zeros[FS_BLOCK_SIZE];
+    uint32_t crc = 0;
+    if (!file || file->type != FILE_TYPE_REGULAR) {
+        return 0;
+    }
+    for (size_t pos = 0; pos < file->size; pos += FS_BLOCK_SIZE) {
+        size_t chunk = file->size - pos < FS_BLOCK_SIZE ? file->size - pos : FS_BLOCK_SIZE;
+        fs_block_t* block = file->blocks[pos / FS_BLOCK_SIZE];
+        crc = fs_crc32(crc, block ? block->data : zeros, chunk);  // Holes read as zeros
+    }
+    return crc;
+}
+
+// Rebuild a directory's hash index with `bucket_count` buckets
+static int fs_rehash_dir(fs_node_t* dir, size_t bucket_count) {
+    fs_node_t** buckets = (fs_node_t**)kmalloc(bucket_count * sizeof(fs_node_t*));
+    if (!buckets) {
+        return -1;
+    }
+    memset(buckets, 0, bucket_count * sizeof(fs_node_t*));
+    
+    for (fs_node_t* child = dir->first_child; child; child = child->next_sibling) {
+        size_t bucket = child->name_hash & (bucket_count - 1);
+        child->hash_next = buckets[bucket];
+        buckets[bucket] = child;
+    }
+    
+    kfree(dir->hash_buckets);
+    dir->hash_buckets = buckets;
+    dir->hash_bucket_count = bucket_count;
+    return 0;
+}
+
 // Find a child by name in a directory
 fs_node_t* fs_find_child(fs_node_t* parent, const char* name) {
-    if (!parent || parent->type != FILE_TYPE_DIRECTORY) {
-        return NULL;
+    return fs_find_child_n(parent, name, strlen(name));
+}
+
+// Insert a child into a directory's index and child list in memory only;
+// the directory must already have hash buckets, so this cannot fail
+static void fs_link_child(fs_node_t* parent, fs_node_t* child) {
+    // Keep the load factor at or below one entry per bucket; failure to
+    // grow only makes chains longer
+    if (parent->child_count >= parent->hash_bucket_count) {
+        fs_rehash_dir(parent, parent->hash_bucket_count * 2);
     }
     
-    for (size_t i = 0; i < parent->child_count; i++) {
-        if (parent->children[i] && strcmp(parent->children[i]->name, name) == 0) {
-            return parent->children[i];
-        }
+    size_t bucket = child->name_hash & (parent->hash_bucket_count - 1);
+    child->hash_next = parent->hash_buckets[bucket];
+    parent->hash_buckets[bucket] = child;
+    
+    child->prev_sibling = parent->last_child;
+    child->next_sibling = NULL;
+    if (parent->last_child) {
+        parent->last_child->next_sibling = child;
+    } else {
+        parent->first_child = child;
     }
+    parent->last_child = child;
     
-    return NULL;
+    parent->child_count++;
+    child->parent = parent;
+    parent->modification_time = get_current_time();
 }
 
 // Add a child to a directory
@@ -143,107 +240,255 @@ int fs_add_child(fs_node_t* parent, fs_node_t* child) {
         return -1;
     }
     
-    if (parent->child_count >= MAX_FILES_PER_DIR) {
-        return -1; // Directory full
-    }
-    
     // Check if name already exists
     if (fs_find_child(parent, child->name)) {
         return -1; // Name collision
     }
     
-    parent->children[parent->child_count] = child;
-    parent->child_count++;
-    child->parent = parent;
-    parent->modification_time = get_current_time();
+    if (!parent->hash_buckets && fs_rehash_dir(parent, FS_HASH_MIN_BUCKETS) != 0) {
+        return -1;
+    }
+    
+    // Persist the link first so a full disk leaves memory untouched
+    if (diskfs_link(parent, child) != 0) {
+        return -1;
+    }
     
+    fs_link_child(parent, child);
     return 0;
 }
 
 // Remove a child from a directory
 int fs_remove_child(fs_node_t* parent, const char* name) {
-    if (!parent || parent->type != FILE_TYPE_DIRECTORY) {
+    if (!parent || parent->type != FILE_TYPE_DIRECTORY || !parent->hash_buckets) {
         return -1;
     }
     
-    for (size_t i = 0; i < parent->child_count; i++) {
-        if (parent->children[i] && strcmp(parent->children[i]->name, name) == 0) {
-            // Shift remaining children
-            for (size_t j = i; j < parent->child_count - 1; j++) {
-                parent->children[j] = parent->children[j + 1];
-            }
-            parent->children[parent->child_count - 1] = NULL;
-            parent->child_count--;
-            parent->modification_time = get_current_time();
-            return 0;
+    uint32_t hash = fs_hash_name(name);
+    fs_node_t** link = &parent->hash_buckets[hash & (parent->hash_bucket_count - 1)];
+    for (; *link; link = &(*link)->hash_next) {
+        fs_node_t* child = *link;
+        if (child->name_hash != hash || strcmp(child->name, name) != 0) {
+            continue;
+        }
+        
+        *link = child->hash_next;
+        child->hash_next = NULL;
+        fs_dcache_invalidate();
+        diskfs_unlink(parent, child);
+        
+        if (child->prev_sibling) {
+            child->prev_sibling->next_sibling = child->next_sibling;
+        } else {
+            parent->first_child = child->next_sibling;
         }
+        if (child->next_sibling) {
+            child->next_sibling->prev_sibling = child->prev_sibling;
+        } else {
+            parent->last_child = child->prev_sibling;
+        }
+        child->next_sibling = NULL;
+        child->prev_sibling = NULL;
+        
+        parent->child_count--;
+        parent->modification_time = get_current_time();
+        return 0;
     }
     
     return -1; // Not found
 }
 
-// Resolve a path to a file system node
-fs_node_t* fs_resolve_path(const char* path) {
-    if (!path || strlen(path) == 0) {
-        return fs.current_dir;
-    }
-    
-    fs_node_t* current;
-    
-    // Absolute or relative path?
-    if (path[0] == '/') {
-        current = fs.root;
-        path++; // Skip leading slash
-    } else {
-        current = fs.current_dir;
+// Look up a child by a name that is not NUL-terminated
+static fs_node_t* fs_find_child_n(fs_node_t* parent, const char* name, size_t length) {
+    if (!parent || parent->type != FILE_TYPE_DIRECTORY || !parent->hash_buckets) {
+        return NULL;
     }
     
-    // Handle root directory
-    if (strlen(path) == 0) {
-        return current;
+    uint32_t hash = fs_hash_name_n(name, length);
+    fs_node_t* child = parent->hash_buckets[hash & (parent->hash_bucket_count - 1)];
+    for (; child; child = child->hash_next) {
+        if (child->name_hash == hash && strncmp(child->name, name, length) == 0 &&
+            child->name[length] == '\0') {
+            return child;
+        }
     }
     
-    // Parse path components
-    char path_copy[MAX_PATH_LENGTH];
-    strncpy(path_copy, path, MAX_PATH_LENGTH - 1);
-    
-    char* token = path_copy;
-    char* next_token;
-    
-    while (token && *token) {
-        // Find next path separator
-        next_token = token;
-        while (*next_token && *next_token != '/') {
-            next_token++;
-        }
-        
-        if (*next_token == '/') {
-            *next_token = '\0';
-            next_token++;
-        } else {
-            next_token = NULL;
+    return NULL;
+}
+
+// Walk a path component by component starting at `current`
+static fs_node_t* fs_walk_path(fs_node_t* current, const char* path) {
+    while (*path) {
+        // Find the end of this component
+        const char* end = path;
+        while (*end && *end != '/') {
+            end++;
         }
+        size_t length = end - path;
         
-        // Handle special cases
-        if (strcmp(token, ".") == 0) {
+        // Handle special cases (empty components come from repeated slashes)
+        if (length == 0 || (length == 1 && path[0] == '.')) {
             // Current directory - do nothing
-        } else if (strcmp(token, "..") == 0) {
+        } else if (length == 2 && path[0] == '.' && path[1] == '.') {
             // Parent directory
             current = current->parent;
         } else {
             // Regular directory/file name
-            current = fs_find_child(current, token);
+            current = fs_find_child_n(current, path, length);
             if (!current) {
                 return NULL; // Path not found
             }
         }
         
-        token = next_token;
+        path = *end ? end + 1 : end;
     }
     
     return current;
 }
 
+// Build an absolute path with ".", empty components and (optionally) ".." removed
+// Returns -1 if the result does not fit or cannot be built
+static int fs_build_path(const char* input, char* output, int allow_parent) {
+    size_t length;
+    
+    if (input[0] == '/') {
+        output[0] = '/';
+        length = 1;
+    } else {
+        if (!fs.current_path_valid) {
+            return -1;
+        }
+        length = strlen(fs.current_path);
+        memcpy(output, fs.current_path, length);
+    }
+    output[length] = '\0';
+    
+    const char* component = input;
+    while (*component) {
+        const char* end = component;
+        while (*end && *end != '/') {
+            end++;
+        }
+        size_t size = end - component;
+        
+        if (size == 0 || (size == 1 && component[0] == '.')) {
+            // Nothing to add
+        } else if (size == 2 && component[0] == '.' && component[1] == '.') {
+            if (!allow_parent) {
+                return -1;
+            }
+            // Drop the last component (root stays root)
+            while (length > 1 && output[length - 1] != '/') {
+                length--;
+            }
+            if (length > 1) {
+                length--;
+            }
+            output[length] = '\0';
+        } else {
+            size_t needed = size + (length > 1 ? 1 : 0);
+            if (length + needed >= MAX_PATH_LENGTH) {
+                return -1;
+            }
+            if (length > 1) {
+                output[length++] = '/';
+            }
+            memcpy(&output[length], component, size);
+            length += size;
+            output[length] = '\0';
+        }
+        
+        component = *end ? end + 1 : end;
+    }
+    
+    return 0;
+}
+
+// Normalize a path to an absolute path without ".", ".." or repeated slashes
+int fs_normalize_path(const char* input, char* output) {
+    if (fs_build_path(input, output, 1) != 0) {
+        output[0] = '\0';
+        return -1;
+    }
+    return 0;
+}
+
+// Drop every cached path (called whenever a name is unlinked or a node freed)
+void fs_dcache_invalidate(void) {
+    fs.dcache_generation++;
+    fs.dcache_stats.invalidations++;
+}
+
+// Look up a normalized absolute path in the path cache
+static fs_node_t* fs_dcache_lookup(const char* path, uint32_t hash) {
+    fs_dcache_entry_t* entry = &fs.dcache[hash & (FS_DCACHE_SIZE - 1)];
+    if (entry->generation == fs.dcache_generation && entry->hash == hash &&
+        strcmp(entry->path, path) == 0) {
+        return entry->node;
+    }
+    return NULL;
+}
+
+// Remember the node for a normalized absolute path
+static void fs_dcache_insert(const char* path, uint32_t hash, fs_node_t* node) {
+    fs_dcache_entry_t* entry = &fs.dcache[hash & (FS_DCACHE_SIZE - 1)];
+    size_t length = strlen(path) + 1;
+    
+    if (!entry->path || entry->path_capacity < length) {
+        char* copy = (char*)kmalloc(length);
+        if (!copy) {
+            return; // Caching is best effort
+        }
+        kfree(entry->path);
+        entry->path = copy;
+        entry->path_capacity = length;
+    }
+    
+    memcpy(entry->path, path, length);
+    entry->hash = hash;
+    entry->node = node;
+    entry->generation = fs.dcache_generation;
+}
+
+// Get path cache statistics
+void fs_dcache_get_stats(fs_dcache_stats_t* stats) {
+    *stats = fs.dcache_stats;
+    stats->entries = 0;
+    for (size_t i = 0; i < FS_DCACHE_SIZE; i++) {
+        if (fs.dcache[i].path && fs.dcache[i].generation == fs.dcache_generation) {
+            stats->entries++;
+        }
+    }
+}
+
+// Resolve a path to a file system node
+fs_node_t* fs_resolve_path(const char* path) {
+    if (!path || *path == '\0') {
+        return fs.current_dir;
+    }
+    
+    // Paths with ".." keep their walk semantics (a missing component fails
+    // the lookup), so only simple paths go through the cache
+    char normalized[MAX_PATH_LENGTH];
+    if (fs_build_path(path, normalized, 0) != 0) {
+        return fs_walk_path(path[0] == '/' ? fs.root : fs.current_dir, path);
+    }
+    
+    uint32_t hash = fs_hash_name(normalized);
+    fs_node_t* node = fs_dcache_lookup(normalized, hash);
+    if (node) {
+        fs.dcache_stats.hits++;
+        return node;
+    }
+    
+    fs.dcache_stats.misses++;
+    node = fs_walk_path(fs.root, normalized);
+    if (node) {
+        fs_dcache_insert(normalized, hash, node);
+    }
+    return node;
+}
+
 // Change current directory
 int fs_change_directory(const char* path) {
     fs_node_t* target = fs_resolve_path(path);
@@ -263,31 +508,36 @@ int fs_change_directory(const char* path) {
 
 // Update current path string
 void fs_update_current_path(void) {
-    if (fs.current_dir == fs.root) {
+    // Measure the path by walking up to the root
+    size_t length = 0;
+    for (fs_node_t* node = fs.current_dir; node != fs.root; node = node->parent) {
+        length += 1 + strlen(node->name);
+    }
+    
+    if (length == 0) {
         strcpy(fs.current_path, "/");
+        fs.current_path_valid = 1;
         return;
     }
     
-    // Build path by traversing up to root
-    char temp_path[MAX_PATH_LENGTH];
-    char components[16][MAX_FILENAME_LENGTH]; // Max 16 levels deep
-    int depth = 0;
-    
-    fs_node_t* node = fs.current_dir;
-    while (node != fs.root && depth < 16) {
-        strcpy(components[depth], node->name);
-        depth++;
-        node = node->parent;
+    if (length >= MAX_PATH_LENGTH) {
+        // Too deep to display in full; relative lookups bypass the path cache
+        strcpy(fs.current_path, "...");
+        strcat(fs.current_path, "/");
+        strcat(fs.current_path, fs.current_dir->name);
+        fs.current_path_valid = 0;
+        return;
     }
     
-    // Build path string
-    strcpy(fs.current_path, "/");
-    for (int i = depth - 1; i >= 0; i--) {
-        if (strlen(fs.current_path) > 1) {
-            strcat(fs.current_path, "/");
-        }
-        strcat(fs.current_path, components[i]);
+    // Fill the path from the end back towards the root
+    fs.current_path[length] = '\0';
+    for (fs_node_t* node = fs.current_dir; node != fs.root; node = node->parent) {
+        size_t name_length = strlen(node->name);
+        length -= name_length;
+        memcpy(&fs.current_path[length], node->name, name_length);
+        fs.current_path[--length] = '/';
     }
+    fs.current_path_valid = 1;
 }
 
 // Get current directory
@@ -300,30 +550,329 @@ char* fs_get_current_path(void) {
     return fs.current_path;
 }
 
-// Write data to a file
+// Number of blocks needed to hold `size` bytes
+static inline size_t fs_blocks_for(size_t size) {
+    return (size + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE;
+}
+
+// Reallocate a file's block table to hold `capacity` entries
+static int fs_resize_block_table(fs_node_t* file, size_t capacity) {
+    if (capacity == 0) {
+        kfree(file->blocks);
+        file->blocks = NULL;
+        file->block_capacity = 0;
+        return 0;
+    }
+    
+    fs_block_t** table = (fs_block_t**)kmalloc(capacity * sizeof(fs_block_t*));
+    if (!table) {
+        return -1;
+    }
+    
+    size_t keep = file->block_capacity < capacity ? file->block_capacity : capacity;
+    if (keep > 0) {
+        memcpy(table, file->blocks, keep * sizeof(fs_block_t*));
+    }
+    memset(&table[keep], 0, (capacity - keep) * sizeof(fs_block_t*));
+    
+    kfree(file->blocks);
+    file->blocks = table;
+    file->block_capacity = capacity;
+    return 0;
+}
+
+// Make sure the block table can index at least `count` blocks
+static int fs_reserve_blocks(fs_node_t* file, size_t count) {
+    if (count <= file->block_capacity) {
+        return 0;
+    }
+    
+    size_t capacity = file->block_capacity ? file->block_capacity : FS_BLOCK_TABLE_MIN;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+    return fs_resize_block_table(file, capacity);
+}
+
+// Drop one reference to a data block, freeing it with the last one
+static void fs_put_block(fs_block_t* block) {
+    if (--block->ref_count == 0) {
+        kmem_cache_free(&fs_block_cache, block);
+    }
+}
+
+// Release every data block from index `first` onwards and shrink the table
+static void fs_release_blocks(fs_node_t* file, size_t first) {
+    for (size_t i = first; i < file->block_capacity; i++) {
+        if (file->blocks[i]) {
+            fs_put_block(file->blocks[i]);
+            file->blocks[i] = NULL;
+        }
+    }
+    
+    if (first == 0) {
+        fs_resize_block_table(file, 0);
+    } else if (file->block_capacity > FS_BLOCK_TABLE_MIN && first * 4 <= file->block_capacity) {
+        // Table is mostly empty - give the slack back (failure just keeps the old table)
+        fs_resize_block_table(file, first * 2);
+    }
+}
+
+// Get the block at `index` for writing: holes get a zeroed block and
+// shared blocks are copied so the other owners keep the old data
+static fs_block_t* fs_get_writable_block(fs_node_t* file, size_t index) {
+    fs_block_t* block = file->blocks[index];
+    
+    if (block && block->ref_count == 1) {
+        return block;
+    }
+    
+    fs_block_t* copy = (fs_block_t*)kmem_cache_alloc(&fs_block_cache);
+    if (!copy) {
+        return NULL;
+    }
+    
+    if (block) {
+        memcpy(copy->data, block->data, FS_BLOCK_SIZE);
+        fs_put_block(block);
+    } else {
+        memset(copy->data, 0, FS_BLOCK_SIZE);
+    }
+    copy->ref_count = 1;
+    file->blocks[index] = copy;
+    return copy;
+}
+
+// Write the segments of `iov` one after the other at an offset, growing
+// the file as needed; each byte is copied once, straight into the file's
+// blocks, and the disk is updated once for the whole range
+// Returns the number of bytes written, or -1 on error
+int fs_writev_at(fs_node_t* file, size_t offset, const fs_iovec_t* iov, size_t count) {
+    if (!file || file->type != FILE_TYPE_REGULAR) {
+        return -1;
+    }
+    
+    size_t size = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (size + iov[i].size < size) {
+            return -1;
+        }
+        size += iov[i].size;
+    }
+    if (size == 0) {
+        return 0;
+    }
+    
+    if (offset + size < offset || fs_reserve_blocks(file, fs_blocks_for(offset + size)) != 0) {
+        return -1;
+    }
+    
+    // Claim the disk blocks first, so a full disk changes nothing
+    if (diskfs_reserve(file, offset, size) != 0) {
+        return -1;
+    }
+    
+    size_t old_size = file->size;
+    size_t written = 0;
+    for (size_t i = 0; i < count && written < size; i++) {
+        size_t done = 0;
+        while (done < iov[i].size) {
+            size_t pos = offset + written;
+            size_t block_offset = pos % FS_BLOCK_SIZE;
+            size_t chunk = FS_BLOCK_SIZE - block_offset;
+            if (chunk > iov[i].size - done) {
+                chunk = iov[i].size - done;
+            }
+            
+            fs_block_t* block = fs_get_writable_block(file, pos / FS_BLOCK_SIZE);
+            if (!block) {
+                size = written; // Out of memory - keep what was written
+                break;
+            }
+            
+            memcpy(&block->data[block_offset], iov[i].data + done, chunk);
+            done += chunk;
+            written += chunk;
+        }
+    }
+    
+    if (offset + written > file->size) {
+        file->size = offset + written;
+    }
+    file->modification_time = get_current_time();
+    
+    if (written > 0 && diskfs_write(file, offset, written) != 0) {
+        // Disk I/O error: the file goes back to its old size, though bytes
+        // overwritten within it stay changed in memory
+        if (file->size > old_size) {
+            fs_truncate(file, old_size);
+        }
+        return -1;
+    }
+    if (written < size) {
+        diskfs_truncate(file); // Give back blocks reserved past the new end
+    }
+    
+    return written > 0 ? (int)written : -1;
+}
+
+// Write data at an offset, growing the file as needed
+// Returns the number of bytes written, or -1 on error
+int fs_write_at(fs_node_t* file, size_t offset, const char* data, size_t size) {
+    fs_iovec_t iov = { data, size };
+    return fs_writev_at(file, offset, &iov, 1);
+}
+
+// Replace the contents of a file with the segments of `iov`
+// Returns the number of bytes written, or -1 on error
+int fs_writev_file(fs_node_t* file, const fs_iovec_t* iov, size_t count) {
+    if (!file || file->type != FILE_TYPE_REGULAR) {
+        return -1;
+    }
+    
+    size_t size = 0;
+    for (size_t i = 0; i < count; i++) {
+        size += iov[i].size;
+    }
+    
+    // Write over the old contents first and cut the tail only once that
+    // worked, so a failed save never loses the old text before the new is in
+    int written = 0;
+    if (size > 0) {
+        written = fs_writev_at(file, 0, iov, count);
+        if (written != (int)size) {
+            return written;
+        }
+    }
+    
+    if ((size < file->size || size == 0) && fs_truncate(file, size) != 0) {
+        return -1;
+    }
+    
+    return written;
+}
+
+// Replace the contents of a file
+// Returns the number of bytes written, or -1 on error
 int fs_write_file(fs_node_t* file, const char* data, size_t size) {
-    if (!file || file->type != FILE_TYPE_REGULAR || !file->data) {
+    fs_iovec_t iov = { data, size };
+    return fs_writev_file(file, &iov, 1);
+}
+
+// Read up to `size` bytes starting at `offset`
+// Returns the number of bytes read (0 at end of file), or -1 on error
+int fs_read_file(fs_node_t* file, size_t offset, char* buffer, size_t size) {
+    if (!file || file->type != FILE_TYPE_REGULAR) {
+        return -1;
+    }
+    
+    if (offset >= file->size) {
+        return 0;
+    }
+    
+    if (size > file->size - offset) {
+        size = file->size - offset;
+    }
+    
+    size_t done = 0;
+    while (done < size) {
+        size_t pos = offset + done;
+        size_t block_offset = pos % FS_BLOCK_SIZE;
+        size_t chunk = FS_BLOCK_SIZE - block_offset;
+        if (chunk > size - done) {
+            chunk = size - done;
+        }
+        
+        fs_block_t* block = file->blocks[pos / FS_BLOCK_SIZE];
+        if (block) {
+            memcpy(buffer + done, &block->data[block_offset], chunk);
+        } else {
+            memset(buffer + done, 0, chunk); // Hole
+        }
+        done += chunk;
+    }
+    
+    return (int)done;
+}
+
+// Grow or shrink a file; shrinking frees the blocks past the new end
+int fs_truncate(fs_node_t* file, size_t size) {
+    if (!file || file->type != FILE_TYPE_REGULAR) {
         return -1;
     }
     
-    if (size > MAX_FILE_SIZE) {
-        size = MAX_FILE_SIZE;
+    if (size < file->size) {
+        size_t keep = fs_blocks_for(size);
+        
+        // Zero the tail of the last kept block so regrowing reads zeros
+        if (size % FS_BLOCK_SIZE != 0 && file->blocks[keep - 1]) {
+            fs_block_t* last = fs_get_writable_block(file, keep - 1);
+            if (!last) {
+                return -1;
+            }
+            size_t tail = size % FS_BLOCK_SIZE;
+            memset(&last->data[tail], 0, FS_BLOCK_SIZE - tail);
+        }
+        
+        fs_release_blocks(file, keep);
+    } else if (size > file->size) {
+        // New space is left as holes until written
+        if (fs_reserve_blocks(file, fs_blocks_for(size)) != 0) {
+            return -1;
+        }
     }
     
-    memcpy(file->data, data, size);
     file->size = size;
     file->modification_time = get_current_time();
-    
-    return (int)size;
+    return diskfs_truncate(file);
 }
 
-// Read data from a file
-char* fs_read_file(fs_node_t* file) {
-    if (!file || file->type != FILE_TYPE_REGULAR || !file->data) {
-        return NULL;
+// Number of data blocks actually allocated to a file
+size_t fs_block_count(fs_node_t* file) {
+    size_t count = 0;
+    if (file && file->type == FILE_TYPE_REGULAR) {
+        for (size_t i = 0; i < file->block_capacity; i++) {
+            if (file->blocks[i]) {
+                count++;
+            }
+        }
+    }
+    return count;
+}
+
+// Number of a file's data blocks that are shared with a clone
+size_t fs_shared_block_count(fs_node_t* file) {
+    size_t count = 0;
+    if (file && file->type == FILE_TYPE_REGULAR) {
+        for (size_t i = 0; i < file->block_capacity; i++) {
+            if (file->blocks[i] && file->blocks[i]->ref_count > 1) {
+                count++;
+            }
+        }
+    }
+    return count;
+}
+
+// Share the data blocks of src with an empty file (copy-on-write clone)
+static int fs_clone_blocks(fs_node_t* dest, fs_node_t* src) {
+    size_t count = fs_blocks_for(src->size);
+    if (count == 0) {
+        return 0;
+    }
+    
+    if (fs_reserve_blocks(dest, count) != 0) {
+        return -1;
     }
     
-    return (char*)file->data;
+    for (size_t i = 0; i < count; i++) {
+        if (src->blocks[i]) {
+            src->blocks[i]->ref_count++;
+            dest->blocks[i] = src->blocks[i];
+        }
+    }
+    
+    dest->size = src->size;
+    return 0;
 }
 
 // Delete a file system node
@@ -342,20 +891,42 @@ int fs_delete_node(fs_node_t* node) {
         return -1;
     }
     
-    // Remove from parent
-    if (node->parent) {
+    // Can't delete the directory we're standing in
+    if (node == fs.current_dir) {
+        return -1;
+    }
+    
+    // Remove from parent (only if still linked there)
+    if (node->parent && fs_find_child(node->parent, node->name) == node) {
         fs_remove_child(node->parent, node->name);
     }
     
-    // Remove from global list (simplified - just mark as deleted)
-    // In a real implementation, we'd properly manage the linked list
+    // Unlink from global list
+    if (node->prev) {
+        node->prev->next = node->next;
+    } else {
+        fs.file_list_head = node->next;
+    }
+    if (node->next) {
+        node->next->prev = node->prev;
+    }
     
     fs.total_files--;
+    fs_dcache_invalidate();
+    diskfs_release(node);
+    
+    // Release file data (or the directory's hash index) and the node itself
+    if (node->type == FILE_TYPE_REGULAR) {
+        fs_release_blocks(node, 0);
+    } else {
+        kfree(node->hash_buckets);
+    }
+    kmem_cache_free(&fs_node_cache, node);
     
     return 0;
 }
 
-// Copy file
+// Copy file as a copy-on-write clone of the source
 int fs_copy_file(const char* src_path, const char* dest_path) {
     fs_node_t* src = fs_resolve_path(src_path);
     if (!src || src->type != FILE_TYPE_REGULAR) {
@@ -380,13 +951,8 @@ int fs_copy_file(const char* src_path, const char* dest_path) {
         return -1;
     }
     
-    // Copy data
-    if (src->data && src->size > 0) {
-        fs_write_file(dest_file, (char*)src->data, src->size);
-    }
-    
-    // Add to destination directory
-    if (fs_add_child(dest_dir, dest_file) != 0) {
+    // Share data blocks, then add to destination directory
+    if (fs_clone_blocks(dest_file, src) != 0 || fs_add_child(dest_dir, dest_file) != 0) {
         fs_delete_node(dest_file);
         return -1;
     }
@@ -394,16 +960,99 @@ int fs_copy_file(const char* src_path, const char* dest_path) {
     return 0;
 }
 
-// Move file
+// Move file or directory by relinking its node (no data is copied)
 int fs_move_file(const char* src_path, const char* dest_path) {
-    if (fs_copy_file(src_path, dest_path) == 0) {
-        fs_node_t* src = fs_resolve_path(src_path);
-        if (src) {
-            fs_delete_node(src);
-            return 0;
+    if (!dest_path || *dest_path == '\0') {
+        return -1;
+    }
+    
+    fs_node_t* src = fs_resolve_path(src_path);
+    if (!src || src == fs.root) {
+        return -1;
+    }
+    
+    // Moving onto an existing directory puts the source inside it
+    fs_node_t* dest_dir;
+    char dest_name[MAX_FILENAME_LENGTH];
+    fs_node_t* existing = fs_resolve_path(dest_path);
+    
+    if (existing && existing->type == FILE_TYPE_DIRECTORY) {
+        dest_dir = existing;
+        strcpy(dest_name, src->name);
+    } else if (existing) {
+        return -1; // Refuse to overwrite an existing file
+    } else {
+        char dest_dir_path[MAX_PATH_LENGTH];
+        if (strlen(dest_path) >= MAX_PATH_LENGTH) {
+            return -1;
+        }
+        fs_get_parent_path(dest_path, dest_dir_path);
+        dest_dir = fs_resolve_path(dest_dir_path);
+        
+        // Name is whatever follows the last slash
+        const char* name = dest_path;
+        for (const char* p = dest_path; *p; p++) {
+            if (*p == '/') {
+                name = p + 1;
+            }
+        }
+        if (*name == '\0' || strlen(name) >= MAX_FILENAME_LENGTH ||
+            strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+            return -1;
+        }
+        strcpy(dest_name, name);
+    }
+    
+    if (!dest_dir || dest_dir->type != FILE_TYPE_DIRECTORY) {
+        return -1;
+    }
+    
+    // A directory can't be moved into itself or its own subtree
+    for (fs_node_t* node = dest_dir; ; node = node->parent) {
+        if (node == src) {
+            return -1;
         }
+        if (node == fs.root) {
+            break;
+        }
+    }
+    
+    if (dest_dir == src->parent && strcmp(dest_name, src->name) == 0) {
+        return 0; // Nothing to do
+    }
+    
+    if (fs_find_child(dest_dir, dest_name)) {
+        return -1; // Name collision
+    }
+    
+    // Make sure the in-memory link into the destination can't fail once we unlink the source
+    if (!dest_dir->hash_buckets && fs_rehash_dir(dest_dir, FS_HASH_MIN_BUCKETS) != 0) {
+        return -1;
     }
-    return -1;
+    
+    fs_node_t* old_parent = src->parent;
+    char old_name[MAX_FILENAME_LENGTH];
+    strcpy(old_name, src->name);
+    
+    // Write the new entry to disk before dropping the old one, so a full
+    // disk leaves the node where it was, in memory and on disk
+    strcpy(src->name, dest_name);
+    if (diskfs_link(dest_dir, src) != 0) {
+        strcpy(src->name, old_name);
+        return -1;
+    }
+    strcpy(src->name, old_name);
+    fs_remove_child(old_parent, old_name);
+    
+    strcpy(src->name, dest_name);
+    src->name_hash = fs_hash_name(src->name);
+    fs_link_child(dest_dir, src);
+    src->modification_time = get_current_time();
+    
+    // The current directory may have been inside the moved subtree
+    fs_update_current_path();
+    
+    return 0;
 }
 
 // Utility functions for path manipulation
@@ -419,7 +1068,9 @@ void fs_get_parent_path(const char* path, char* parent) {
         }
     }
     
-    if (last_slash <= 0) {
+    if (last_slash == -1) {
+        strcpy(parent, "."); // Relative name - lives in the current directory
+    } else if (last_slash == 0) {
         strcpy(parent, "/");
     } else {
         parent[last_slash] = '\0';
@@ -6,9 +6,9 @@
 // File system constants
 #define MAX_FILENAME_LENGTH 64
 #define MAX_PATH_LENGTH 256
-#define MAX_FILES_PER_DIR 32
-#define MAX_FILE_SIZE 4096
-#define MAX_TOTAL_FILES 128
+#define FS_HASH_MIN_BUCKETS 8
+#define FS_DCACHE_SIZE 128  // Path cache entries (power of two)
+#define FS_BLOCK_SIZE 512
 
 // File types
 typedef enum {
@@ -16,27 +16,60 @@ typedef enum {
     FILE_TYPE_DIRECTORY = 1
 } file_type_t;
 
+// File data block (allocated on demand as a file grows)
+// Blocks are shared copy-on-write between files cloned with cp
+typedef struct fs_block {
+    uint32_t ref_count;
+    char data[FS_BLOCK_SIZE];
+} fs_block_t;
+
 // File system node structure
 typedef struct fs_node {
     char name[MAX_FILENAME_LENGTH];
+    uint32_t name_hash;         // Cached fs_hash_name(name)
     file_type_t type;
     size_t size;
     uint32_t creation_time;
     uint32_t modification_time;
+    uint32_t inode;             // On-disk inode number (0 if not on disk)
     
-    // For files: pointer to data
-    // For directories: pointer to children array
-    void* data;
+    // For files: table of data blocks (NULL entries are holes that read as zeros)
+    fs_block_t** blocks;
+    size_t block_capacity;
     
-    // Directory management
+    // Directory management: children in insertion order plus a hash index by name
     struct fs_node* parent;
-    struct fs_node* children[MAX_FILES_PER_DIR];
+    struct fs_node* first_child;
+    struct fs_node* last_child;
+    struct fs_node* next_sibling;
+    struct fs_node* prev_sibling;
+    struct fs_node** hash_buckets;
+    size_t hash_bucket_count;   // Power of two
+    struct fs_node* hash_next;  // Chain within the parent's bucket
     size_t child_count;
     
     // Linked list for global file tracking
     struct fs_node* next;
+    struct fs_node* prev;
 } fs_node_t;
 
+// Path cache entry: normalized absolute path -> node
+typedef struct {
+    uint32_t hash;
+    uint32_t generation;    // Valid only while equal to the cache generation
+    fs_node_t* node;
+    char* path;
+    size_t path_capacity;
+} fs_dcache_entry_t;
+
+// Path cache statistics
+typedef struct {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t invalidations;
+    size_t entries;
+} fs_dcache_stats_t;
+
 // File system state
 typedef struct {
     fs_node_t* root;
@@ -44,12 +77,26 @@ typedef struct {
     fs_node_t* file_list_head;
     size_t total_files;
     char current_path[MAX_PATH_LENGTH];
+    int current_path_valid;  // 0 if the path was too long to store in full
+    
+    // Path lookup cache
+    fs_dcache_entry_t dcache[FS_DCACHE_SIZE];
+    uint32_t dcache_generation;
+    fs_dcache_stats_t dcache_stats;
 } filesystem_t;
 
+// One piece of the data for fs_writev_at and fs_writev_file
+typedef struct {
+    const char* data;
+    size_t size;
+} fs_iovec_t;
+
 // Function declarations
 void fs_init(void);
 fs_node_t* fs_create_file(const char* name, file_type_t type);
 fs_node_t* fs_find_child(fs_node_t* parent, const char* name);
+uint32_t fs_hash_name(const char* name);
+uint32_t fs_hash_name_n(const char* name, size_t length);
 fs_node_t* fs_resolve_path(const char* path);
 int fs_add_child(fs_node_t* parent, fs_node_t* child);
 int fs_remove_child(fs_node_t* parent, const char* name);
@@ -61,12 +108,32 @@ int fs_change_directory(const char* path);
 
 // File operations
 int fs_write_file(fs_node_t* file, const char* data, size_t size);
-char* fs_read_file(fs_node_t* file);
+int fs_write_at(fs_node_t* file, size_t offset, const char* data, size_t size);
+int fs_writev_file(fs_node_t* file, const fs_iovec_t* iov, size_t count);
+int fs_writev_at(fs_node_t* file, size_t offset, const fs_iovec_t* iov, size_t count);
+int fs_read_file(fs_node_t* file, size_t offset, char* buffer, size_t size);
+int fs_truncate(fs_node_t* file, size_t size);
+size_t fs_block_count(fs_node_t* file);
+uint32_t fs_crc32(uint32_t crc, const void* data, size_t size);
+uint32_t fs_checksum_file(fs_node_t* file);
+size_t fs_shared_block_count(fs_node_t* file);
 int fs_copy_file(const char* src_path, const char* dest_path);
 int fs_move_file(const char* src_path, const char* dest_path);
 
+// Path lookup cache
+void fs_dcache_invalidate(void);
+void fs_dcache_get_stats(fs_dcache_stats_t* stats);
+
+// File system lock: serializes the file system and the disk stack under it
+// (diskfs, buffer cache, ATA queue). The fs_* functions do not take it;
+// callers hold it across their sequence of calls, as the shell does while
+// a command runs. It is a mutex, so only threads take it, never interrupt
+// handlers; a thread holding it can be preempted but not killed.
+void fs_lock(void);
+void fs_unlock(void);
+
 // Path utilities
-void fs_normalize_path(const char* input, char* output);
+int fs_normalize_path(const char* input, char* output);
 void fs_get_parent_path(const char* path, char* parent);
 void fs_get_filename(const char* path, char* filename);
 
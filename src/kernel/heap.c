@@ -0,0 +1,444 @@
+// PhantomOS Kernel Heap
+// Coalescing free-list allocator for variable-size blocks, with slab caches
+// on top of it for small and fixed-size objects. One spinlock covers both;
+// the static helpers below expect it to be held.
+
+#include "heap.h"
+#include "pmm.h"
+#include "spinlock.h"
+
+// Block layout: [header][payload ...][footer]
+// The header magic is odd so kfree can tell a block payload apart from a
+// slab object, whose preceding word is an (aligned) slab pointer.
+#define HEAP_BLOCK_MAGIC 0x4B4D4131
+#define HEAP_USED 0x1
+#define HEAP_FOOTER_SIZE sizeof(uint32_t)
+#define HEAP_MIN_BLOCK ((sizeof(heap_free_block_t) + HEAP_FOOTER_SIZE + HEAP_ALIGNMENT - 1) & ~(HEAP_ALIGNMENT - 1))
+#define KMEM_SLAB_MAGIC 0x51AB51AB
+
+// Initial pool used until more memory is handed to the heap
+#define HEAP_POOL_SIZE (64 * 1024)
+
+// Minimum number of page frames requested from the PMM when the heap grows
+#define HEAP_GROW_FRAMES 16
+
+typedef struct {
+    uint32_t size;  // Total block size including header and footer; bit 0 = used
+    uint32_t magic;
+} heap_block_t;
+
+typedef struct heap_free_block {
+    heap_block_t header;
+    struct heap_free_block* next;
+    struct heap_free_block* prev;
+} heap_free_block_t;
+
+static char heap_pool[HEAP_POOL_SIZE] __attribute__((aligned(HEAP_ALIGNMENT)));
+static heap_free_block_t* free_list_head = NULL;
+static size_t heap_total = 0;
+static size_t heap_limit = 0;   // Most the heap may grow to (0 = no limit)
+static size_t heap_used = 0;
+static uint32_t heap_alloc_count = 0;
+static uint32_t heap_free_count = 0;
+
+// Size-class caches backing small kmalloc requests
+static const size_t kmalloc_sizes[] = { 16, 32, 64, 128, 256 };
+#define KMALLOC_CLASSES (sizeof(kmalloc_sizes) / sizeof(kmalloc_sizes[0]))
+static kmem_cache_t kmalloc_caches[KMALLOC_CLASSES];
+static const char* kmalloc_names[KMALLOC_CLASSES] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128", "kmalloc-256"
+};
+static kmem_cache_t* cache_registry = NULL;
+static spinlock_t heap_lock = SPINLOCK_INIT;
+
+static inline size_t block_size(heap_block_t* block) {
+    return block->size & ~HEAP_USED;
+}
+
+static inline uint32_t* block_footer(heap_block_t* block) {
+    return (uint32_t*)((char*)block + block_size(block) - HEAP_FOOTER_SIZE);
+}
+
+static inline void block_set(heap_block_t* block, size_t size, uint32_t used) {
+    block->size = size | used;
+    block->magic = HEAP_BLOCK_MAGIC;
+    *block_footer(block) = size | used;
+}
+
+static void free_list_insert(heap_free_block_t* block) {
+    block->prev = NULL;
+    block->next = free_list_head;
+    if (free_list_head) {
+        free_list_head->prev = block;
+    }
+    free_list_head = block;
+}
+
+static void free_list_remove(heap_free_block_t* block) {
+    if (block->prev) {
+        block->prev->next = block->next;
+    } else {
+        free_list_head = block->next;
+    }
+    if (block->next) {
+        block->next->prev = block->prev;
+    }
+}
+
+// Add a memory region to the heap
+static int heap_region_add(void* start, size_t size) {
+    uint32_t base = ((uint32_t)start + HEAP_ALIGNMENT - 1) & ~(HEAP_ALIGNMENT - 1);
+    uint32_t end = ((uint32_t)start + size) & ~(HEAP_ALIGNMENT - 1);
+
+    // Need room for the prologue/epilogue fences plus one minimal block
+    if (end <= base || end - base < HEAP_MIN_BLOCK + 2 * HEAP_ALIGNMENT) {
+        return -1;
+    }
+
+    // Prologue: a used "footer" so the first block never coalesces backwards
+    *(uint32_t*)(base + HEAP_ALIGNMENT - HEAP_FOOTER_SIZE) = HEAP_USED;
+
+    // Epilogue: a zero-sized used header so the last block never coalesces forwards
+    heap_block_t* epilogue = (heap_block_t*)(end - sizeof(heap_block_t));
+    epilogue->size = HEAP_USED;
+    epilogue->magic = HEAP_BLOCK_MAGIC;
+
+    heap_block_t* block = (heap_block_t*)(base + HEAP_ALIGNMENT);
+    size_t usable = ((uint32_t)epilogue - (uint32_t)block) & ~(HEAP_ALIGNMENT - 1);
+    block_set(block, usable, 0);
+    free_list_insert((heap_free_block_t*)block);
+
+    heap_total += usable;
+    return 0;
+}
+
+// Grow the heap with fresh page frames large enough for a block of `needed` bytes
+static int heap_grow(size_t needed) {
+    // Region fences take one alignment unit at each end
+    size_t frames = (needed + 2 * HEAP_ALIGNMENT + PMM_FRAME_SIZE - 1) / PMM_FRAME_SIZE;
+    if (frames < HEAP_GROW_FRAMES) {
+        frames = HEAP_GROW_FRAMES;
+    }
+
+    if (heap_limit && heap_total + frames * PMM_FRAME_SIZE > heap_limit) {
+        return -1;
+    }
+
+    uint32_t addr = pmm_alloc_frames(frames);
+    if (!addr) {
+        return -1;
+    }
+
+    return heap_region_add((void*)addr, frames * PMM_FRAME_SIZE);
+}
+
+int heap_add_region(void* start, size_t size) {
+    uint32_t irq = spin_lock_irqsave(&heap_lock);
+    int result = heap_region_add(start, size);
+    spin_unlock_irqrestore(&heap_lock, irq);
+    return result;
+}
+
+// First-fit allocation from the free list, splitting oversized blocks
+static void* heap_block_alloc(size_t size) {
+    size_t needed = sizeof(heap_block_t) + size + HEAP_FOOTER_SIZE;
+    needed = (needed + HEAP_ALIGNMENT - 1) & ~(HEAP_ALIGNMENT - 1);
+    if (needed < HEAP_MIN_BLOCK) {
+        needed = HEAP_MIN_BLOCK;
+    }
+
+    heap_free_block_t* block = free_list_head;
+    for (;; block = block->next) {
+        if (!block) {
+            // Out of free blocks - ask the PMM for more memory and retry
+            if (heap_grow(needed) != 0) {
+                return NULL; // Out of memory
+            }
+            block = free_list_head;
+        }
+
+        size_t available = block_size(&block->header);
+        if (available < needed) {
+            continue;
+        }
+
+        free_list_remove(block);
+
+        if (available - needed >= HEAP_MIN_BLOCK) {
+            heap_block_t* rest = (heap_block_t*)((char*)block + needed);
+            block_set(rest, available - needed, 0);
+            free_list_insert((heap_free_block_t*)rest);
+            available = needed;
+        }
+
+        block_set(&block->header, available, HEAP_USED);
+        heap_used += available;
+        heap_alloc_count++;
+        return (char*)block + sizeof(heap_block_t);
+    }
+}
+
+// Return a block to the free list, merging with free neighbours
+static void heap_block_free(void* ptr) {
+    heap_block_t* block = (heap_block_t*)((char*)ptr - sizeof(heap_block_t));
+    if (block->magic != HEAP_BLOCK_MAGIC || !(block->size & HEAP_USED)) {
+        return; // Not a live heap block
+    }
+
+    size_t size = block_size(block);
+    heap_used -= size;
+    heap_free_count++;
+
+    // Merge with the following block
+    heap_block_t* next = (heap_block_t*)((char*)block + size);
+    if (!(next->size & HEAP_USED)) {
+        free_list_remove((heap_free_block_t*)next);
+        size += block_size(next);
+    }
+
+    // Merge with the preceding block
+    uint32_t prev_footer = *((uint32_t*)block - 1);
+    if (!(prev_footer & HEAP_USED)) {
+        heap_block_t* prev = (heap_block_t*)((char*)block - prev_footer);
+        free_list_remove((heap_free_block_t*)prev);
+        size += prev_footer;
+        block = prev;
+    }
+
+    block_set(block, size, 0);
+    free_list_insert((heap_free_block_t*)block);
+}
+
+// Initialize a slab cache for objects of the given size
+void kmem_cache_init(kmem_cache_t* cache, const char* name, size_t object_size) {
+    memset(cache, 0, sizeof(kmem_cache_t));
+
+    if (object_size < sizeof(void*)) {
+        object_size = sizeof(void*); // Free objects hold a list link
+    }
+
+    cache->name = name;
+    cache->object_size = object_size;
+    cache->slot_size = (sizeof(kmem_slab_t*) + object_size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+    cache->objects_per_slab = (KMEM_SLAB_SIZE - sizeof(kmem_slab_t)) / cache->slot_size;
+
+    uint32_t irq = spin_lock_irqsave(&heap_lock);
+    cache->next = cache_registry;
+    cache_registry = cache;
+    spin_unlock_irqrestore(&heap_lock, irq);
+}
+
+static void slab_list_remove(kmem_slab_t** list, kmem_slab_t* slab) {
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        *list = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+    slab->next = NULL;
+    slab->prev = NULL;
+}
+
+static void slab_list_push(kmem_slab_t** list, kmem_slab_t* slab) {
+    slab->prev = NULL;
+    slab->next = *list;
+    if (*list) {
+        (*list)->prev = slab;
+    }
+    *list = slab;
+}
+
+// Carve a fresh slab out of the free-list heap
+static kmem_slab_t* kmem_slab_create(kmem_cache_t* cache) {
+    kmem_slab_t* slab = (kmem_slab_t*)heap_block_alloc(KMEM_SLAB_SIZE);
+    if (!slab) {
+        return NULL;
+    }
+
+    slab->magic = KMEM_SLAB_MAGIC;
+    slab->cache = cache;
+    slab->next = NULL;
+    slab->prev = NULL;
+    slab->free_list = NULL;
+    slab->in_use = 0;
+
+    // Build the free list back to front so objects are handed out in order
+    char* slots = (char*)slab + sizeof(kmem_slab_t);
+    for (size_t i = cache->objects_per_slab; i > 0; i--) {
+        char* slot = slots + (i - 1) * cache->slot_size;
+        *(kmem_slab_t**)slot = slab;
+        void* object = slot + sizeof(kmem_slab_t*);
+        *(void**)object = slab->free_list;
+        slab->free_list = object;
+    }
+
+    cache->slab_count++;
+    return slab;
+}
+
+// Allocate an object from a slab cache
+static void* cache_alloc(kmem_cache_t* cache) {
+    kmem_slab_t* slab = cache->partial;
+
+    if (!slab) {
+        if (cache->empty) {
+            slab = cache->empty;
+            cache->empty = NULL;
+        } else {
+            slab = kmem_slab_create(cache);
+            if (!slab) {
+                return NULL;
+            }
+        }
+        slab_list_push(&cache->partial, slab);
+    }
+
+    void* object = slab->free_list;
+    slab->free_list = *(void**)object;
+    slab->in_use++;
+    cache->active_objects++;
+
+    if (!slab->free_list) {
+        slab_list_remove(&cache->partial, slab);
+        slab_list_push(&cache->full, slab);
+    }
+
+    return object;
+}
+
+// Return an object to its slab cache
+static void cache_free(kmem_cache_t* cache, void* ptr) {
+    kmem_slab_t* slab = *(kmem_slab_t**)((char*)ptr - sizeof(kmem_slab_t*));
+    if (slab->magic != KMEM_SLAB_MAGIC || slab->cache != cache) {
+        return; // Not an object from this cache
+    }
+
+    if (!slab->free_list) {
+        slab_list_remove(&cache->full, slab);
+        slab_list_push(&cache->partial, slab);
+    }
+
+    *(void**)ptr = slab->free_list;
+    slab->free_list = ptr;
+    slab->in_use--;
+    cache->active_objects--;
+
+    if (slab->in_use == 0) {
+        slab_list_remove(&cache->partial, slab);
+        if (!cache->empty) {
+            cache->empty = slab;
+        } else {
+            // Already holding a spare slab - give this one back to the heap
+            slab->magic = 0;
+            cache->slab_count--;
+            heap_block_free(slab);
+        }
+    }
+}
+
+void* kmem_cache_alloc(kmem_cache_t* cache) {
+    uint32_t irq = spin_lock_irqsave(&heap_lock);
+    void* object = cache_alloc(cache);
+    spin_unlock_irqrestore(&heap_lock, irq);
+    return object;
+}
+
+void kmem_cache_free(kmem_cache_t* cache, void* ptr) {
+    if (!ptr) {
+        return;
+    }
+    uint32_t irq = spin_lock_irqsave(&heap_lock);
+    cache_free(cache, ptr);
+    spin_unlock_irqrestore(&heap_lock, irq);
+}
+
+// First cache in the registry (for statistics)
+kmem_cache_t* kmem_cache_first(void) {
+    return cache_registry;
+}
+
+// Initialize the kernel heap
+void heap_init(void) {
+    free_list_head = NULL;
+    heap_total = 0;
+    heap_used = 0;
+    heap_alloc_count = 0;
+    heap_free_count = 0;
+    cache_registry = NULL;
+    spin_lock_init(&heap_lock);
+
+    heap_region_add(heap_pool, sizeof(heap_pool));
+
+    for (size_t i = 0; i < KMALLOC_CLASSES; i++) {
+        kmem_cache_init(&kmalloc_caches[i], kmalloc_names[i], kmalloc_sizes[i]);
+    }
+}
+
+// Cap how far the heap grows from page frames (the static pool always counts)
+void heap_set_limit(size_t bytes) {
+    heap_limit = bytes;
+}
+
+// Allocate memory: small sizes from the size-class slabs, the rest from the free list
+void* kmalloc(size_t size) {
+    if (size == 0) {
+        return NULL;
+    }
+
+    uint32_t irq = spin_lock_irqsave(&heap_lock);
+    void* ptr = NULL;
+    if (size <= KMALLOC_MAX_SLAB_SIZE) {
+        for (size_t i = 0; i < KMALLOC_CLASSES; i++) {
+            if (size <= kmalloc_sizes[i]) {
+                ptr = cache_alloc(&kmalloc_caches[i]);
+                break;
+            }
+        }
+    } else {
+        ptr = heap_block_alloc(size);
+    }
+    spin_unlock_irqrestore(&heap_lock, irq);
+    return ptr;
+}
+
+// Free memory returned by kmalloc or kmem_cache_alloc
+void kfree(void* ptr) {
+    if (!ptr) {
+        return;
+    }
+
+    uint32_t irq = spin_lock_irqsave(&heap_lock);
+    uint32_t tag = *((uint32_t*)ptr - 1);
+    if (tag == HEAP_BLOCK_MAGIC) {
+        heap_block_free(ptr);
+    } else {
+        kmem_slab_t* slab = (kmem_slab_t*)tag;
+        if (slab && slab->magic == KMEM_SLAB_MAGIC) {
+            cache_free(slab->cache, ptr);
+        }
+    }
+    spin_unlock_irqrestore(&heap_lock, irq);
+}
+
+// Gather heap usage statistics
+void heap_get_stats(heap_stats_t* stats) {
+    uint32_t irq = spin_lock_irqsave(&heap_lock);
+    stats->total_bytes = heap_total;
+    stats->used_bytes = heap_used;
+    stats->free_bytes = heap_total - heap_used;
+    stats->largest_free = 0;
+    stats->free_blocks = 0;
+    stats->alloc_count = heap_alloc_count;
+    stats->free_count = heap_free_count;
+
+    for (heap_free_block_t* block = free_list_head; block; block = block->next) {
+        size_t size = block_size(&block->header);
+        if (size > stats->largest_free) {
+            stats->largest_free = size;
+        }
+        stats->free_blocks++;
+    }
+    spin_unlock_irqrestore(&heap_lock, irq);
+}
@@ -0,0 +1,58 @@
+#ifndef HEAP_H
+#define HEAP_H
+
+#include "kernel.h"
+
+// Heap constants
+#define HEAP_ALIGNMENT 8
+#define KMEM_SLAB_SIZE 4096
+#define KMALLOC_MAX_SLAB_SIZE 256  // Larger requests go to the free-list allocator
+
+// Slab: a KMEM_SLAB_SIZE block carved into equal object slots
+typedef struct kmem_slab {
+    uint32_t magic;
+    struct kmem_cache* cache;
+    struct kmem_slab* next;
+    struct kmem_slab* prev;
+    void* free_list;        // Free objects, linked through their first word
+    size_t in_use;
+} kmem_slab_t;
+
+// Object cache for fixed-size allocations (fs_node_t, small kmalloc classes)
+typedef struct kmem_cache {
+    const char* name;
+    size_t object_size;
+    size_t slot_size;       // Object plus owning-slab back pointer
+    size_t objects_per_slab;
+    kmem_slab_t* partial;   // Slabs with at least one free object
+    kmem_slab_t* full;
+    kmem_slab_t* empty;     // One fully free slab kept to avoid thrashing
+    size_t slab_count;
+    size_t active_objects;
+    struct kmem_cache* next; // Registry of all caches for statistics
+} kmem_cache_t;
+
+// Heap usage statistics
+typedef struct {
+    size_t total_bytes;
+    size_t used_bytes;
+    size_t free_bytes;
+    size_t largest_free;
+    size_t free_blocks;
+    uint32_t alloc_count;
+    uint32_t free_count;
+} heap_stats_t;
+
+// Heap management
+void heap_init(void);
+int heap_add_region(void* start, size_t size);
+void heap_set_limit(size_t bytes);
+void heap_get_stats(heap_stats_t* stats);
+
+// Slab caches
+void kmem_cache_init(kmem_cache_t* cache, const char* name, size_t object_size);
+void* kmem_cache_alloc(kmem_cache_t* cache);
+void kmem_cache_free(kmem_cache_t* cache, void* ptr);
+kmem_cache_t* kmem_cache_first(void);
+
+#endif // HEAP_H
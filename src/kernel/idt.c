@@ -0,0 +1,338 @@
+// PhantomOS Interrupt Descriptor Table
+// Every exception and PIC interrupt has a stub in interrupts.asm that saves
+// the registers and calls interrupt_dispatch with the vector number. Drivers
+// register a handler per vector; an IRQ line is unmasked when its handler is
+// registered, on the 8259 PIC or, once apic_init switched over, the IOAPIC.
+// Spurious IRQ7/IRQ15s and local APIC spurious interrupts are counted and
+// dropped, and an exception nobody handles prints a crash dump to the
+// screen and COM1 and halts. After an IRQ or local APIC interrupt has been
+// acknowledged, the scheduler gets the chance to switch threads.
+
+#include "idt.h"
+#include "apic.h"
+#include "thread.h"
+#include "io.h"
+#include "serial.h"
+
+#define KERNEL_CODE_SEGMENT 0x08
+#define IDT_INTERRUPT_GATE 0x8E     // Present, ring 0, 32-bit interrupt gate
+
+// 8259 PIC ports and commands
+#define PIC_MASTER_COMMAND 0x20
+#define PIC_MASTER_DATA 0x21
+#define PIC_SLAVE_COMMAND 0xA0
+#define PIC_SLAVE_DATA 0xA1
+#define PIC_ICW1_INIT 0x11          // Edge triggered, cascade, ICW4 follows
+#define PIC_ICW4_8086 0x01
+#define PIC_EOI 0x20
+#define PIC_READ_ISR 0x0B
+#define PIC_CASCADE_IRQ 2
+
+#define EXCEPTION_PAGE_FAULT 14
+
+// IDT entry structure (32-bit)
+struct idt_entry {
+    uint16_t offset_low;
+    uint16_t selector;
+    uint8_t zero;
+    uint8_t type_attr;
+    uint16_t offset_high;
+} __attribute__((packed));
+
+// IDT pointer structure
+struct idt_ptr {
+    uint16_t limit;
+    uint32_t base;
+} __attribute__((packed));
+
+// Stub addresses for vectors 0 to IDT_STUBS - 1, and SPURIOUS_VECTOR (interrupts.asm)
+extern uint32_t interrupt_stub_table[IDT_STUBS];
+extern void spurious_interrupt_stub(void);
+
+static struct idt_entry idt[IDT_SIZE];
+static struct idt_ptr idt_pointer;
+static interrupt_handler_t handlers[IDT_SIZE];
+static const char* handler_names[IDT_SIZE];
+static uint32_t counts[IDT_SIZE];
+static uint32_t spurious_count = 0;
+static uint16_t irq_mask = 0xFFFF;
+static int use_apic = 0;
+static int in_panic = 0;
+
+static const char* exception_names[IDT_EXCEPTIONS] = {
+    "Divide Error", "Debug", "NMI", "Breakpoint", "Overflow", "Bound Range Exceeded",
+    "Invalid Opcode", "Device Not Available", "Double Fault", "Coprocessor Segment Overrun",
+    "Invalid TSS", "Segment Not Present", "Stack-Segment Fault", "General Protection Fault",
+    "Page Fault", "Reserved", "x87 Floating-Point Error", "Alignment Check", "Machine Check",
+    "SIMD Floating-Point Exception", "Virtualization Exception", "Control Protection Exception",
+    "Reserved", "Reserved", "Reserved", "Reserved", "Reserved", "Reserved",
+    "Hypervisor Injection", "VMM Communication", "Security Exception", "Reserved"
+};
+
+static void idt_set_entry(int num, uint32_t handler, uint16_t selector, uint8_t type_attr) {
+    idt[num].offset_low = handler & 0xFFFF;
+    idt[num].selector = selector;
+    idt[num].zero = 0;
+    idt[num].type_attr = type_attr;
+    idt[num].offset_high = (handler >> 16) & 0xFFFF;
+}
+
+static void pic_write_mask(void) {
+    outb(PIC_MASTER_DATA, irq_mask & 0xFF);
+    outb(PIC_SLAVE_DATA, irq_mask >> 8);
+}
+
+// Remap the PICs to IRQ_BASE (their defaults collide with CPU exceptions)
+static void pic_remap(void) {
+    outb(PIC_MASTER_COMMAND, PIC_ICW1_INIT);
+    outb(PIC_SLAVE_COMMAND, PIC_ICW1_INIT);
+    outb(PIC_MASTER_DATA, IRQ_BASE);
+    outb(PIC_SLAVE_DATA, IRQ_BASE + 8);
+    outb(PIC_MASTER_DATA, 1 << PIC_CASCADE_IRQ);   // Slave on IRQ2
+    outb(PIC_SLAVE_DATA, PIC_CASCADE_IRQ);         // Slave identity
+    outb(PIC_MASTER_DATA, PIC_ICW4_8086);
+    outb(PIC_SLAVE_DATA, PIC_ICW4_8086);
+
+    irq_mask = 0xFFFF;
+    pic_write_mask();
+}
+
+// Install stubs for every exception and IRQ; interrupts stay off until
+// the caller enables them
+void idt_init(void) {
+    memset(idt, 0, sizeof(idt));
+    memset(handlers, 0, sizeof(handlers));
+    memset(handler_names, 0, sizeof(handler_names));
+    memset(counts, 0, sizeof(counts));
+    spurious_count = 0;
+
+    use_apic = 0;
+    pic_remap();
+
+    for (int i = 0; i < IDT_STUBS; i++) {
+        idt_set_entry(i, interrupt_stub_table[i], KERNEL_CODE_SEGMENT, IDT_INTERRUPT_GATE);
+    }
+    idt_set_entry(SPURIOUS_VECTOR, (uint32_t)spurious_interrupt_stub, KERNEL_CODE_SEGMENT, IDT_INTERRUPT_GATE);
+
+    idt_pointer.limit = sizeof(idt) - 1;
+    idt_pointer.base = (uint32_t)&idt;
+    idt_load();
+
+    serial_init();
+}
+
+// Every CPU loads the shared IDT for itself
+void idt_load(void) {
+    asm volatile ("lidt %0" : : "m"(idt_pointer));
+}
+
+// Handle `vector` with `handler`; -1 if another handler already has it
+int interrupt_register(uint32_t vector, interrupt_handler_t handler, const char* name) {
+    if (vector >= IDT_STUBS || !handler) {
+        return -1;
+    }
+    if (handlers[vector] && handlers[vector] != handler) {
+        return -1;
+    }
+    handlers[vector] = handler;
+    handler_names[vector] = name;
+    return 0;
+}
+
+// Register an IRQ handler and unmask its line (and the cascade for the slave)
+int irq_register(uint32_t irq, interrupt_handler_t handler, const char* name) {
+    if (irq >= IRQ_COUNT || interrupt_register(IRQ_VECTOR(irq), handler, name) != 0) {
+        return -1;
+    }
+    if (use_apic) {
+        ioapic_set_masked(irq, 0);
+        return 0;
+    }
+    irq_mask &= ~(1 << irq);
+    if (irq >= 8) {
+        irq_mask &= ~(1 << PIC_CASCADE_IRQ);
+    }
+    pic_write_mask();
+    return 0;
+}
+
+// Called by apic_init once the IOAPIC is programmed: mask the PIC for good
+// and unmask the lines that already have handlers on the IOAPIC instead
+void irq_use_apic(void) {
+    irq_mask = 0xFFFF;
+    pic_write_mask();
+    use_apic = 1;
+    for (uint32_t irq = 0; irq < IRQ_COUNT; irq++) {
+        if (handlers[IRQ_VECTOR(irq)]) {
+            ioapic_set_masked(irq, 0);
+        }
+    }
+}
+
+const char* irq_get_controller(void) {
+    return use_apic ? "IOAPIC + local APIC" : "8259 PIC";
+}
+
+uint32_t interrupt_get_count(uint32_t vector) {
+    return vector < IDT_SIZE ? counts[vector] : 0;
+}
+
+const char* interrupt_get_name(uint32_t vector) {
+    if (vector >= IDT_SIZE) {
+        return NULL;
+    }
+    if (handler_names[vector]) {
+        return handler_names[vector];
+    }
+    return vector < IDT_EXCEPTIONS ? exception_names[vector] : NULL;
+}
+
+uint32_t interrupt_get_spurious(void) {
+    return spurious_count;
+}
+
+// IRQ7 and IRQ15 fire spuriously when a request goes away before the CPU
+// acknowledges it; the PIC then has nothing in service
+static int pic_is_spurious(uint32_t irq) {
+    if (irq == 7) {
+        outb(PIC_MASTER_COMMAND, PIC_READ_ISR);
+        return !(inb(PIC_MASTER_COMMAND) & 0x80);
+    }
+    if (irq == 15) {
+        outb(PIC_SLAVE_COMMAND, PIC_READ_ISR);
+        if (!(inb(PIC_SLAVE_COMMAND) & 0x80)) {
+            outb(PIC_MASTER_COMMAND, PIC_EOI);  // The master did see the cascade
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void irq_eoi(uint32_t irq) {
+    if (use_apic) {
+        lapic_eoi();
+        return;
+    }
+    if (irq >= 8) {
+        outb(PIC_SLAVE_COMMAND, PIC_EOI);
+    }
+    outb(PIC_MASTER_COMMAND, PIC_EOI);
+}
+
+// Crash dump output goes to both the screen and COM1
+static void dump_string(const char* text) {
+    terminal_writestring(text);
+    serial_writestring(text);
+}
+
+static void dump_hex(const char* label, uint32_t value) {
+    char text[11] = "0x";
+    for (int i = 0; i < 8; i++) {
+        text[2 + i] = "0123456789ABCDEF"[(value >> (28 - 4 * i)) & 0xF];
+    }
+    text[10] = '\0';
+    dump_string(label);
+    dump_string(text);
+}
+
+static void interrupt_panic(interrupt_frame_t* frame) {
+    uint32_t cr0, cr2, cr3;
+    asm volatile ("mov %%cr0, %0; mov %%cr2, %1; mov %%cr3, %2" : "=r"(cr0), "=r"(cr2), "=r"(cr3));
+
+    // A fault while dumping would only recurse
+    if (in_panic) {
+        asm volatile ("cli; hlt");
+    }
+    in_panic = 1;
+
+    // The CPU pushed no ESP (same privilege level): the interrupted stack
+    // continues right after the saved EFLAGS
+    uint32_t esp = (uint32_t)&frame->eflags + sizeof(frame->eflags);
+
+    terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_RED));
+    dump_string("\n*** KERNEL PANIC: ");
+    dump_string(exception_names[frame->vector]);
+    dump_hex(" (vector ", frame->vector);
+    dump_hex(", error ", frame->error_code);
+    dump_string(") ***\n");
+
+    dump_hex("EIP=", frame->eip);
+    dump_hex(" CS=", frame->cs);
+    dump_hex(" EFLAGS=", frame->eflags);
+    dump_string("\n");
+    dump_hex("EAX=", frame->eax);
+    dump_hex(" EBX=", frame->ebx);
+    dump_hex(" ECX=", frame->ecx);
+    dump_hex(" EDX=", frame->edx);
+    dump_string("\n");
+    dump_hex("ESI=", frame->esi);
+    dump_hex(" EDI=", frame->edi);
+    dump_hex(" EBP=", frame->ebp);
+    dump_hex(" ESP=", esp);
+    dump_string("\n");
+    dump_hex("CR0=", cr0);
+    dump_hex(" CR2=", cr2);
+    dump_hex(" CR3=", cr3);
+    dump_string("\n");
+
+    if (frame->vector == EXCEPTION_PAGE_FAULT) {
+        dump_hex("Faulting address ", cr2);
+        dump_string(frame->error_code & 0x1 ? " (protection violation, " : " (page not present, ");
+        dump_string(frame->error_code & 0x2 ? "write)\n" : "read)\n");
+    }
+
+    dump_string("Stack:");
+    uint32_t* stack = (uint32_t*)esp;
+    for (int i = 0; i < 8; i++) {
+        dump_hex(" ", stack[i]);
+    }
+    dump_string("\nSystem halted.\n");
+    terminal_flush();
+
+    for (;;) {
+        asm volatile ("cli; hlt");
+    }
+}
+
+// Called from the common stub in interrupts.asm
+void interrupt_dispatch(interrupt_frame_t* frame) {
+    uint32_t vector = frame->vector;
+
+    // The local APIC expects no EOI for its spurious interrupt
+    if (vector == SPURIOUS_VECTOR) {
+        spurious_count++;
+        return;
+    }
+
+    if (vector >= IRQ_BASE && vector < IRQ_BASE + IRQ_COUNT) {
+        uint32_t irq = vector - IRQ_BASE;
+        if (!use_apic && (irq == 7 || irq == 15) && pic_is_spurious(irq)) {
+            spurious_count++;
+            return;
+        }
+        counts[vector]++;
+        if (handlers[vector]) {
+            handlers[vector](frame);
+        }
+        irq_eoi(irq);
+        thread_preempt();
+        return;
+    }
+
+    if (vector >= LOCAL_VECTOR_BASE && vector < LOCAL_VECTOR_BASE + LOCAL_VECTOR_COUNT) {
+        counts[vector]++;
+        if (handlers[vector]) {
+            handlers[vector](frame);
+        }
+        lapic_eoi();
+        thread_preempt();
+        return;
+    }
+
+    counts[vector]++;
+    if (handlers[vector]) {
+        handlers[vector](frame);
+        return;
+    }
+    interrupt_panic(frame);
+}
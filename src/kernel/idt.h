@@ -0,0 +1,40 @@
+#ifndef IDT_H
+#define IDT_H
+
+#include "kernel.h"
+
+#define IDT_SIZE 256
+#define IDT_EXCEPTIONS 32           // Vectors 0-31 are CPU exceptions
+#define IRQ_BASE 0x20               // The PICs are remapped to vectors 0x20-0x2F
+#define IRQ_COUNT 16
+#define IRQ_VECTOR(irq) (IRQ_BASE + (irq))
+#define LOCAL_VECTOR_BASE 0x30      // Local APIC sources (timer, IPIs)
+#define LOCAL_VECTOR_COUNT 16
+#define IDT_STUBS (LOCAL_VECTOR_BASE + LOCAL_VECTOR_COUNT)
+#define SPURIOUS_VECTOR 0xFF        // Local APIC spurious interrupt
+
+// Registers saved by the stubs in interrupts.asm, lowest address first
+typedef struct {
+    uint32_t edi, esi, ebp, esp, ebx, edx, ecx, eax;   // pushad (esp is unused)
+    uint32_t vector;
+    uint32_t error_code;            // 0 for vectors without one
+    uint32_t eip, cs, eflags;       // Pushed by the CPU
+} __attribute__((packed)) interrupt_frame_t;
+
+typedef void (*interrupt_handler_t)(interrupt_frame_t* frame);
+
+// Interrupt descriptor table, PIC setup and handler dispatch. Exceptions
+// without a handler dump the machine state and halt; IRQ handlers run
+// with interrupts off and the PIC (or local APIC) is acknowledged after
+// they return.
+void idt_init(void);
+void idt_load(void);
+int interrupt_register(uint32_t vector, interrupt_handler_t handler, const char* name);
+int irq_register(uint32_t irq, interrupt_handler_t handler, const char* name);
+void irq_use_apic(void);
+const char* irq_get_controller(void);
+uint32_t interrupt_get_count(uint32_t vector);
+const char* interrupt_get_name(uint32_t vector);
+uint32_t interrupt_get_spurious(void);
+
+#endif // IDT_H
@@ -1,19 +1,142 @@
 bits 32
 
-global keyboard_interrupt_handler
-extern keyboard_handler
+global interrupt_stub_table
+global spurious_interrupt_stub
+extern interrupt_dispatch
 
 section .text
 
-keyboard_interrupt_handler:
-    ; Save all 32-bit registers
+; CPU exception without an error code: push a 0 in its place
+%macro EXCEPTION 1
+exception_stub_%1:
+    push dword 0
+    push dword %1
+    jmp interrupt_common
+%endmacro
+
+; CPU exception with an error code (already pushed by the CPU)
+%macro EXCEPTION_ERROR 1
+exception_stub_%1:
+    push dword %1
+    jmp interrupt_common
+%endmacro
+
+; Device IRQ (8259 PIC or IOAPIC) on vector 0x20 + IRQ
+%macro IRQ 1
+irq_stub_%1:
+    push dword 0
+    push dword 0x20 + %1
+    jmp interrupt_common
+%endmacro
+
+; Local APIC interrupt (timer, IPIs) on vector 0x30 + n
+%macro LOCAL 1
+local_stub_%1:
+    push dword 0
+    push dword 0x30 + %1
+    jmp interrupt_common
+%endmacro
+
+EXCEPTION 0
+EXCEPTION 1
+EXCEPTION 2
+EXCEPTION 3
+EXCEPTION 4
+EXCEPTION 5
+EXCEPTION 6
+EXCEPTION 7
+EXCEPTION_ERROR 8
+EXCEPTION 9
+EXCEPTION_ERROR 10
+EXCEPTION_ERROR 11
+EXCEPTION_ERROR 12
+EXCEPTION_ERROR 13
+EXCEPTION_ERROR 14
+EXCEPTION 15
+EXCEPTION 16
+EXCEPTION_ERROR 17
+EXCEPTION 18
+EXCEPTION 19
+EXCEPTION 20
+EXCEPTION_ERROR 21
+EXCEPTION 22
+EXCEPTION 23
+EXCEPTION 24
+EXCEPTION 25
+EXCEPTION 26
+EXCEPTION 27
+EXCEPTION 28
+EXCEPTION_ERROR 29
+EXCEPTION_ERROR 30
+EXCEPTION 31
+
+IRQ 0
+IRQ 1
+IRQ 2
+IRQ 3
+IRQ 4
+IRQ 5
+IRQ 6
+IRQ 7
+IRQ 8
+IRQ 9
+IRQ 10
+IRQ 11
+IRQ 12
+IRQ 13
+IRQ 14
+IRQ 15
+
+LOCAL 0
+LOCAL 1
+LOCAL 2
+LOCAL 3
+LOCAL 4
+LOCAL 5
+LOCAL 6
+LOCAL 7
+LOCAL 8
+LOCAL 9
+LOCAL 10
+LOCAL 11
+LOCAL 12
+LOCAL 13
+LOCAL 14
+LOCAL 15
+
+; Local APIC spurious interrupt (vector 0xFF)
+spurious_interrupt_stub:
+    push dword 0
+    push dword 0xFF
+    jmp interrupt_common
+
+; Save the registers and hand the frame (see interrupt_frame_t) to C
+interrupt_common:
     pushad          ; Pushes EAX, ECX, EDX, EBX, ESP, EBP, ESI, EDI
-    
-    ; Call C keyboard handler
-    call keyboard_handler
-    
-    ; Restore all 32-bit registers
+    cld
+    push esp        ; interrupt_frame_t*
+    call interrupt_dispatch
+    add esp, 4
     popad           ; Pops EDI, ESI, EBP, ESP, EBX, EDX, ECX, EAX
-    
-    ; Return from interrupt (32-bit)
-    iret 
\ No newline at end of file
+    add esp, 8      ; Vector and error code
+    iret
+
+section .data
+
+; Stub addresses for vectors 0-63, installed by idt_init
+interrupt_stub_table:
+%assign i 0
+%rep 32
+    dd exception_stub_%+i
+%assign i i + 1
+%endrep
+%assign i 0
+%rep 16
+    dd irq_stub_%+i
+%assign i i + 1
+%endrep
+%assign i 0
+%rep 16
+    dd local_stub_%+i
+%assign i i + 1
+%endrep
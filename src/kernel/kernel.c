@@ -4,36 +4,39 @@
 #include "kernel.h"
 #include "filesystem.h"
 #include "editor.h"
+#include "heap.h"
+#include "pmm.h"
+#include "io.h"
+#include "diskfs.h"
+#include "bcache.h"
+#include "ata.h"
+#include "bootinfo.h"
+#include "timer.h"
+#include "rtc.h"
+#include "idt.h"
+#include "acpi.h"
+#include "apic.h"
+#include "smp.h"
+#include "thread.h"
+#include "task.h"
 
 // VGA text mode constants
 #define VGA_MEMORY 0xB8000
 #define VGA_WIDTH 80
 #define VGA_HEIGHT 25
+#define TERMINAL_ALL_ROWS ((1u << VGA_HEIGHT) - 1)
+#define TERMINAL_FLUSH_MS 20         // Longest a finished line waits for VGA memory
 
 // Keyboard constants
 #define KEYBOARD_DATA_PORT 0x60
 #define KEYBOARD_STATUS_PORT 0x64
-#define IDT_SIZE 256
-#define KERNEL_CODE_SEGMENT_OFFSET 0x08
+#define KEYBOARD_IRQ 1
+#define KEYBOARD_RING_SIZE 256      // Power of two
 
 // VGA color constants
 
-// IDT entry structure (32-bit)
-struct idt_entry {
-    uint16_t offset_low;
-    uint16_t selector;
-    uint8_t zero;
-    uint8_t type_attr;
-    uint16_t offset_high;
-} __attribute__((packed));
-
-// IDT pointer structure
-struct idt_ptr {
-    uint16_t limit;
-    uint32_t base;
-} __attribute__((packed));
-
 // Forward declarations
+void keyboard_handler(interrupt_frame_t* frame);
 void process_command(const char* command);
 void shell_prompt(void);
 int strncmp(const char* str1, const char* str2, size_t n);
@@ -41,24 +44,38 @@ void parse_command_args(const char* command, char* cmd, char* arg1, char* arg2);
 void tree_print_node(fs_node_t* node, int depth, int is_last);
 void run_editor(const char* filename);
 
-// Global variables for terminal state
+// Global variables for terminal state. Text goes to a back buffer in RAM
+// and terminal_flush copies the rows that changed to VGA memory. The back
+// buffer is a ring of lines, so scrolling moves terminal_top, not text.
 static size_t terminal_row;
 static size_t terminal_column;
 static uint8_t terminal_color;
-static uint16_t* terminal_buffer;
+static uint16_t terminal_lines[VGA_HEIGHT][VGA_WIDTH];
+static size_t terminal_top = 0;             // Ring line shown on screen row 0
+static uint32_t terminal_dirty = 0;         // Screen rows VGA memory is behind on
+static size_t terminal_pending_lines = 0;   // Newlines since the last flush
+static uint32_t terminal_flush_time = 0;
 
 // Global variables for keyboard input
 static char input_buffer[256];
 static size_t input_length = 0;
-static struct idt_entry idt[IDT_SIZE];
-static struct idt_ptr idt_pointer;
 
 // Editor state
 static int editor_active = 0;
 static editor_state_t* current_editor = NULL;
 
+// Scancodes from IRQ1, waiting for the main loop. The interrupt handler
+// only advances the head and the main loop only the tail, so neither side
+// needs a lock; the indices run freely and wrap at 2^32.
+static uint8_t scancode_ring[KEYBOARD_RING_SIZE];
+static volatile uint32_t scancode_head = 0;
+static volatile uint32_t scancode_tail = 0;
+static uint32_t scancodes_dropped = 0;
+static wait_queue_t keyboard_wait = WAIT_QUEUE_INIT;   // The shell, waiting for keys
+
 // Keyboard state
 static int shift_pressed = 0;
+static int ctrl_pressed = 0;
 static int caps_lock = 0;
 static int use_german_layout = 1; // Default to German layout
 
@@ -107,21 +124,7 @@ static char scancode_to_ascii_de_shift[] = {
 #define SCANCODE_LEFT_SHIFT 0x2A
 #define SCANCODE_RIGHT_SHIFT 0x36
 #define SCANCODE_CAPS_LOCK 0x3A
-
-// I/O port functions
-static inline uint8_t inb(uint16_t port) {
-    uint8_t ret;
-    asm volatile ("inb %1, %0" : "=a"(ret) : "Nd"(port));
-    return ret;
-}
-
-static inline void outb(uint16_t port, uint8_t val) {
-    asm volatile ("outb %0, %1" : : "a"(val), "Nd"(port));
-}
-
-static inline void io_wait(void) {
-    asm volatile ("outb %%al, $0x80" : : "a"(0));
-}
+#define SCANCODE_CTRL 0x1D          // Left Ctrl; right Ctrl is the same after 0xE0
 
 // Enable PS/2 keyboard and start scanning
 static void keyboard_init(void) {
@@ -178,6 +181,8 @@ static void keyboard_init(void) {
     while (!(inb(KEYBOARD_STATUS_PORT) & 0x01))
         io_wait();
     inb(KEYBOARD_DATA_PORT);  // Read ACK
+
+    irq_register(KEYBOARD_IRQ, keyboard_handler, "keyboard");
 }
 
 // Helper function to create VGA entry
@@ -221,20 +226,47 @@ int strncmp(const char* str1, const char* str2, size_t n) {
     return 0;
 }
 
+// Back buffer line shown on screen row y
+static inline uint16_t* terminal_line(size_t y) {
+    return terminal_lines[(terminal_top + y) % VGA_HEIGHT];
+}
+
+static void terminal_clear_line(uint16_t* line) {
+    uint16_t blank = vga_entry(' ', terminal_color);
+    for (size_t x = 0; x < VGA_WIDTH; x++) {
+        line[x] = blank;
+    }
+}
+
+// Copy the changed rows to VGA memory, a row at a time in 32-bit moves
+void terminal_flush(void) {
+    for (size_t y = 0; terminal_dirty && y < VGA_HEIGHT; y++) {
+        if (!(terminal_dirty & (1u << y))) {
+            continue;
+        }
+        uint16_t* vga = (uint16_t*)VGA_MEMORY + y * VGA_WIDTH;
+        const uint16_t* line = terminal_line(y);
+        size_t count = VGA_WIDTH / 2;
+        asm volatile ("rep movsl" : "+D"(vga), "+S"(line), "+c"(count) : : "memory");
+        terminal_dirty &= ~(1u << y);
+    }
+    terminal_pending_lines = 0;
+    terminal_flush_time = timer_uptime_ms();
+}
+
 // Initialize the terminal
 void terminal_initialize(void) {
     terminal_row = 0;
     terminal_column = 0;
     terminal_color = vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
-    terminal_buffer = (uint16_t*) VGA_MEMORY;
+    terminal_top = 0;
     
     // Clear the screen
     for (size_t y = 0; y < VGA_HEIGHT; y++) {
-        for (size_t x = 0; x < VGA_WIDTH; x++) {
-            const size_t index = y * VGA_WIDTH + x;
-            terminal_buffer[index] = vga_entry(' ', terminal_color);
-        }
+        terminal_clear_line(terminal_lines[y]);
     }
+    terminal_dirty = TERMINAL_ALL_ROWS;
+    terminal_flush();
 }
 
 // Set terminal color
@@ -244,34 +276,39 @@ void terminal_setcolor(uint8_t color) {
 
 // Put character at specific position
 void terminal_putentryat(char c, uint8_t color, size_t x, size_t y) {
-    const size_t index = y * VGA_WIDTH + x;
-    terminal_buffer[index] = vga_entry(c, color);
+    terminal_line(y)[x] = vga_entry(c, color);
+    terminal_dirty |= 1u << y;
 }
 
-// Scroll the terminal up by one line
+// Scroll the terminal up by one line: the top line becomes the new, blank
+// bottom line. Every row shows different text now, but scrolls between two
+// flushes cost a single repaint.
 void terminal_scroll(void) {
-    // Move all lines up
-    for (size_t y = 0; y < VGA_HEIGHT - 1; y++) {
-        for (size_t x = 0; x < VGA_WIDTH; x++) {
-            terminal_buffer[y * VGA_WIDTH + x] = terminal_buffer[(y + 1) * VGA_WIDTH + x];
-        }
+    terminal_top = (terminal_top + 1) % VGA_HEIGHT;
+    terminal_clear_line(terminal_line(VGA_HEIGHT - 1));
+    terminal_dirty = TERMINAL_ALL_ROWS;
+    terminal_row = VGA_HEIGHT - 1;
+}
+
+// Move to the next line. Output is flushed once a screenful has gone by or
+// TERMINAL_FLUSH_MS has passed, so long listings still show progress; until
+// the clock runs (early boot) every line is flushed as it ends.
+static void terminal_newline(void) {
+    terminal_column = 0;
+    if (++terminal_row == VGA_HEIGHT) {
+        terminal_scroll();
     }
-    
-    // Clear the bottom line
-    for (size_t x = 0; x < VGA_WIDTH; x++) {
-        terminal_buffer[(VGA_HEIGHT - 1) * VGA_WIDTH + x] = vga_entry(' ', terminal_color);
+    uint32_t now = timer_uptime_ms();
+    if (++terminal_pending_lines >= VGA_HEIGHT || now == 0 ||
+        now - terminal_flush_time >= TERMINAL_FLUSH_MS) {
+        terminal_flush();
     }
-    
-    terminal_row = VGA_HEIGHT - 1;
 }
 
 // Put a single character
 void terminal_putchar(char c) {
     if (c == '\n') {
-        terminal_column = 0;
-        if (++terminal_row == VGA_HEIGHT) {
-            terminal_scroll();
-        }
+        terminal_newline();
         return;
     }
     
@@ -284,10 +321,7 @@ void terminal_putchar(char c) {
         // Simple tab implementation - move to next multiple of 4
         terminal_column = (terminal_column + 4) & ~3;
         if (terminal_column >= VGA_WIDTH) {
-            terminal_column = 0;
-            if (++terminal_row == VGA_HEIGHT) {
-                terminal_scroll();
-            }
+            terminal_newline();
         }
         return;
     }
@@ -302,10 +336,7 @@ void terminal_putchar(char c) {
     
     terminal_putentryat(c, terminal_color, terminal_column, terminal_row);
     if (++terminal_column == VGA_WIDTH) {
-        terminal_column = 0;
-        if (++terminal_row == VGA_HEIGHT) {
-            terminal_scroll();
-        }
+        terminal_newline();
     }
 }
 
@@ -320,47 +351,84 @@ void terminal_writestring(const char* data) {
     terminal_write(data, strlen(data));
 }
 
+// Print an unsigned decimal number
+void terminal_writedec(uint32_t value) {
+    char digits[11];
+    int i = 10;
+    digits[i] = '\0';
+    do {
+        digits[--i] = '0' + (value % 10);
+        value /= 10;
+    } while (value > 0);
+    terminal_writestring(&digits[i]);
+}
+
 // Clear the screen
 void terminal_clear(void) {
     for (size_t y = 0; y < VGA_HEIGHT; y++) {
-        for (size_t x = 0; x < VGA_WIDTH; x++) {
-            const size_t index = y * VGA_WIDTH + x;
-            terminal_buffer[index] = vga_entry(' ', terminal_color);
-        }
+        terminal_clear_line(terminal_lines[y]);
     }
+    terminal_top = 0;
+    terminal_dirty = TERMINAL_ALL_ROWS;
     terminal_row = 0;
     terminal_column = 0;
 }
 
-// External assembly function declaration for keyboard interrupt handler
-extern void keyboard_interrupt_handler(void);
+// External assembly interrupt handlers
+// Keyboard interrupt handler (IRQ1; the dispatcher acknowledges the PIC).
+// Only queues the scancode and wakes the shell thread, which decodes keys
+// and runs commands in kernel_main.
+void keyboard_handler(interrupt_frame_t* frame) {
+    uint8_t scancode = inb(KEYBOARD_DATA_PORT);
+    uint32_t head = scancode_head;
 
-// Set up an IDT entry (32-bit version)
-void idt_set_entry(int num, uint32_t handler, uint16_t selector, uint8_t type_attr) {
-    idt[num].offset_low = handler & 0xFFFF;
-    idt[num].selector = selector;
-    idt[num].zero = 0;
-    idt[num].type_attr = type_attr;
-    idt[num].offset_high = (handler >> 16) & 0xFFFF;
+    if (head - scancode_tail == KEYBOARD_RING_SIZE) {
+        scancodes_dropped++;
+        return;
+    }
+    scancode_ring[head & (KEYBOARD_RING_SIZE - 1)] = scancode;
+    asm volatile ("" : : : "memory");  // Store the scancode before publishing it
+    scancode_head = head + 1;
+    wait_queue_wake_all(&keyboard_wait);
 }
 
-// Keyboard interrupt handler (called from assembly)
-void keyboard_handler(void) {
-    uint8_t scancode = inb(KEYBOARD_DATA_PORT);
+static int keyboard_has_input(void* arg) {
+    return scancode_head != scancode_tail;
+}
+
+// Take the oldest queued scancode; 0 if there is none
+static int keyboard_read_scancode(uint8_t* scancode) {
+    uint32_t tail = scancode_tail;
+    if (tail == scancode_head) {
+        return 0;
+    }
+    asm volatile ("" : : : "memory");  // Read the slot only after seeing the head
+    *scancode = scancode_ring[tail & (KEYBOARD_RING_SIZE - 1)];
+    asm volatile ("" : : : "memory");  // Free the slot only after reading it
+    scancode_tail = tail + 1;
+    return 1;
+}
+
+// Decode a scancode and feed it to the editor or the shell
+static void keyboard_process_scancode(uint8_t scancode) {
     int key_released = scancode & 0x80;
     scancode &= 0x7F; // Get the actual scancode without release bit
     
     // Track shift key state
     if (scancode == SCANCODE_LEFT_SHIFT || scancode == SCANCODE_RIGHT_SHIFT) {
         shift_pressed = !key_released;
-        outb(0x20, 0x20);  // End of interrupt to PIC
+        return;
+    }
+    
+    // Track ctrl key state
+    if (scancode == SCANCODE_CTRL) {
+        ctrl_pressed = !key_released;
         return;
     }
     
     // Track caps lock (toggle on press)
     if (scancode == SCANCODE_CAPS_LOCK && !key_released) {
         caps_lock = !caps_lock;
-        outb(0x20, 0x20);  // End of interrupt to PIC
         return;
     }
 
@@ -381,6 +449,11 @@ void keyboard_handler(void) {
                 if (caps_lock && ascii >= 'a' && ascii <= 'z') {
                     ascii = ascii - 'a' + 'A';
                 }
+                
+                // Ctrl with a letter gives its control character (Ctrl-R is 0x12)
+                if (ctrl_pressed && (ascii | 0x20) >= 'a' && (ascii | 0x20) <= 'z') {
+                    ascii &= 0x1F;
+                }
             }
             
             // Pass both ASCII character and raw scancode to editor
@@ -391,6 +464,7 @@ void keyboard_handler(void) {
             
             // Check if editor wants to exit
             if (current_editor->mode == -1) {
+                editor_free(current_editor);
                 editor_active = 0;
                 current_editor = NULL;
                 terminal_clear();
@@ -398,7 +472,6 @@ void keyboard_handler(void) {
             }
         }
         
-        outb(0x20, 0x20);  // End of interrupt to PIC
         return;
     }
 
@@ -437,8 +510,6 @@ void keyboard_handler(void) {
             }
         }
     }
-
-    outb(0x20, 0x20);  // End of interrupt to PIC
 }
 
 // Parse command into command and arguments
@@ -492,6 +563,121 @@ void parse_command_args(const char* command, char* cmd, char* arg1, char* arg2)
     arg2[arg2_len] = '\0';
 }
 
+// Bulk shell jobs spread over every CPU as fork/join tasks (task.c)
+#define BENCH_BUFFER_SIZE 65536
+#define BENCH_CHUNK_SIZE 4096
+#define BENCH_CHUNKS 4096           // 16MB of CRC-32 per run
+#define BENCH_GRAIN 16
+
+typedef struct {
+    fs_node_t* node;
+    uint32_t crc;
+} cksum_entry_t;
+
+static uint32_t bench_results[BENCH_CHUNKS];
+
+// Files under `node` in tree order, from index `count` on; with no
+// `entries` only counts them
+static size_t cksum_collect(fs_node_t* node, cksum_entry_t* entries, size_t count) {
+    if (node->type == FILE_TYPE_REGULAR) {
+        if (entries) {
+            entries[count].node = node;
+        }
+        return count + 1;
+    }
+    for (fs_node_t* child = node->first_child; child; child = child->next_sibling) {
+        count = cksum_collect(child, entries, count);
+    }
+    return count;
+}
+
+static void cksum_file(uint32_t index, void* arg) {
+    cksum_entry_t* entries = (cksum_entry_t*)arg;
+    entries[index].crc = fs_checksum_file(entries[index].node);
+}
+
+static void write_hex32(uint32_t value) {
+    for (int shift = 28; shift >= 0; shift -= 4) {
+        terminal_putchar("0123456789abcdef"[(value >> shift) & 0xF]);
+    }
+}
+
+// Path of `node` relative to the directory `top`
+static void write_relative_path(fs_node_t* node, fs_node_t* top) {
+    if (node->parent && node->parent != top) {
+        write_relative_path(node->parent, top);
+        terminal_putchar('/');
+    }
+    terminal_writestring(node->name);
+}
+
+static void bench_chunk(uint32_t index, void* arg) {
+    const uint8_t* buffer = (const uint8_t*)arg;
+    uint32_t offset = (index % (BENCH_BUFFER_SIZE / BENCH_CHUNK_SIZE)) * BENCH_CHUNK_SIZE;
+    bench_results[index] = fs_crc32(0, buffer + offset, BENCH_CHUNK_SIZE);
+}
+
+// Time the same CRC job with 1 to `max_workers` workers
+static void run_benchmark(uint32_t max_workers) {
+    uint8_t* buffer = (uint8_t*)kmalloc(BENCH_BUFFER_SIZE);
+    if (!buffer) {
+        terminal_writestring("bench: out of memory\n");
+        return;
+    }
+    for (uint32_t i = 0; i < BENCH_BUFFER_SIZE; i++) {
+        buffer[i] = (uint8_t)(i * 7 + (i >> 8));
+    }
+
+    terminal_writestring("CRC-32 of 16MB in 4KB tasks\n");
+    terminal_writestring("Workers  Time (ms)  Speedup  Steals\n");
+    uint32_t base_us = 0;
+    uint32_t expected = 0;
+    for (uint32_t workers = 1; workers <= max_workers; workers++) {
+        uint64_t start = timer_monotonic_ns();
+        task_parallel_for(workers, BENCH_CHUNKS, BENCH_GRAIN, bench_chunk, buffer);
+        uint32_t us = (uint32_t)div64_32(timer_monotonic_ns() - start, 1000, NULL);
+        if (us == 0) {
+            us = 1;
+        }
+
+        uint32_t combined = 0, steals = 0;
+        for (uint32_t i = 0; i < BENCH_CHUNKS; i++) {
+            combined = combined * 31 + bench_results[i];
+        }
+        for (uint32_t i = 0; i < workers; i++) {
+            task_worker_stats_t stats;
+            task_get_stats(i, &stats);
+            steals += stats.stolen;
+        }
+        if (workers == 1) {
+            base_us = us;
+            expected = combined;
+        }
+
+        uint32_t speedup = base_us * 100 / us;
+        terminal_writedec(workers);
+        terminal_writestring(workers < 10 ? "        " : "       ");
+        terminal_writedec(us / 1000);
+        terminal_putchar('.');
+        terminal_writedec(us / 100 % 10);
+        uint32_t width = 3;
+        for (uint32_t digits = us / 1000; digits >= 10; digits /= 10) {
+            width++;
+        }
+        for (; width < 11; width++) {
+            terminal_putchar(' ');
+        }
+        terminal_writedec(speedup / 100);
+        terminal_putchar('.');
+        terminal_putchar('0' + speedup / 10 % 10);
+        terminal_putchar('0' + speedup % 10);
+        terminal_writestring("x    ");
+        terminal_writedec(steals);
+        terminal_writestring(combined == expected ? "\n" : "  (wrong result)\n");
+    }
+    kfree(buffer);
+}
+
 // Process shell commands
 void process_command(const char* command) {
     if (strlen(command) == 0) {
@@ -510,6 +696,16 @@ void process_command(const char* command) {
         terminal_writestring("  clear        - Clear the screen\n");
         terminal_writestring("  echo <text>  - Echo text to the screen\n");
         terminal_writestring("  version      - Show OS version\n");
+        terminal_writestring("  mem          - Show memory and heap usage\n");
+        terminal_writestring("  bootinfo     - Show boot loader and command line\n");
+        terminal_writestring("  date         - Show the date and time (UTC)\n");
+        terminal_writestring("  uptime       - Show time since boot and timer statistics\n");
+        terminal_writestring("  irqs         - Show interrupt counts per vector\n");
+        terminal_writestring("  cpus         - Show the processors and what they have done\n");
+        terminal_writestring("  ps           - List kernel threads\n");
+        terminal_writestring("  kill <id>    - Stop a kernel thread\n");
+        terminal_writestring("  bench [n]    - Time a parallel job on 1 to n workers\n");
+        terminal_writestring("  sync         - Write cached disk blocks back now\n");
         terminal_writestring("  exit         - Halt the system\n\n");
         
         terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK));
@@ -520,7 +716,10 @@ void process_command(const char* command) {
         terminal_writestring("  cd <dir>     - Change directory\n");
         terminal_writestring("  mkdir <dir>  - Make directory\n");
         terminal_writestring("  rmdir <dir>  - Remove empty directory\n");
-        terminal_writestring("  stat <file>  - Show file information\n\n");
+        terminal_writestring("  stat <file>  - Show file information\n");
+        terminal_writestring("  dcache       - Show path lookup cache statistics\n");
+        terminal_writestring("  df           - Show disk usage\n");
+        terminal_writestring("  bcache       - Show disk buffer cache statistics\n\n");
         
         terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK));
         terminal_writestring("File Operations:\n");
@@ -528,11 +727,12 @@ void process_command(const char* command) {
         terminal_writestring("  touch <file> - Create empty file\n");
         terminal_writestring("  rm <file>    - Remove file\n");
         terminal_writestring("  cp <s> <d>   - Copy file\n");
-        terminal_writestring("  mv <s> <d>   - Move/rename file\n");
+        terminal_writestring("  mv <s> <d>   - Move/rename file or directory\n");
         terminal_writestring("  cat <file>   - Display file contents\n");
         terminal_writestring("  write <file> <text> - Write text to file\n");
         terminal_writestring("  stat <file>  - Show file information\n");
         terminal_writestring("  tree [dir]   - Show directory tree\n");
+        terminal_writestring("  cksum [path] - CRC-32 of a file or every file below a directory\n");
         terminal_writestring("  edit <file>  - Edit file in text editor\n");
         terminal_writestring("  vi <file>    - Edit file (alias for edit)\n");
         terminal_writestring("  kbd <layout> - Set keyboard layout (de/us)\n");
@@ -544,8 +744,284 @@ void process_command(const char* command) {
         terminal_writestring("PhantomOS v0.4 - 32-bit Kernel with POSIX File System\n");
         terminal_writestring("Features: German/US keyboard layouts, uppercase support, vim-like editor\n");
         
+    } else if (strcmp(cmd, "mem") == 0) {
+        heap_stats_t stats;
+        heap_get_stats(&stats);
+        terminal_writestring("Heap: ");
+        terminal_writedec(stats.used_bytes);
+        terminal_writestring(" / ");
+        terminal_writedec(stats.total_bytes);
+        terminal_writestring(" bytes used, largest free block ");
+        terminal_writedec(stats.largest_free);
+        terminal_writestring(" (");
+        terminal_writedec(stats.free_blocks);
+        terminal_writestring(" free blocks)\n");
+        terminal_writestring("Frames: ");
+        terminal_writedec(pmm_get_free_frames());
+        terminal_writestring(" / ");
+        terminal_writedec(pmm_get_total_frames());
+        terminal_writestring(" free (4 KB each)\n");
+        terminal_writestring("Allocs: ");
+        terminal_writedec(stats.alloc_count);
+        terminal_writestring("  Frees: ");
+        terminal_writedec(stats.free_count);
+        terminal_writestring("\n");
+        for (kmem_cache_t* cache = kmem_cache_first(); cache; cache = cache->next) {
+            terminal_writestring("  ");
+            terminal_writestring(cache->name);
+            terminal_writestring(": ");
+            terminal_writedec(cache->active_objects);
+            terminal_writestring(" objects in ");
+            terminal_writedec(cache->slab_count);
+            terminal_writestring(" slabs\n");
+        }
+        
+    } else if (strcmp(cmd, "bootinfo") == 0) {
+        boot_memory_map_t* map = boot_get_memory_map();
+        terminal_writestring("Loader: ");
+        terminal_writestring(boot_get_loader());
+        terminal_writestring("\nCommand line: ");
+        terminal_writestring(boot_get_cmdline());
+        terminal_writestring("\nMemory map: ");
+        terminal_writedec(map->entry_count);
+        terminal_writestring(" entries, ");
+        terminal_writedec(pmm_get_usable_bytes() / 1024);
+        terminal_writestring(" KB usable\n");
+        
+    } else if (strcmp(cmd, "date") == 0) {
+        char date[20];
+        rtc_format(timer_wall_clock(), date);
+        terminal_writestring(date);
+        terminal_writestring(" UTC\n");
+        
+    } else if (strcmp(cmd, "uptime") == 0) {
+        timer_stats_t stats;
+        timer_get_stats(&stats);
+        uint32_t uptime = timer_uptime_ms();
+        terminal_writestring("Up ");
+        terminal_writedec(uptime / 1000);
+        terminal_writestring(".");
+        terminal_putchar('0' + uptime / 100 % 10);
+        terminal_putchar('0' + uptime / 10 % 10);
+        terminal_putchar('0' + uptime % 10);
+        terminal_writestring(" s, ");
+        terminal_writedec((uint32_t)stats.ticks);
+        terminal_writestring(" ticks at ");
+        terminal_writedec(TIMER_HZ);
+        terminal_writestring(" Hz from the ");
+        terminal_writestring(stats.tick_source);
+        terminal_writestring("\n");
+        terminal_writestring("Clock: ");
+        if (stats.tsc_khz) {
+            terminal_writestring("TSC at ");
+            terminal_writedec(stats.tsc_khz / 1000);
+            terminal_writestring(" MHz\n");
+        } else {
+            terminal_writestring("PIT ticks (no TSC)\n");
+        }
+        terminal_writestring("Timers: ");
+        terminal_writedec(stats.pending);
+        terminal_writestring(" pending, ");
+        terminal_writedec(stats.fired);
+        terminal_writestring(" fired\n");
+        
+    } else if (strcmp(cmd, "ps") == 0) {
+        static const char* priority_names[THREAD_PRIORITIES] = { "low ", "norm", "high" };
+        thread_info_t threads[16];
+        uint32_t count = thread_list(threads, 16);
+        terminal_writestring("ID   PRI   STATE     TICKS       NAME\n");
+        for (uint32_t i = 0; i < count; i++) {
+            const char* state = thread_state_name(threads[i].state);
+            terminal_writedec(threads[i].id);
+            terminal_writestring(threads[i].id < 10 ? "    " : threads[i].id < 100 ? "   " : "  ");
+            terminal_writestring(priority_names[threads[i].priority]);
+            terminal_writestring("  ");
+            terminal_writestring(state);
+            for (size_t width = strlen(state); width < 10; width++) {
+                terminal_putchar(' ');
+            }
+            terminal_writedec(threads[i].ticks);
+            uint32_t width = 1;
+            for (uint32_t digits = threads[i].ticks; digits >= 10; digits /= 10) {
+                width++;
+            }
+            for (; width < 12; width++) {
+                terminal_putchar(' ');
+            }
+            terminal_writestring(threads[i].name);
+            terminal_writestring("\n");
+        }
+        terminal_writedec(thread_get_switches());
+        terminal_writestring(" context switches\n");
+        
+    } else if (strcmp(cmd, "kill") == 0) {
+        uint32_t id = 0;
+        const char* c = arg1;
+        for (; *c >= '0' && *c <= '9' && id < 100000; c++) {
+            id = id * 10 + (*c - '0');
+        }
+        if (arg1[0] == '\0' || *c != '\0') {
+            terminal_writestring("Usage: kill <thread id>\n");
+        } else if (thread_kill(id) != 0) {
+            terminal_writestring("kill: no such thread, or it cannot be killed\n");
+        }
+        
+    } else if (strcmp(cmd, "cpus") == 0) {
+        terminal_writestring("CPU  APIC  Role  Ticks       Idle ms     Work\n");
+        for (uint32_t i = 0; i < smp_cpu_count(); i++) {
+            cpu_t* cpu = smp_get_cpu(i);
+            uint32_t columns[3] = { cpu->ticks, (uint32_t)div64_32(cpu->idle_ns, 1000000, NULL), cpu->work_done };
+            terminal_writedec(i);
+            terminal_writestring(i < 10 ? "    " : "   ");
+            terminal_writedec(cpu->apic_id);
+            terminal_writestring(cpu->apic_id < 10 ? "     " : cpu->apic_id < 100 ? "    " : "   ");
+            terminal_writestring(i == 0 ? "boot  " : "AP    ");
+            for (int c = 0; c < 3; c++) {
+                terminal_writedec(columns[c]);
+                uint32_t width = 1;
+                for (uint32_t digits = columns[c]; digits >= 10; digits /= 10) {
+                    width++;
+                }
+                for (; c < 2 && width < 12; width++) {
+                    terminal_putchar(' ');
+                }
+            }
+            terminal_writestring("\n");
+        }
+        
+    } else if (strcmp(cmd, "irqs") == 0) {
+        terminal_writestring("Controller: ");
+        terminal_writestring(irq_get_controller());
+        terminal_writestring("\n");
+        terminal_writestring("Vector  Count       Name\n");
+        for (uint32_t vector = 0; vector < IDT_SIZE; vector++) {
+            uint32_t count = interrupt_get_count(vector);
+            if (count == 0) {
+                continue;
+            }
+            const char* name = interrupt_get_name(vector);
+            terminal_writestring("0x");
+            terminal_putchar("0123456789ABCDEF"[vector >> 4]);
+            terminal_putchar("0123456789ABCDEF"[vector & 0xF]);
+            terminal_writestring("    ");
+            terminal_writedec(count);
+            uint32_t width = 1;
+            for (uint32_t digits = count; digits >= 10; digits /= 10) {
+                width++;
+            }
+            for (; width < 12; width++) {
+                terminal_putchar(' ');
+            }
+            terminal_writestring(name ? name : "-");
+            terminal_writestring("\n");
+        }
+        terminal_writestring("Spurious: ");
+        terminal_writedec(interrupt_get_spurious());
+        terminal_writestring(", keyboard scancodes dropped: ");
+        terminal_writedec(scancodes_dropped);
+        terminal_writestring("\n");
+        
+    } else if (strcmp(cmd, "dcache") == 0) {
+        fs_dcache_stats_t stats;
+        fs_dcache_get_stats(&stats);
+        terminal_writestring("Path cache: ");
+        terminal_writedec(stats.hits);
+        terminal_writestring(" hits, ");
+        terminal_writedec(stats.misses);
+        terminal_writestring(" misses, ");
+        terminal_writedec(stats.invalidations);
+        terminal_writestring(" invalidations\n");
+        terminal_writestring("Entries: ");
+        terminal_writedec(stats.entries);
+        terminal_writestring(" / ");
+        terminal_writedec(FS_DCACHE_SIZE);
+        terminal_writestring("\n");
+        
+    } else if (strcmp(cmd, "df") == 0) {
+        diskfs_stats_t stats;
+        diskfs_get_stats(&stats);
+        if (!stats.mounted) {
+            terminal_writestring("df: no disk mounted - files are kept in RAM only\n");
+        } else {
+            terminal_writestring("Disk: ");
+            terminal_writedec((stats.total_blocks - stats.free_blocks) * PFS_BLOCK_SIZE / 1024);
+            terminal_writestring(" / ");
+            terminal_writedec(stats.total_blocks * PFS_BLOCK_SIZE / 1024);
+            terminal_writestring(" KB used\n");
+            terminal_writestring("Inodes: ");
+            terminal_writedec(stats.inode_count - stats.free_inodes);
+            terminal_writestring(" / ");
+            terminal_writedec(stats.inode_count);
+            terminal_writestring(" used\n");
+            terminal_writestring("Mounted ");
+            terminal_writedec(stats.mount_count);
+            terminal_writestring(" times\n");
+        }
+        
+    } else if (strcmp(cmd, "bcache") == 0) {
+        bcache_stats_t stats;
+        bcache_get_stats(&stats);
+        uint32_t lookups = stats.hits + stats.misses;
+        terminal_writestring("Buffer cache: ");
+        terminal_writedec(stats.hits);
+        terminal_writestring(" hits, ");
+        terminal_writedec(stats.misses);
+        terminal_writestring(" misses (");
+        terminal_writedec(lookups ? stats.hits * 100 / lookups : 0);
+        terminal_writestring("% hit rate)\n");
+        terminal_writestring("Read-ahead: ");
+        terminal_writedec(stats.readahead_blocks);
+        terminal_writestring(" blocks fetched, ");
+        terminal_writedec(stats.readahead_hits);
+        terminal_writestring(" used\n");
+        terminal_writestring("Writes: ");
+        terminal_writedec(stats.writes);
+        terminal_writestring(", ");
+        terminal_writedec(stats.blocks_flushed);
+        terminal_writestring(" blocks flushed in ");
+        terminal_writedec(stats.flushes);
+        terminal_writestring(" requests, ");
+        terminal_writedec(stats.evictions);
+        terminal_writestring(" evictions\n");
+        terminal_writestring("Buffers: ");
+        terminal_writedec(stats.cached);
+        terminal_writestring(" / ");
+        terminal_writedec(stats.buffers);
+        terminal_writestring(" cached, ");
+        terminal_writedec(stats.dirty);
+        terminal_writestring(" dirty\n");
+        
+        ata_stats_t disk;
+        ata_get_stats(&disk);
+        terminal_writestring("Disk: ");
+        terminal_writestring(disk.dma ? "bus-master DMA, " : "PIO, ");
+        terminal_writedec(disk.requests);
+        terminal_writestring(" requests merged into ");
+        terminal_writedec(disk.commands);
+        terminal_writestring(" commands, ");
+        terminal_writedec(disk.interrupts);
+        terminal_writestring(" interrupts, ");
+        terminal_writedec(disk.errors);
+        terminal_writestring(" errors\n");
+        
+    } else if (strcmp(cmd, "sync") == 0) {
+        if (!diskfs_is_mounted()) {
+            terminal_writestring("sync: no disk mounted - files are kept in RAM only\n");
+        } else {
+            int written = bcache_sync();
+            if (written < 0) {
+                terminal_writestring("sync: disk write failed\n");
+            } else {
+                terminal_writestring("Wrote ");
+                terminal_writedec(written);
+                terminal_writestring(" blocks to disk\n");
+            }
+        }
+        
     } else if (strcmp(cmd, "exit") == 0) {
+        bcache_sync();
         terminal_writestring("Halting system...\n");
+        terminal_flush();
         asm volatile ("cli; hlt");
         
     } else if (strcmp(cmd, "pwd") == 0) {
@@ -577,8 +1053,7 @@ void process_command(const char* command) {
         }
         
         // List directory contents
-        for (size_t i = 0; i < dir->child_count; i++) {
-            fs_node_t* child = dir->children[i];
+        for (fs_node_t* child = dir->first_child; child; child = child->next_sibling) {
             if (child->type == FILE_TYPE_DIRECTORY) {
                 terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_BLUE, VGA_COLOR_BLACK));
                 terminal_writestring(child->name);
@@ -632,6 +1107,7 @@ void process_command(const char* command) {
                     // Success - no output
                 } else {
                     terminal_writestring("mkdir: cannot create directory\n");
+                    fs_delete_node(new_dir);
                 }
             }
         }
@@ -653,9 +1129,11 @@ void process_command(const char* command) {
                 terminal_writestring("rmdir: failed to remove '");
                 terminal_writestring(arg1);
                 terminal_writestring("': Directory not empty\n");
-            } else {
-                fs_remove_child(node->parent, node->name);
-                fs_delete_node(node);
+            } else if (fs_delete_node(node) != 0) {
+                // The root and the current directory cannot be removed
+                terminal_writestring("rmdir: failed to remove '");
+                terminal_writestring(arg1);
+                terminal_writestring("'\n");
             }
         }
         
@@ -671,6 +1149,7 @@ void process_command(const char* command) {
                     // Success - no output
                 } else {
                     terminal_writestring("touch: cannot create file\n");
+                    fs_delete_node(new_file);
                 }
             }
             // If file exists, touch just updates timestamp (not implemented)
@@ -689,9 +1168,10 @@ void process_command(const char* command) {
                 terminal_writestring("rm: cannot remove '");
                 terminal_writestring(arg1);
                 terminal_writestring("': Is a directory\n");
-            } else {
-                fs_remove_child(node->parent, node->name);
-                fs_delete_node(node);
+            } else if (fs_delete_node(node) != 0) {
+                terminal_writestring("rm: cannot remove '");
+                terminal_writestring(arg1);
+                terminal_writestring("'\n");
             }
         }
         
@@ -727,14 +1207,18 @@ void process_command(const char* command) {
                 terminal_writestring(arg1);
                 terminal_writestring(": Is a directory\n");
             } else {
-                char* content = fs_read_file(node);
-                if (content) {
-                    terminal_writestring(content);
-                    if (strlen(content) == 0 || content[strlen(content)-1] != '\n') {
-                        terminal_writestring("\n");
-                    }
-                } else {
-                    // Empty file
+                // Stream the file block by block
+                char chunk[FS_BLOCK_SIZE];
+                size_t offset = 0;
+                char last = '\0';
+                int count;
+                while ((count = fs_read_file(node, offset, chunk, sizeof(chunk))) > 0) {
+                    terminal_write(chunk, count);
+                    offset += count;
+                    last = chunk[count - 1];
+                }
+                if (last != '\n') {
+                    terminal_writestring("\n");
                 }
             }
         }
@@ -763,7 +1247,7 @@ void process_command(const char* command) {
                     terminal_writestring(arg1);
                     terminal_writestring(": Is a directory\n");
                 } else {
-                    if (fs_write_file(node, arg2, strlen(arg2)) == 0) {
+                    if (fs_write_file(node, arg2, strlen(arg2)) >= 0) {
                         // Success - no output
                     } else {
                         terminal_writestring("write: cannot write to file\n");
@@ -817,6 +1301,11 @@ void process_command(const char* command) {
                     size_str[i] = '\0';
                     terminal_writestring(size_str);
                     terminal_writestring(" bytes\n");
+                    terminal_writestring("  Blocks: ");
+                    terminal_writedec(fs_block_count(node));
+                    terminal_writestring(" (");
+                    terminal_writedec(fs_shared_block_count(node));
+                    terminal_writestring(" shared)\n");
                 } else if (node->type == FILE_TYPE_DIRECTORY) {
                     terminal_writestring("  Contents: ");
                     char count_str[32];
@@ -839,6 +1328,15 @@ void process_command(const char* command) {
                     terminal_writestring(count_str);
                     terminal_writestring(" items\n");
                 }
+                
+                char date[20];
+                rtc_format(node->creation_time, date);
+                terminal_writestring("  Created:  ");
+                terminal_writestring(date);
+                rtc_format(node->modification_time, date);
+                terminal_writestring("\n  Modified: ");
+                terminal_writestring(date);
+                terminal_writestring("\n");
             }
         }
         
@@ -861,10 +1359,70 @@ void process_command(const char* command) {
         terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
         terminal_writestring("\n");
         
-        for (size_t i = 0; i < dir->child_count; i++) {
-            tree_print_node(dir->children[i], 0, i == dir->child_count - 1);
+        for (fs_node_t* child = dir->first_child; child; child = child->next_sibling) {
+            tree_print_node(child, 0, child->next_sibling == NULL);
         }
         
+    } else if (strcmp(cmd, "cksum") == 0) {
+        fs_node_t* node = strlen(arg1) > 0 ? fs_resolve_path(arg1) : fs_get_current_dir();
+        if (!node) {
+            terminal_writestring("cksum: ");
+            terminal_writestring(arg1);
+            terminal_writestring(": No such file or directory\n");
+            return;
+        }
+        
+        // Collect the files one by one, checksum them on every CPU, then
+        // print in tree order
+        size_t count = cksum_collect(node, NULL, 0);
+        if (count == 0) {
+            terminal_writestring("cksum: no files\n");
+            return;
+        }
+        cksum_entry_t* entries = (cksum_entry_t*)kmalloc(count * sizeof(cksum_entry_t));
+        if (!entries) {
+            terminal_writestring("cksum: out of memory\n");
+            return;
+        }
+        cksum_collect(node, entries, 0);
+        uint64_t start = timer_monotonic_ns();
+        uint32_t workers = task_parallel_for(task_max_workers(), count, 1, cksum_file, entries);
+        uint32_t us = (uint32_t)div64_32(timer_monotonic_ns() - start, 1000, NULL);
+        
+        fs_node_t* top = node->type == FILE_TYPE_DIRECTORY ? node : node->parent;
+        size_t bytes = 0;
+        for (size_t i = 0; i < count; i++) {
+            write_hex32(entries[i].crc);
+            terminal_writestring("  ");
+            terminal_writedec(entries[i].node->size);
+            terminal_writestring("  ");
+            write_relative_path(entries[i].node, top);
+            terminal_writestring("\n");
+            bytes += entries[i].node->size;
+        }
+        terminal_writedec(count);
+        terminal_writestring(" files, ");
+        terminal_writedec(bytes);
+        terminal_writestring(" bytes in ");
+        terminal_writedec(us);
+        terminal_writestring(" us on ");
+        terminal_writedec(workers);
+        terminal_writestring(workers == 1 ? " worker\n" : " workers\n");
+        kfree(entries);
+        
+    } else if (strcmp(cmd, "bench") == 0) {
+        uint32_t max_workers = task_max_workers();
+        if (strlen(arg1) > 0) {
+            uint32_t requested = 0;
+            for (const char* c = arg1; *c >= '0' && *c <= '9' && requested < 1000; c++) {
+                requested = requested * 10 + (*c - '0');
+            }
+            if (requested >= 1 && requested < max_workers) {
+                max_workers = requested;
+            }
+        }
+        run_benchmark(max_workers);
+        
     } else if (strcmp(cmd, "edit") == 0 || strcmp(cmd, "vi") == 0) {
         if (strlen(arg1) == 0) {
             // Open editor with no file
@@ -923,43 +1481,12 @@ void tree_print_node(fs_node_t* node, int depth, int is_last) {
     
     // Recursively print children for directories
     if (node->type == FILE_TYPE_DIRECTORY) {
-        for (size_t i = 0; i < node->child_count; i++) {
-            tree_print_node(node->children[i], depth + 1, i == node->child_count - 1);
+        for (fs_node_t* child = node->first_child; child; child = child->next_sibling) {
+            tree_print_node(child, depth + 1, child->next_sibling == NULL);
         }
     }
 }
 
-void init_idt(void) {
-    // Remap PIC
-    outb(0x20, 0x11);
-    outb(0xA0, 0x11);
-    outb(0x21, 0x20);
-    outb(0xA1, 0x28);
-    outb(0x21, 0x04);
-    outb(0xA1, 0x02);
-    outb(0x21, 0x01);
-    outb(0xA1, 0x01);
-
-    // Mask all IRQs then unmask keyboard (IRQ1)
-    outb(0x21, 0xFF);  // mask all on master PIC
-    outb(0xA1, 0xFF);  // mask all on slave PIC
-    outb(0x21, 0xFD);  // enable only keyboard (bit 1 cleared)
-
-    // ✅ Now install IDT entry AFTER remapping
-    idt_set_entry(0x20, (uint32_t)keyboard_interrupt_handler, KERNEL_CODE_SEGMENT_OFFSET, 0x8E); // Timer IRQ0
-    idt_set_entry(0x21, (uint32_t)keyboard_interrupt_handler, KERNEL_CODE_SEGMENT_OFFSET, 0x8E); // Keyboard IRQ1
-    idt_pointer.limit = sizeof(idt) - 1;
-    idt_pointer.base = (uint32_t)&idt;
-    asm volatile ("lidt %0" : : "m"(idt_pointer));
-
-    uint8_t m = inb(0x21);
-    char* vga = (char*)0xB8000;
-    vga[5] = 0x0F;
-
-    // Enable interrupts
-    asm volatile ("sti");
-
-}
 
 // Basic shell prompt with current directory
 void shell_prompt(void) {
@@ -973,14 +1500,53 @@ void shell_prompt(void) {
     terminal_writestring("$ ");
 }
 
-// Main kernel entry point
-void kernel_main(void) {
+// Dirty disk blocks are written back at most this long after the write
+#define WRITEBACK_INTERVAL_MS 1000
+
+// Background thread writing dirty disk blocks back; runs until killed
+static void writeback_thread(void* arg) {
+    while (thread_sleep_ms(WRITEBACK_INTERVAL_MS) == 0) {
+        fs_lock();
+        bcache_writeback();
+        fs_unlock();
+    }
+}
+
+// Apply the boot command line options (kbd=de|us, heap=<KB>)
+static void apply_boot_options(void) {
+    char layout[8];
+    if (boot_get_option("kbd", layout, sizeof(layout)) == 0) {
+        if (strcmp(layout, "us") == 0) {
+            use_german_layout = 0;
+        } else if (strcmp(layout, "de") == 0) {
+            use_german_layout = 1;
+        }
+    }
+
+    uint32_t heap_kb;
+    // Ignore sizes whose byte count would not fit in 32 bits
+    if (boot_get_option_number("heap", &heap_kb) == 0 && heap_kb <= 0xFFFFFFFF / 1024) {
+        heap_set_limit(heap_kb * 1024);
+    }
+}
+
+// Main kernel entry point (loader magic and boot information from _start)
+void kernel_main(uint32_t boot_magic, uint32_t boot_info) {
     char* video = (char*)0xB8000;
+
+    // Copy the loader's memory map and command line before anything can
+    // reuse the memory they are in
+    int boot_ok = boot_info_init(boot_magic, boot_info);
   
 
 
     // Initialize the terminal
     terminal_initialize();
+
+    // Catch exceptions from here on; IRQs stay masked until registered
+    idt_init();
+    cpu_init();
+    thread_init("shell", THREAD_PRIORITY_HIGH);
     
     // Print welcome message
     terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK));
@@ -992,16 +1558,70 @@ void kernel_main(void) {
     terminal_writestring("  - VGA text mode output\n");
     terminal_writestring("  - Keyboard input handling\n");
     terminal_writestring("  - Interrupt system\n");
-    terminal_writestring("  - In-memory file system\n");
+    terminal_writestring("  - Slab/free-list kernel heap\n");
+    terminal_writestring("  - File system persisted to the boot disk\n");
     terminal_writestring("  - POSIX-compatible shell commands\n");
     terminal_writestring("  - Vim-like text editor\n");
     terminal_writestring("  - German/US keyboard layouts (type 'kbd' for info)\n\n");
     
+    if (boot_ok != 0) {
+        terminal_writestring("Unknown boot loader - no memory map\n");
+    } else if (boot_get_cmdline()[0]) {
+        terminal_writestring("Boot options: ");
+        terminal_writestring(boot_get_cmdline());
+        terminal_writestring("\n");
+    }
+
+    // Initialize physical memory from the E820 map, then the kernel heap
+    pmm_init(boot_get_memory_map());
+    terminal_writestring("Memory: ");
+    terminal_writedec(pmm_get_usable_bytes() / 1024);
+    terminal_writestring(" KB usable, ");
+    terminal_writedec(pmm_get_free_frames());
+    terminal_writestring(" free page frames\n");
+    heap_init();
+    apply_boot_options();
+
+    // Route IRQs through the IOAPIC when the MADT lists one ("noapic" keeps the PIC)
+    if (boot_get_option("noapic", NULL, 0) != 0 && acpi_init() == 0) {
+        apic_init();
+    }
+    terminal_writestring("Interrupts: ");
+    terminal_writestring(irq_get_controller());
+    if (apic_enabled()) {
+        terminal_writestring(", ");
+        terminal_writedec(ioapic_get_count());
+        terminal_writestring(" IOAPIC");
+    }
+    terminal_writestring("\n");
+
+    // Start the clocks before the file system stamps anything
+    timer_init();
+    timer_stats_t timer_stats;
+    timer_get_stats(&timer_stats);
+    char date[20];
+    rtc_format(timer_stats.boot_time, date);
+    terminal_writestring("Clock: ");
+    terminal_writestring(date);
+    terminal_writestring(" UTC, ");
+    if (timer_stats.tsc_khz) {
+        terminal_writestring("TSC ");
+        terminal_writedec(timer_stats.tsc_khz / 1000);
+        terminal_writestring(" MHz\n");
+    } else {
+        terminal_writestring("no TSC\n");
+    }
+
+    // Bring up the other processors; they idle until smp_call hands them work
+    terminal_writestring("CPUs: ");
+    terminal_writedec(smp_init());
+    terminal_writestring(" online\n");
+    
     // Initialize file system
     fs_init();
 
     // Enable interrupts first, then keyboard
-    init_idt();
+    asm volatile ("sti");
     keyboard_init();
     
     // Start the shell
@@ -1012,9 +1632,23 @@ void kernel_main(void) {
     
     shell_prompt();
     
-    // Main kernel loop - just wait for interrupts
+    if (!thread_create("writeback", writeback_thread, NULL, THREAD_PRIORITY_NORMAL)) {
+        terminal_writestring("Warning: no write-back thread, use 'sync' to save files\n");
+    }
+    
+    // Main kernel loop, now the shell thread - decode queued keys and run
+    // their commands, holding the file system lock while it touches files,
+    // and block until the keyboard interrupt queues more. The idle thread
+    // halts the CPU when no thread has anything to do.
     while (1) {
-        asm volatile ("hlt"); // Halt until next interrupt
+        uint8_t scancode;
+        while (keyboard_read_scancode(&scancode)) {
+            fs_lock();
+            keyboard_process_scancode(scancode);
+            fs_unlock();
+        }
+        terminal_flush();
+        wait_queue_wait(&keyboard_wait, keyboard_has_input, NULL);
     }
 }
 
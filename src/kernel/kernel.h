@@ -25,6 +25,7 @@ typedef enum {
 typedef unsigned char uint8_t;
 typedef unsigned short uint16_t;
 typedef unsigned int uint32_t;
+typedef unsigned long long uint64_t;
 typedef unsigned int size_t;
 
 #define NULL ((void*)0)
@@ -34,7 +35,10 @@ void terminal_clear(void);
 void terminal_setcolor(uint8_t color);
 void terminal_putentryat(char c, uint8_t color, size_t x, size_t y);
 void terminal_writestring(const char* data);
+void terminal_write(const char* data, size_t size);
 void terminal_putchar(char c);
+void terminal_writedec(uint32_t value);
+void terminal_flush(void);
 uint8_t vga_entry_color(vga_color fg, vga_color bg);
 
 // String functions
@@ -54,6 +58,6 @@ void* memcpy(void* dest, const void* src, size_t size);
 void shell_prompt(void);
 
 // Basic math
-uint32_t get_current_time(void); // Simple time counter
+uint32_t get_current_time(void); // Wall-clock seconds since 1970
 
 #endif // KERNEL_H 
\ No newline at end of file
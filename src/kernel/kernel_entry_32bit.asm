@@ -3,13 +3,83 @@ bits 32
 global _start
 extern kernel_main
 
+; Multiboot headers, so QEMU -kernel (Multiboot) and GRUB (multiboot or
+; multiboot2) can load the ELF image directly. The linker puts this
+; section at the start of .text, inside the first 8KB of the file.
+MULTIBOOT_HEADER_MAGIC equ 0x1BADB002
+MULTIBOOT_MEMORY_INFO equ 0x00000002    ; Ask for the memory map
+MULTIBOOT2_HEADER_MAGIC equ 0xE85250D6
+MULTIBOOT2_ARCH_I386 equ 0
+
+KERNEL_STACK_SIZE equ 65536    ; In .bss, so it costs no disk space
+CODE_SEG equ 0x08
+DATA_SEG equ 0x10
+
+section .multiboot align=8
+multiboot2_header:
+    dd MULTIBOOT2_HEADER_MAGIC
+    dd MULTIBOOT2_ARCH_I386
+    dd multiboot2_header_end - multiboot2_header
+    dd 0x100000000 - (MULTIBOOT2_HEADER_MAGIC + MULTIBOOT2_ARCH_I386 + (multiboot2_header_end - multiboot2_header))
+    ; Information request: command line (1) and memory map (6)
+    align 8
+    dw 1, 0
+    dd 16
+    dd 1, 6
+    ; End tag
+    align 8
+    dw 0, 0
+    dd 8
+multiboot2_header_end:
+
+align 4
+multiboot_header:
+    dd MULTIBOOT_HEADER_MAGIC
+    dd MULTIBOOT_MEMORY_INFO
+    dd -(MULTIBOOT_HEADER_MAGIC + MULTIBOOT_MEMORY_INFO)
+
 section .text
 _start:
-    ; Call the C kernel main function
+    ; Entered in protected mode from stage 2 or a Multiboot loader, with
+    ; the loader's magic in EAX and its boot information in EBX. Multiboot
+    ; leaves the stack and GDT undefined, so set up our own.
+    cli
+    mov esp, kernel_stack_top
+    lgdt [gdt_descriptor]
+    jmp CODE_SEG:.reload_segments
+.reload_segments:
+    mov cx, DATA_SEG
+    mov ds, cx
+    mov es, cx
+    mov fs, cx
+    mov gs, cx
+    mov ss, cx
+
+    ; Call the C kernel main function with the boot magic and information
+    push ebx
+    push eax
     call kernel_main
-    
+
     ; If kernel_main returns (it shouldn't), halt
     cli
 .halt:
     hlt
-    jmp .halt 
\ No newline at end of file
+    jmp .halt
+
+; Flat 4GB code and data segments (same selectors as stage 2's GDT)
+section .gdt
+gdt_start:
+    dq 0x0000000000000000   ; Null descriptor
+    dq 0x00CF9A000000FFFF   ; Code segment: ring 0, execute/read
+    dq 0x00CF92000000FFFF   ; Data segment: ring 0, read/write
+gdt_end:
+
+gdt_descriptor:
+    dw gdt_end - gdt_start - 1
+    dd gdt_start
+
+section .bss
+align 16
+kernel_stack:
+    resb KERNEL_STACK_SIZE
+kernel_stack_top:
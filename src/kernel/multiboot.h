@@ -0,0 +1,58 @@
+#ifndef MULTIBOOT_H
+#define MULTIBOOT_H
+
+#include "kernel.h"
+
+// Multiboot (version 1) - QEMU -kernel, GRUB "multiboot"
+#define MULTIBOOT_HEADER_MAGIC 0x1BADB002
+#define MULTIBOOT_BOOTLOADER_MAGIC 0x2BADB002
+#define MULTIBOOT_INFO_MEMORY 0x001   // mem_lower/mem_upper are valid
+#define MULTIBOOT_INFO_CMDLINE 0x004   // cmdline is valid
+#define MULTIBOOT_INFO_MEM_MAP 0x040   // mmap_length/mmap_addr are valid
+
+// Multiboot 2 - GRUB "multiboot2"
+#define MULTIBOOT2_HEADER_MAGIC 0xE85250D6
+#define MULTIBOOT2_BOOTLOADER_MAGIC 0x36D76289
+#define MULTIBOOT2_TAG_END 0
+#define MULTIBOOT2_TAG_CMDLINE 1
+#define MULTIBOOT2_TAG_MMAP 6
+
+// Boot information from a Multiboot loader (only the fields we use)
+typedef struct {
+    uint32_t flags;
+    uint32_t mem_lower;
+    uint32_t mem_upper;
+    uint32_t boot_device;
+    uint32_t cmdline;
+    uint32_t mods_count;
+    uint32_t mods_addr;
+    uint32_t syms[4];
+    uint32_t mmap_length;
+    uint32_t mmap_addr;
+} __attribute__((packed)) multiboot_info_t;
+
+// Multiboot memory map entry; `size` does not count itself
+typedef struct {
+    uint32_t size;
+    uint32_t base_low;
+    uint32_t base_high;
+    uint32_t length_low;
+    uint32_t length_high;
+    uint32_t type;
+} __attribute__((packed)) multiboot_mmap_entry_t;
+
+// Multiboot 2 information: total size, reserved, then 8-byte aligned tags
+typedef struct {
+    uint32_t type;
+    uint32_t size;
+} __attribute__((packed)) multiboot2_tag_t;
+
+typedef struct {
+    uint32_t type;
+    uint32_t size;
+    uint32_t entry_size;
+    uint32_t entry_version;
+    // Entries: base (64), length (64), type, reserved
+} __attribute__((packed)) multiboot2_tag_mmap_t;
+
+#endif // MULTIBOOT_H
@@ -0,0 +1,59 @@
+// PhantomOS PCI Bus
+// Configuration mechanism #1 access and a brute-force device scan
+
+#include "pci.h"
+#include "io.h"
+
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA 0xCFC
+
+#define PCI_VENDOR_NONE 0xFFFF
+#define PCI_MULTIFUNCTION 0x80
+
+static void pci_select(const pci_device_t* dev, uint8_t offset) {
+    outl(PCI_CONFIG_ADDRESS, 0x80000000u | ((uint32_t)dev->bus << 16) |
+         ((uint32_t)dev->slot << 11) | ((uint32_t)dev->function << 8) | (offset & 0xFC));
+}
+
+uint32_t pci_config_read32(const pci_device_t* dev, uint8_t offset) {
+    pci_select(dev, offset);
+    return inl(PCI_CONFIG_DATA);
+}
+
+uint16_t pci_config_read16(const pci_device_t* dev, uint8_t offset) {
+    return (uint16_t)(pci_config_read32(dev, offset) >> ((offset & 2) * 8));
+}
+
+uint8_t pci_config_read8(const pci_device_t* dev, uint8_t offset) {
+    return (uint8_t)(pci_config_read32(dev, offset) >> ((offset & 3) * 8));
+}
+
+void pci_config_write16(const pci_device_t* dev, uint8_t offset, uint16_t value) {
+    pci_select(dev, offset);
+    outw(PCI_CONFIG_DATA + (offset & 2), value);
+}
+
+// Scan every bus, slot and function for a matching class code
+int pci_find_class(uint8_t class_code, uint8_t subclass, pci_device_t* out) {
+    for (uint32_t bus = 0; bus < 256; bus++) {
+        for (uint8_t slot = 0; slot < 32; slot++) {
+            pci_device_t dev = { (uint8_t)bus, slot, 0 };
+            if (pci_config_read16(&dev, 0) == PCI_VENDOR_NONE) {
+                continue;
+            }
+
+            uint8_t functions = (pci_config_read8(&dev, PCI_HEADER_TYPE) & PCI_MULTIFUNCTION) ? 8 : 1;
+            for (dev.function = 0; dev.function < functions; dev.function++) {
+                if (pci_config_read16(&dev, 0) == PCI_VENDOR_NONE) {
+                    continue;
+                }
+                if (pci_config_read8(&dev, PCI_CLASS) == class_code &&
+                    pci_config_read8(&dev, PCI_SUBCLASS) == subclass) {
+                    *out = dev;
+                    return 0;
+                }
+            }
+        }
+    }
+    return -1;
+}
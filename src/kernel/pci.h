@@ -0,0 +1,38 @@
+#ifndef PCI_H
+#define PCI_H
+
+#include "kernel.h"
+
+// Configuration space registers
+#define PCI_COMMAND 0x04
+#define PCI_PROG_IF 0x09
+#define PCI_SUBCLASS 0x0A
+#define PCI_CLASS 0x0B
+#define PCI_HEADER_TYPE 0x0E
+#define PCI_BAR0 0x10
+#define PCI_BAR4 0x20
+
+// Command register bits
+#define PCI_COMMAND_IO 0x0001
+#define PCI_COMMAND_BUS_MASTER 0x0004
+
+// Class codes
+#define PCI_CLASS_STORAGE 0x01
+#define PCI_SUBCLASS_IDE 0x01
+
+typedef struct {
+    uint8_t bus;
+    uint8_t slot;
+    uint8_t function;
+} pci_device_t;
+
+// Configuration space access through ports 0xCF8/0xCFC
+uint32_t pci_config_read32(const pci_device_t* dev, uint8_t offset);
+uint16_t pci_config_read16(const pci_device_t* dev, uint8_t offset);
+uint8_t pci_config_read8(const pci_device_t* dev, uint8_t offset);
+void pci_config_write16(const pci_device_t* dev, uint8_t offset, uint16_t value);
+
+// Find the first function with the given class; returns -1 if there is none
+int pci_find_class(uint8_t class_code, uint8_t subclass, pci_device_t* out);
+
+#endif // PCI_H
@@ -0,0 +1,75 @@
+#ifndef PFS_H
+#define PFS_H
+
+// PhantomFS on-disk format
+// Shared by the kernel and the host mkfs/fsck tools, so this header includes
+// nothing itself: include it after kernel.h (kernel) or <stdint.h> (host).
+//
+// Layout, in 512-byte blocks counted from PFS_START_LBA:
+//   0                superblock
+//   bitmap_start     block bitmap (1 bit per block, 1 = used)
+//   inode_start      inode table (inode 0 unused, inode 1 is the root)
+//   data_start       file data, directory entries and indirect blocks
+
+#define PFS_MAGIC 0x53464850        // "PHFS"
+#define PFS_VERSION 1
+#define PFS_BLOCK_SIZE 512          // One sector per block
+#define PFS_START_LBA 256           // Sectors below this belong to the bootloader and kernel
+#define PFS_ROOT_INODE 1
+#define PFS_BLOCKS_PER_INODE 8      // mkfs creates one inode for every 8 blocks
+#define PFS_NAME_LENGTH 64
+
+// Block pointers: direct, then one single- and one double-indirect block
+#define PFS_DIRECT_BLOCKS 10
+#define PFS_PTRS_PER_BLOCK (PFS_BLOCK_SIZE / 4)
+#define PFS_MAX_FILE_BLOCKS (PFS_DIRECT_BLOCKS + PFS_PTRS_PER_BLOCK + \
+                             PFS_PTRS_PER_BLOCK * PFS_PTRS_PER_BLOCK)
+
+// Inode types
+#define PFS_TYPE_FREE 0
+#define PFS_TYPE_FILE 1
+#define PFS_TYPE_DIR 2
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t block_size;
+    uint32_t total_blocks;
+    uint32_t bitmap_start;
+    uint32_t bitmap_blocks;
+    uint32_t inode_start;
+    uint32_t inode_blocks;
+    uint32_t inode_count;
+    uint32_t data_start;
+    uint32_t root_inode;
+    uint32_t mount_count;
+    uint8_t reserved[PFS_BLOCK_SIZE - 48];
+} pfs_superblock_t;
+
+typedef struct {
+    uint16_t type;
+    uint16_t reserved;
+    uint32_t size;                  // Bytes; directories hold size / sizeof(pfs_dirent_t) slots
+    uint32_t creation_time;
+    uint32_t modification_time;
+    uint32_t direct[PFS_DIRECT_BLOCKS];
+    uint32_t indirect;
+    uint32_t double_indirect;
+} pfs_inode_t;
+
+// Directory entry; a zero inode marks a free slot
+typedef struct {
+    uint32_t inode;
+    char name[PFS_NAME_LENGTH];     // NUL-terminated
+} pfs_dirent_t;
+
+#define PFS_INODES_PER_BLOCK (PFS_BLOCK_SIZE / sizeof(pfs_inode_t))
+#define PFS_DIRENTS_PER_BLOCK (PFS_BLOCK_SIZE / sizeof(pfs_dirent_t))
+#define PFS_BITS_PER_BLOCK (PFS_BLOCK_SIZE * 8)
+
+// The structures above are naturally aligned; these pin the on-disk sizes
+_Static_assert(sizeof(pfs_superblock_t) == PFS_BLOCK_SIZE, "superblock must fill one block");
+_Static_assert(sizeof(pfs_inode_t) == 64, "inode size is part of the disk format");
+_Static_assert(sizeof(pfs_dirent_t) == 68, "dirent size is part of the disk format");
+
+#endif // PFS_H
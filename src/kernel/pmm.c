@@ -0,0 +1,218 @@
+// PhantomOS Physical Memory Manager
+// Bitmap frame allocator built from the BIOS E820 memory map. One bit per
+// 4 KB frame (1 = used); the bitmap itself lives right after kernel_end.
+
+#include "pmm.h"
+#include "spinlock.h"
+
+// Exported by linker.ld
+extern char kernel_end[];
+
+static uint32_t* frame_bitmap = NULL;
+static size_t frame_count = 0;
+static size_t free_frames = 0;
+static size_t search_hint = 0;  // Word index to start the next search from
+static uint32_t usable_bytes = 0;
+static spinlock_t pmm_lock = SPINLOCK_INIT;
+
+static inline void frame_set(size_t frame) {
+    frame_bitmap[frame / 32] |= (1u << (frame % 32));
+}
+
+static inline void frame_clear(size_t frame) {
+    frame_bitmap[frame / 32] &= ~(1u << (frame % 32));
+}
+
+static inline int frame_test(size_t frame) {
+    return (frame_bitmap[frame / 32] >> (frame % 32)) & 1;
+}
+
+// Clip an E820 entry to the 32-bit physical address space
+static int e820_range(e820_entry_t* entry, uint32_t* start, uint32_t* end) {
+    if (entry->base_high != 0) {
+        return -1; // Above 4 GB - not addressable without PAE
+    }
+
+    *start = entry->base_low;
+    if (entry->length_high != 0 || entry->length_low > 0xFFFFFFFF - entry->base_low) {
+        *end = 0xFFFFF000;
+    } else {
+        *end = entry->base_low + entry->length_low;
+    }
+    return *end > *start ? 0 : -1;
+}
+
+// Initialize the frame allocator from the bootloader memory map
+void pmm_init(boot_memory_map_t* memory_map) {
+    frame_bitmap = NULL;
+    frame_count = 0;
+    free_frames = 0;
+    search_hint = 0;
+    usable_bytes = 0;
+
+    if (!memory_map || memory_map->entry_count == 0) {
+        return; // No E820 data - only the static heap pool is available
+    }
+
+    size_t entries = memory_map->entry_count;
+    if (entries > E820_MAX_ENTRIES) {
+        entries = E820_MAX_ENTRIES;
+    }
+
+    // Find the highest usable address to size the bitmap
+    uint32_t highest = 0;
+    for (size_t i = 0; i < entries; i++) {
+        uint32_t start, end;
+        if (memory_map->entries[i].type != E820_TYPE_USABLE ||
+            e820_range(&memory_map->entries[i], &start, &end) != 0) {
+            continue;
+        }
+        if (usable_bytes > 0xFFFFFFFF - (end - start)) {
+            usable_bytes = 0xFFFFFFFF;
+        } else {
+            usable_bytes += end - start;
+        }
+        if (end > highest) {
+            highest = end;
+        }
+    }
+
+    // Place the bitmap on the first page boundary after the kernel image
+    uint32_t bitmap_start = ((uint32_t)kernel_end + PMM_FRAME_SIZE - 1) & ~(PMM_FRAME_SIZE - 1);
+    size_t total = highest / PMM_FRAME_SIZE;
+    size_t bitmap_bytes = ((total + 31) / 32) * sizeof(uint32_t);
+    uint32_t reserved_end = (bitmap_start + bitmap_bytes + PMM_FRAME_SIZE - 1) & ~(PMM_FRAME_SIZE - 1);
+
+    if (reserved_end >= highest) {
+        return; // Not enough memory above the kernel for the bitmap
+    }
+
+    frame_bitmap = (uint32_t*)bitmap_start;
+    frame_count = total;
+    memset(frame_bitmap, 0xFF, bitmap_bytes);
+
+    // Release whole frames inside usable regions
+    for (size_t i = 0; i < entries; i++) {
+        uint32_t start, end;
+        if (memory_map->entries[i].type != E820_TYPE_USABLE ||
+            e820_range(&memory_map->entries[i], &start, &end) != 0) {
+            continue;
+        }
+        size_t first = (start + PMM_FRAME_SIZE - 1) / PMM_FRAME_SIZE;
+        size_t last = end / PMM_FRAME_SIZE;
+        for (size_t frame = first; frame < last && frame < frame_count; frame++) {
+            if (frame_test(frame)) {
+                frame_clear(frame);
+                free_frames++;
+            }
+        }
+    }
+
+    // Everything below the end of the bitmap (low memory, kernel, bitmap) stays reserved
+    for (size_t frame = 0; frame < reserved_end / PMM_FRAME_SIZE; frame++) {
+        if (!frame_test(frame)) {
+            frame_set(frame);
+            free_frames--;
+        }
+    }
+
+    search_hint = (reserved_end / PMM_FRAME_SIZE) / 32;
+}
+
+// Find and claim a run of free frames (pmm_lock held)
+static uint32_t pmm_claim_frames(size_t count) {
+    if (count == 0 || count > free_frames) {
+        return 0;
+    }
+
+    size_t words = (frame_count + 31) / 32;
+
+    for (size_t pass = 0; pass < 2; pass++) {
+        size_t run_start = 0;
+        size_t run_length = 0;
+        size_t frame = (pass == 0 ? search_hint : 0) * 32;
+        size_t limit = pass == 0 ? frame_count : search_hint * 32 + count;
+        if (limit > frame_count) {
+            limit = frame_count;
+        }
+
+        while (frame < limit) {
+            // Skip fully used words quickly
+            if (frame % 32 == 0 && frame_bitmap[frame / 32] == 0xFFFFFFFF) {
+                run_length = 0;
+                frame += 32;
+                continue;
+            }
+
+            if (frame_test(frame)) {
+                run_length = 0;
+            } else {
+                if (run_length == 0) {
+                    run_start = frame;
+                }
+                if (++run_length == count) {
+                    for (size_t i = run_start; i < run_start + count; i++) {
+                        frame_set(i);
+                    }
+                    free_frames -= count;
+                    search_hint = (run_start + count) / 32;
+                    if (search_hint >= words) {
+                        search_hint = 0;
+                    }
+                    return run_start * PMM_FRAME_SIZE;
+                }
+            }
+            frame++;
+        }
+    }
+
+    return 0; // No contiguous run large enough
+}
+
+// Allocate a run of physically contiguous frames; returns 0 on failure
+uint32_t pmm_alloc_frames(size_t count) {
+    uint32_t irq = spin_lock_irqsave(&pmm_lock);
+    uint32_t addr = pmm_claim_frames(count);
+    spin_unlock_irqrestore(&pmm_lock, irq);
+    return addr;
+}
+
+// Allocate a single 4 KB frame; returns 0 on failure
+uint32_t pmm_alloc_frame(void) {
+    return pmm_alloc_frames(1);
+}
+
+// Release a run of frames
+void pmm_free_frames(uint32_t addr, size_t count) {
+    size_t first = addr / PMM_FRAME_SIZE;
+
+    uint32_t irq = spin_lock_irqsave(&pmm_lock);
+    for (size_t frame = first; frame < first + count && frame < frame_count; frame++) {
+        if (frame_test(frame)) {
+            frame_clear(frame);
+            free_frames++;
+        }
+    }
+
+    if (first / 32 < search_hint) {
+        search_hint = first / 32;
+    }
+    spin_unlock_irqrestore(&pmm_lock, irq);
+}
+
+// Release a single frame
+void pmm_free_frame(uint32_t addr) {
+    pmm_free_frames(addr, 1);
+}
+
+size_t pmm_get_total_frames(void) {
+    return frame_count;
+}
+
+size_t pmm_get_free_frames(void) {
+    return free_frames;
+}
+
+uint32_t pmm_get_usable_bytes(void) {
+    return usable_bytes;
+}
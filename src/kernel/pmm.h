@@ -0,0 +1,37 @@
+#ifndef PMM_H
+#define PMM_H
+
+#include "kernel.h"
+
+// Physical memory constants
+#define PMM_FRAME_SIZE 4096
+#define E820_MAX_ENTRIES 32
+#define E820_TYPE_USABLE 1
+
+// BIOS E820 memory map entry (as stored by the bootloader)
+typedef struct {
+    uint32_t base_low;
+    uint32_t base_high;
+    uint32_t length_low;
+    uint32_t length_high;
+    uint32_t type;
+    uint32_t acpi_attributes;
+} __attribute__((packed)) e820_entry_t;
+
+// Memory map in E820 form (stored by stage 2, or built from Multiboot data)
+typedef struct {
+    uint32_t entry_count;
+    e820_entry_t entries[E820_MAX_ENTRIES];
+} __attribute__((packed)) boot_memory_map_t;
+
+// Physical memory manager (bitmap frame allocator)
+void pmm_init(boot_memory_map_t* memory_map);
+uint32_t pmm_alloc_frame(void);
+uint32_t pmm_alloc_frames(size_t count);
+void pmm_free_frame(uint32_t addr);
+void pmm_free_frames(uint32_t addr, size_t count);
+size_t pmm_get_total_frames(void);
+size_t pmm_get_free_frames(void);
+uint32_t pmm_get_usable_bytes(void);
+
+#endif // PMM_H
@@ -0,0 +1,150 @@
+// PhantomOS Real-Time Clock
+// Reads the date and time from the CMOS clock once at boot; the timer
+// subsystem keeps wall-clock time from there with its monotonic clock.
+
+#include "rtc.h"
+#include "io.h"
+
+#define CMOS_ADDRESS 0x70
+#define CMOS_DATA 0x71
+#define CMOS_NMI_DISABLE 0x80
+
+// CMOS registers
+#define RTC_SECONDS 0x00
+#define RTC_MINUTES 0x02
+#define RTC_HOURS 0x04
+#define RTC_DAY 0x07
+#define RTC_MONTH 0x08
+#define RTC_YEAR 0x09
+#define RTC_STATUS_A 0x0A
+#define RTC_STATUS_B 0x0B
+
+#define RTC_A_UPDATING 0x80     // Registers are being updated
+#define RTC_B_24_HOUR 0x02
+#define RTC_B_BINARY 0x04       // Values are binary, not BCD
+#define RTC_HOUR_PM 0x80        // PM flag in 12-hour mode
+
+static uint8_t cmos_read(uint8_t reg) {
+    outb(CMOS_ADDRESS, CMOS_NMI_DISABLE | reg);
+    return inb(CMOS_DATA);
+}
+
+static void rtc_read_raw(uint8_t* regs) {
+    // Wait for any update in progress to finish (it takes under 2ms)
+    for (uint32_t i = 0; i < 1000000 && (cmos_read(RTC_STATUS_A) & RTC_A_UPDATING); i++) {
+    }
+    regs[0] = cmos_read(RTC_SECONDS);
+    regs[1] = cmos_read(RTC_MINUTES);
+    regs[2] = cmos_read(RTC_HOURS);
+    regs[3] = cmos_read(RTC_DAY);
+    regs[4] = cmos_read(RTC_MONTH);
+    regs[5] = cmos_read(RTC_YEAR);
+}
+
+static uint32_t bcd_to_binary(uint8_t value) {
+    return (value >> 4) * 10 + (value & 0x0F);
+}
+
+// Read the current date and time; -1 if the clock reports nonsense
+int rtc_read(rtc_time_t* time) {
+    uint8_t regs[6], check[6];
+
+    // An update can start between two reads: read until two agree
+    rtc_read_raw(regs);
+    for (int tries = 0; tries < 5; tries++) {
+        rtc_read_raw(check);
+        int same = 1;
+        for (int i = 0; i < 6; i++) {
+            same &= regs[i] == check[i];
+        }
+        if (same) {
+            break;
+        }
+        memcpy(regs, check, sizeof(regs));
+    }
+
+    uint8_t status_b = cmos_read(RTC_STATUS_B);
+    int pm = !(status_b & RTC_B_24_HOUR) && (regs[2] & RTC_HOUR_PM);
+    regs[2] &= ~RTC_HOUR_PM;
+
+    uint32_t values[6];
+    for (int i = 0; i < 6; i++) {
+        values[i] = (status_b & RTC_B_BINARY) ? regs[i] : bcd_to_binary(regs[i]);
+    }
+
+    time->second = values[0];
+    time->minute = values[1];
+    time->hour = values[2];
+    time->day = values[3];
+    time->month = values[4];
+    time->year = values[5] + (values[5] < 70 ? 2000 : 1900);
+    if (!(status_b & RTC_B_24_HOUR)) {
+        time->hour = (time->hour % 12) + (pm ? 12 : 0);
+    }
+
+    if (time->second > 59 || time->minute > 59 || time->hour > 23 ||
+        time->day < 1 || time->day > 31 || time->month < 1 || time->month > 12) {
+        return -1;
+    }
+    return 0;
+}
+
+// Seconds since 1970-01-01 00:00:00 UTC (the RTC is assumed to run in UTC)
+uint32_t rtc_to_unix(const rtc_time_t* time) {
+    // Days from the civil date, counting years from March so the leap day is last
+    uint32_t year = time->year - (time->month <= 2);
+    uint32_t era = year / 400;
+    uint32_t year_of_era = year - era * 400;
+    uint32_t month = time->month > 2 ? time->month - 3 : time->month + 9;
+    uint32_t day_of_year = (153 * month + 2) / 5 + time->day - 1;
+    uint32_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    uint32_t days = era * 146097 + day_of_era - 719468;
+
+    return days * 86400 + time->hour * 3600 + time->minute * 60 + time->second;
+}
+
+void rtc_from_unix(uint32_t seconds, rtc_time_t* time) {
+    uint32_t days = seconds / 86400;
+    uint32_t rest = seconds % 86400;
+    time->hour = rest / 3600;
+    time->minute = rest / 60 % 60;
+    time->second = rest % 60;
+
+    // Inverse of rtc_to_unix's day count
+    days += 719468;
+    uint32_t era = days / 146097;
+    uint32_t day_of_era = days - era * 146097;
+    uint32_t year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+    uint32_t day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    uint32_t month = (5 * day_of_year + 2) / 153;
+    time->day = day_of_year - (153 * month + 2) / 5 + 1;
+    time->month = month < 10 ? month + 3 : month - 9;
+    time->year = year_of_era + era * 400 + (time->month <= 2);
+}
+
+static char* format_number(char* out, uint32_t value, int digits) {
+    for (int i = digits - 1; i >= 0; i--) {
+        out[i] = '0' + value % 10;
+        value /= 10;
+    }
+    return out + digits;
+}
+
+// Format as "YYYY-MM-DD HH:MM:SS"; `buffer` needs 20 bytes
+void rtc_format(uint32_t seconds, char* buffer) {
+    rtc_time_t time;
+    rtc_from_unix(seconds, &time);
+
+    char* out = format_number(buffer, time.year, 4);
+    *out++ = '-';
+    out = format_number(out, time.month, 2);
+    *out++ = '-';
+    out = format_number(out, time.day, 2);
+    *out++ = ' ';
+    out = format_number(out, time.hour, 2);
+    *out++ = ':';
+    out = format_number(out, time.minute, 2);
+    *out++ = ':';
+    out = format_number(out, time.second, 2);
+    *out = '\0';
+}
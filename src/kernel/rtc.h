@@ -0,0 +1,22 @@
+#ifndef RTC_H
+#define RTC_H
+
+#include "kernel.h"
+
+// Calendar time as kept by the CMOS real-time clock
+typedef struct {
+    uint32_t year;      // e.g. 2024
+    uint32_t month;     // 1-12
+    uint32_t day;       // 1-31
+    uint32_t hour;
+    uint32_t minute;
+    uint32_t second;
+} rtc_time_t;
+
+// CMOS real-time clock
+int rtc_read(rtc_time_t* time);
+uint32_t rtc_to_unix(const rtc_time_t* time);
+void rtc_from_unix(uint32_t seconds, rtc_time_t* time);
+void rtc_format(uint32_t seconds, char* buffer);   // "YYYY-MM-DD HH:MM:SS", 20 bytes
+
+#endif // RTC_H
@@ -0,0 +1,54 @@
+// PhantomOS Serial Port
+// Polled output on COM1 (115200 8N1), so crash dumps reach a log even
+// when the screen is gone. QEMU shows it with -serial stdio.
+
+#include "serial.h"
+#include "io.h"
+
+#define COM1 0x3F8
+
+// Register offsets from COM1
+#define SERIAL_DATA 0
+#define SERIAL_INTERRUPTS 1
+#define SERIAL_FIFO 2
+#define SERIAL_LINE_CONTROL 3
+#define SERIAL_MODEM_CONTROL 4
+#define SERIAL_LINE_STATUS 5
+
+#define SERIAL_LCR_DLAB 0x80        // Divisor latch access
+#define SERIAL_LCR_8N1 0x03
+#define SERIAL_LSR_THR_EMPTY 0x20
+#define SERIAL_DIVISOR_115200 1
+
+static int serial_ready = 0;
+
+void serial_init(void) {
+    outb(COM1 + SERIAL_INTERRUPTS, 0x00);
+    outb(COM1 + SERIAL_LINE_CONTROL, SERIAL_LCR_DLAB);
+    outb(COM1 + SERIAL_DATA, SERIAL_DIVISOR_115200);
+    outb(COM1 + SERIAL_INTERRUPTS, 0x00);
+    outb(COM1 + SERIAL_LINE_CONTROL, SERIAL_LCR_8N1);
+    outb(COM1 + SERIAL_FIFO, 0xC7);          // Enable and clear the FIFOs
+    outb(COM1 + SERIAL_MODEM_CONTROL, 0x03); // DTR and RTS, no IRQ
+
+    // A missing port reads as 0xFF
+    serial_ready = inb(COM1 + SERIAL_LINE_STATUS) != 0xFF;
+}
+
+void serial_putchar(char c) {
+    if (!serial_ready) {
+        return;
+    }
+    if (c == '\n') {
+        serial_putchar('\r');
+    }
+    for (uint32_t i = 0; i < 100000 && !(inb(COM1 + SERIAL_LINE_STATUS) & SERIAL_LSR_THR_EMPTY); i++) {
+    }
+    outb(COM1 + SERIAL_DATA, c);
+}
+
+void serial_writestring(const char* data) {
+    while (*data) {
+        serial_putchar(*data++);
+    }
+}
@@ -0,0 +1,11 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#include "kernel.h"
+
+// COM1, polled (no interrupts); used for crash dumps
+void serial_init(void);
+void serial_putchar(char c);
+void serial_writestring(const char* data);
+
+#endif // SERIAL_H
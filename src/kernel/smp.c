@@ -0,0 +1,242 @@
+// PhantomOS Multiprocessor Support
+// cpu_init builds a GDT with a TSS and a per-CPU data segment for every
+// possible CPU and loads it on the boot CPU. smp_init then starts each other
+// processor the MADT lists with INIT-SIPI-SIPI: it begins in real mode in
+// the trampoline copied to SMP_TRAMPOLINE_BASE, switches to protected mode
+// and enters smp_ap_main on its own stack. Application processors load the
+// shared GDT and IDT, enable their local APIC and tick, and then idle,
+// running whatever smp_call queues for them.
+
+#include "smp.h"
+#include "apic.h"
+#include "idt.h"
+#include "timer.h"
+
+#define KERNEL_CODE_SEGMENT 0x08
+#define KERNEL_DATA_SEGMENT 0x10
+#define GDT_CPU_BASE 3              // Null, code, data, then two entries per CPU
+#define GDT_ENTRIES (GDT_CPU_BASE + 2 * SMP_MAX_CPUS)
+#define TSS_SELECTOR(index) ((GDT_CPU_BASE + 2 * (index)) << 3)
+#define PERCPU_SELECTOR(index) ((GDT_CPU_BASE + 2 * (index) + 1) << 3)
+
+#define GDT_ACCESS_CODE 0x9A        // Present, ring 0, execute/read
+#define GDT_ACCESS_DATA 0x92        // Present, ring 0, read/write
+#define GDT_ACCESS_TSS 0x89         // Present, 32-bit TSS (available)
+#define GDT_FLAGS_4K_32BIT 0xC
+#define GDT_FLAGS_32BIT 0x4
+
+#define SMP_INIT_DELAY_US 10000
+#define SMP_STARTUP_DELAY_US 200
+#define SMP_ONLINE_TIMEOUT_US 100000
+
+// GDT entry structure
+struct gdt_entry {
+    uint16_t limit_low;
+    uint16_t base_low;
+    uint8_t base_middle;
+    uint8_t access;
+    uint8_t granularity;            // Flags (high nibble) and limit bits 16-19
+    uint8_t base_high;
+} __attribute__((packed));
+
+struct gdt_ptr {
+    uint16_t limit;
+    uint32_t base;
+} __attribute__((packed));
+
+// Real-mode startup code and its parameter block (trampoline.asm)
+extern char smp_trampoline_start[];
+extern char smp_trampoline_end[];
+extern char smp_trampoline_params[];
+
+static struct gdt_entry gdt[GDT_ENTRIES];
+static struct gdt_ptr gdt_pointer;
+static cpu_t cpus[SMP_MAX_CPUS];
+static uint32_t cpu_count = 0;
+
+static void gdt_set_entry(int index, uint32_t base, uint32_t limit, uint8_t access, uint8_t flags) {
+    gdt[index].limit_low = limit & 0xFFFF;
+    gdt[index].base_low = base & 0xFFFF;
+    gdt[index].base_middle = (base >> 16) & 0xFF;
+    gdt[index].access = access;
+    gdt[index].granularity = ((limit >> 16) & 0x0F) | (flags << 4);
+    gdt[index].base_high = (base >> 24) & 0xFF;
+}
+
+// Switch the calling CPU to the shared GDT and its own TSS and %gs
+static void cpu_load(cpu_t* cpu) {
+    uint16_t data = KERNEL_DATA_SEGMENT;
+    uint16_t tss = TSS_SELECTOR(cpu->index);
+    uint16_t percpu = PERCPU_SELECTOR(cpu->index);
+
+    asm volatile ("lgdt %0" : : "m"(gdt_pointer));
+    asm volatile ("ljmp %0, $1f\n1:" : : "i"(KERNEL_CODE_SEGMENT));
+    asm volatile ("mov %0, %%ds; mov %0, %%es; mov %0, %%fs; mov %0, %%ss" : : "r"(data));
+    asm volatile ("ltr %0" : : "r"(tss));
+    asm volatile ("mov %0, %%gs" : : "r"(percpu) : "memory");
+}
+
+static void cpu_setup(uint32_t index, uint32_t apic_id, uint32_t stack_top) {
+    cpu_t* cpu = &cpus[index];
+    memset(cpu, 0, sizeof(cpu_t));
+    cpu->self = cpu;
+    cpu->index = index;
+    cpu->apic_id = apic_id;
+    cpu->stack_top = stack_top;
+    spin_lock_init(&cpu->work_lock);
+
+    cpu->tss.ss0 = KERNEL_DATA_SEGMENT;
+    cpu->tss.esp0 = stack_top;
+    cpu->tss.iomap_base = sizeof(tss_t);   // No I/O permission bitmap
+}
+
+void cpu_init(void) {
+    memset(gdt, 0, sizeof(gdt));
+    gdt_set_entry(1, 0, 0xFFFFF, GDT_ACCESS_CODE, GDT_FLAGS_4K_32BIT);
+    gdt_set_entry(2, 0, 0xFFFFF, GDT_ACCESS_DATA, GDT_FLAGS_4K_32BIT);
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        gdt_set_entry(GDT_CPU_BASE + 2 * i, (uint32_t)&cpus[i].tss, sizeof(tss_t) - 1, GDT_ACCESS_TSS, 0);
+        gdt_set_entry(GDT_CPU_BASE + 2 * i + 1, (uint32_t)&cpus[i], sizeof(cpu_t) - 1,
+                      GDT_ACCESS_DATA, GDT_FLAGS_32BIT);
+    }
+    gdt_pointer.limit = sizeof(gdt) - 1;
+    gdt_pointer.base = (uint32_t)&gdt;
+
+    // The boot CPU keeps the stack _start gave it; its APIC ID is filled in
+    // by smp_init once the local APIC is known
+    uint32_t esp;
+    asm volatile ("mov %%esp, %0" : "=r"(esp));
+    cpu_setup(0, 0, esp);
+    cpus[0].online = 1;
+    cpu_count = 1;
+    cpu_load(&cpus[0]);
+}
+
+// Take the oldest queued call for `cpu`; 0 if there is none
+static int smp_take_work(cpu_t* cpu, smp_work_t* work) {
+    uint32_t irq = spin_lock_irqsave(&cpu->work_lock);
+    int found = cpu->work_tail != cpu->work_head;
+    if (found) {
+        *work = cpu->work[cpu->work_tail % SMP_WORK_SLOTS];
+        cpu->work_tail++;
+    }
+    spin_unlock_irqrestore(&cpu->work_lock, irq);
+    return found;
+}
+
+void cpu_idle_halt(void) {
+    cpu_t* cpu = cpu_current();
+    uint64_t start = timer_monotonic_ns();
+    asm volatile ("sti; hlt");  // sti holds off interrupts until hlt has started
+    cpu->idle_ns += timer_monotonic_ns() - start;
+}
+
+// Queued calls only need the CPU awake; the wakeup interrupt does nothing else
+static void smp_wakeup(interrupt_frame_t* frame) {
+}
+
+// Application processor entry, on its own stack, from the trampoline
+void smp_ap_main(uint32_t index) {
+    cpu_t* cpu = &cpus[index];
+    cpu_load(cpu);
+    idt_load();
+    lapic_init_cpu();
+    timer_init_cpu();
+    cpu->online = 1;
+
+    smp_work_t work;
+    for (;;) {
+        while (smp_take_work(cpu, &work)) {
+            work.function(work.arg);
+            cpu->work_done++;
+        }
+        asm volatile ("cli");
+        if (cpu->work_tail == cpu->work_head) {
+            cpu_idle_halt();
+        } else {
+            asm volatile ("sti");
+        }
+    }
+}
+
+// INIT, then up to two STARTUPs, then wait for the CPU to report in
+static int smp_start_cpu(uint32_t index, uint32_t apic_id) {
+    uint32_t stack = (uint32_t)kmalloc(SMP_STACK_SIZE);
+    if (!stack) {
+        return -1;
+    }
+    cpu_setup(index, apic_id, (stack + SMP_STACK_SIZE) & ~0xF);
+
+    uint32_t* params = (uint32_t*)(SMP_TRAMPOLINE_BASE + (smp_trampoline_params - smp_trampoline_start));
+    params[0] = cpus[index].stack_top;
+    params[1] = (uint32_t)smp_ap_main;
+    params[2] = index;
+
+    lapic_send_init(apic_id);
+    timer_delay_us(SMP_INIT_DELAY_US);
+    for (int attempt = 0; attempt < 2 && !cpus[index].online; attempt++) {
+        lapic_send_startup(apic_id, SMP_TRAMPOLINE_BASE >> 12);
+        timer_delay_us(SMP_STARTUP_DELAY_US);
+    }
+    for (uint32_t waited = 0; waited < SMP_ONLINE_TIMEOUT_US && !cpus[index].online; waited += 100) {
+        timer_delay_us(100);
+    }
+
+    if (!cpus[index].online) {
+        kfree((void*)stack);
+        return -1;
+    }
+    return 0;
+}
+
+uint32_t smp_init(void) {
+    const acpi_madt_t* madt = acpi_get_madt();
+    timer_stats_t clock;
+    timer_get_stats(&clock);
+    if (!apic_enabled() || !madt || !clock.tsc_khz) {
+        return cpu_count;
+    }
+
+    cpus[0].apic_id = lapic_id();
+    interrupt_register(SMP_WAKEUP_VECTOR, smp_wakeup, "ipi wakeup");
+    memcpy((void*)SMP_TRAMPOLINE_BASE, smp_trampoline_start, smp_trampoline_end - smp_trampoline_start);
+
+    // One at a time: they all start from the same trampoline parameters
+    for (uint32_t i = 0; i < madt->cpu_count && cpu_count < SMP_MAX_CPUS; i++) {
+        if (madt->cpu_apic_ids[i] == cpus[0].apic_id) {
+            continue;
+        }
+        if (smp_start_cpu(cpu_count, madt->cpu_apic_ids[i]) == 0) {
+            cpu_count++;
+        }
+    }
+    return cpu_count;
+}
+
+uint32_t smp_cpu_count(void) {
+    return cpu_count;
+}
+
+cpu_t* smp_get_cpu(uint32_t index) {
+    return index < cpu_count ? &cpus[index] : NULL;
+}
+
+int smp_call(uint32_t index, void (*function)(void* arg), void* arg) {
+    if (index == 0 || index >= cpu_count || !cpus[index].online || !function) {
+        return -1;
+    }
+
+    cpu_t* cpu = &cpus[index];
+    uint32_t irq = spin_lock_irqsave(&cpu->work_lock);
+    if (cpu->work_head - cpu->work_tail == SMP_WORK_SLOTS) {
+        spin_unlock_irqrestore(&cpu->work_lock, irq);
+        return -1;
+    }
+    cpu->work[cpu->work_head % SMP_WORK_SLOTS].function = function;
+    cpu->work[cpu->work_head % SMP_WORK_SLOTS].arg = arg;
+    cpu->work_head++;
+    spin_unlock_irqrestore(&cpu->work_lock, irq);
+
+    lapic_send_ipi(cpu->apic_id, SMP_WAKEUP_VECTOR);
+    return 0;
+}
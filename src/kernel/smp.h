@@ -0,0 +1,70 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include "kernel.h"
+#include "acpi.h"
+#include "idt.h"
+#include "spinlock.h"
+
+#define SMP_MAX_CPUS ACPI_MAX_CPUS
+#define SMP_STACK_SIZE 16384        // Per application processor
+#define SMP_WORK_SLOTS 16           // Queued calls per CPU
+#define SMP_TRAMPOLINE_BASE 0x7000  // Must match trampoline.asm; below 1MB, page aligned
+#define SMP_WAKEUP_VECTOR (LOCAL_VECTOR_BASE + 1)
+
+// 32-bit task state segment; only the ring 0 stack is used
+typedef struct {
+    uint32_t link;
+    uint32_t esp0;
+    uint32_t ss0;
+    uint32_t unused[22];
+    uint16_t trap;
+    uint16_t iomap_base;
+} __attribute__((packed)) tss_t;
+
+typedef struct {
+    void (*function)(void* arg);
+    void* arg;
+} smp_work_t;
+
+// Per-CPU data. Each CPU's %gs selects a segment based at its own entry,
+// so cpu_current is a single load.
+typedef struct cpu {
+    struct cpu* self;               // Must stay first (%gs:0)
+    uint32_t index;                 // 0 is the boot CPU
+    uint32_t apic_id;
+    volatile int online;
+    uint32_t stack_top;
+    volatile uint32_t ticks;        // Tick interrupts taken by this CPU
+    uint64_t idle_ns;               // Time spent halted
+    uint32_t work_done;
+    spinlock_t work_lock;
+    smp_work_t work[SMP_WORK_SLOTS];
+    volatile uint32_t work_head;
+    volatile uint32_t work_tail;
+    tss_t tss;
+} cpu_t;
+
+static inline cpu_t* cpu_current(void) {
+    cpu_t* cpu;
+    asm volatile ("movl %%gs:0, %0" : "=r"(cpu));
+    return cpu;
+}
+
+// cpu_init sets up the GDT, TSS and per-CPU data and loads them on the boot
+// CPU; smp_init then starts the other processors the MADT lists (it needs
+// the local APIC and the TSC clock) and returns how many CPUs are online.
+void cpu_init(void);
+uint32_t smp_init(void);
+uint32_t smp_cpu_count(void);
+cpu_t* smp_get_cpu(uint32_t index);
+
+// Run `function(arg)` from the idle loop of application processor `index`;
+// -1 for the boot CPU (it runs the shell), an offline CPU or a full queue
+int smp_call(uint32_t index, void (*function)(void* arg), void* arg);
+
+// Halt until the next interrupt, counting the time as idle. Called with
+// interrupts off after checking for work; returns with them on.
+void cpu_idle_halt(void);
+
+#endif // SMP_H
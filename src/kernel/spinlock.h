@@ -0,0 +1,49 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include "kernel.h"
+
+// Ticket lock: CPUs get the lock in the order they asked for it. Only the
+// holder advances `owner`, so unlocking needs no locked instruction.
+typedef struct {
+    volatile uint32_t next;         // Next ticket to hand out
+    volatile uint32_t owner;        // Ticket now holding the lock
+} spinlock_t;
+
+#define SPINLOCK_INIT { 0, 0 }
+
+static inline void spin_lock_init(spinlock_t* lock) {
+    lock->next = 0;
+    lock->owner = 0;
+}
+
+static inline void spin_lock(spinlock_t* lock) {
+    uint32_t ticket = 1;
+    asm volatile ("lock xaddl %0, %1" : "+r"(ticket), "+m"(lock->next) : : "memory");
+    while (lock->owner != ticket) {
+        asm volatile ("pause" : : : "memory");
+    }
+}
+
+static inline void spin_unlock(spinlock_t* lock) {
+    asm volatile ("" : : : "memory");
+    lock->owner = lock->owner + 1;
+}
+
+// For locks also taken in interrupt handlers: interrupts stay off while
+// the lock is held. Returns whether they were on.
+static inline uint32_t spin_lock_irqsave(spinlock_t* lock) {
+    uint32_t flags;
+    asm volatile ("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    spin_lock(lock);
+    return flags & 0x200;
+}
+
+static inline void spin_unlock_irqrestore(spinlock_t* lock, uint32_t enabled) {
+    spin_unlock(lock);
+    if (enabled) {
+        asm volatile ("sti" : : : "memory");
+    }
+}
+
+#endif // SPINLOCK_H
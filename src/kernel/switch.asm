@@ -0,0 +1,25 @@
+; PhantomOS thread switch
+; thread_switch(uint32_t* save_esp, uint32_t new_esp) pushes the registers
+; the C calling convention expects to survive a call, stores the stack
+; pointer in *save_esp and picks the other thread up from new_esp, where
+; its own thread_switch call (or thread_alloc's initial frame) left it.
+
+bits 32
+
+global thread_switch
+
+section .text
+
+thread_switch:
+    push ebp
+    push ebx
+    push esi
+    push edi
+    mov eax, [esp + 20]             ; save_esp
+    mov [eax], esp
+    mov esp, [esp + 24]             ; new_esp
+    pop edi
+    pop esi
+    pop ebx
+    pop ebp
+    ret
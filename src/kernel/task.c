@@ -0,0 +1,250 @@
+// PhantomOS Fork/Join Tasks
+// Every worker owns a Chase-Lev deque: it pushes and pops tasks at the
+// bottom without locking, and idle workers steal from the top with a
+// compare-and-swap, so they take the oldest, usually largest, piece of
+// work. Only the last task of a deque is contended between its owner and a
+// thief; the owner then settles it with the same compare-and-swap.
+// Task structures live on the stacks of the tasks that forked them, which
+// wait in task_join until they are done, so a job allocates nothing.
+
+#include "task.h"
+#include "smp.h"
+#include "thread.h"
+
+typedef struct {
+    volatile uint32_t top;          // Next task to steal
+    volatile uint32_t bottom;       // Next free slot for the owner
+    task_t* volatile slots[TASK_DEQUE_SIZE];
+} task_deque_t;
+
+// A range of task_parallel_for indices
+typedef struct {
+    task_t task;                    // Must stay first
+    uint32_t start;
+    uint32_t end;
+    uint32_t grain;
+    void (*body)(uint32_t index, void* arg);
+    void* arg;
+} task_range_t;
+
+static task_deque_t deques[SMP_MAX_CPUS];
+static task_worker_stats_t worker_stats[SMP_MAX_CPUS];
+static uint32_t steal_seeds[SMP_MAX_CPUS];
+static volatile uint32_t job_workers = 0;    // Workers in the running job
+static volatile int job_active = 0;
+static volatile uint32_t helpers_running = 0; // Application processors inside task_worker
+static mutex_t job_mutex = MUTEX_INIT;
+
+static inline int cas(volatile uint32_t* value, uint32_t expected, uint32_t desired) {
+    uint32_t previous;
+    asm volatile ("lock cmpxchgl %2, %1"
+                  : "=a"(previous), "+m"(*value)
+                  : "r"(desired), "0"(expected)
+                  : "memory");
+    return previous == expected;
+}
+
+static inline void atomic_add(volatile uint32_t* value, uint32_t amount) {
+    asm volatile ("lock addl %1, %0" : "+m"(*value) : "r"(amount) : "memory");
+}
+
+// Owner only
+static int deque_push(task_deque_t* deque, task_t* task) {
+    uint32_t bottom = deque->bottom;
+    if (bottom - deque->top >= TASK_DEQUE_SIZE) {
+        return -1;
+    }
+    deque->slots[bottom & (TASK_DEQUE_SIZE - 1)] = task;
+    asm volatile ("" : : : "memory");  // Store the task before publishing it
+    deque->bottom = bottom + 1;
+    return 0;
+}
+
+// Owner only: newest task first
+static task_t* deque_pop(task_deque_t* deque) {
+    uint32_t bottom = deque->bottom - 1;
+    deque->bottom = bottom;
+    // The claim on the slot must be visible before top is read, or a thief
+    // and the owner could both take the last task
+    asm volatile ("mfence" : : : "memory");
+    uint32_t top = deque->top;
+
+    if ((int)(bottom - top) < 0) {
+        deque->bottom = bottom + 1; // Was empty
+        return NULL;
+    }
+    task_t* task = deque->slots[bottom & (TASK_DEQUE_SIZE - 1)];
+    if (bottom == top) {
+        // Last task: race the thieves for it
+        if (!cas(&deque->top, top, top + 1)) {
+            task = NULL;
+        }
+        deque->bottom = top + 1;
+    }
+    return task;
+}
+
+// Any other worker: oldest task first; NULL if empty or lost a race
+static task_t* deque_steal(task_deque_t* deque) {
+    uint32_t top = deque->top;
+    asm volatile ("" : : : "memory");  // x86 keeps these two loads in order
+    uint32_t bottom = deque->bottom;
+    if ((int)(bottom - top) <= 0) {
+        return NULL;
+    }
+    task_t* task = deque->slots[top & (TASK_DEQUE_SIZE - 1)];
+    return cas(&deque->top, top, top + 1) ? task : NULL;
+}
+
+static void task_execute(task_t* task, uint32_t worker) {
+    task->function(task);
+    asm volatile ("" : : : "memory");  // Finish the work before reporting it
+    task->done = 1;
+    worker_stats[worker].executed++;
+}
+
+// Try every other worker once, starting at a pseudo-random one
+static task_t* task_steal(uint32_t worker) {
+    uint32_t workers = job_workers;
+    if (workers < 2) {
+        return NULL;
+    }
+    steal_seeds[worker] = steal_seeds[worker] * 1103515245 + 12345;
+    uint32_t victim = (steal_seeds[worker] >> 16) % workers;
+    for (uint32_t i = 0; i < workers; i++, victim = (victim + 1) % workers) {
+        if (victim == worker) {
+            continue;
+        }
+        task_t* task = deque_steal(&deques[victim]);
+        if (task) {
+            worker_stats[worker].stolen++;
+            return task;
+        }
+    }
+    return NULL;
+}
+
+// Find something to run: own work first, then another worker's
+static int task_help(uint32_t worker) {
+    task_t* task = deque_pop(&deques[worker]);
+    if (!task) {
+        task = task_steal(worker);
+    }
+    if (!task) {
+        asm volatile ("pause");
+        return 0;
+    }
+    task_execute(task, worker);
+    return 1;
+}
+
+// Application processor side of a job, queued by task_run
+static void task_worker(void* arg) {
+    uint32_t worker = cpu_current()->index;
+    while (job_active) {
+        task_help(worker);
+    }
+    atomic_add(&helpers_running, (uint32_t)-1);
+}
+
+void task_init(task_t* task, void (*function)(task_t* task), void* arg) {
+    task->function = function;
+    task->arg = arg;
+    task->done = 0;
+}
+
+void task_fork(task_t* task) {
+    uint32_t worker = cpu_current()->index;
+    if (deque_push(&deques[worker], task) != 0) {
+        task_execute(task, worker);
+    }
+}
+
+void task_join(task_t* task) {
+    uint32_t worker = cpu_current()->index;
+    while (!task->done) {
+        task_help(worker);
+    }
+}
+
+uint32_t task_run(task_t* root, uint32_t workers) {
+    mutex_lock(&job_mutex);
+    if (workers > smp_cpu_count()) {
+        workers = smp_cpu_count();
+    }
+    if (workers == 0) {
+        workers = 1;
+    }
+    for (uint32_t i = 0; i < workers; i++) {
+        deques[i].top = 0;
+        deques[i].bottom = 0;
+        worker_stats[i].executed = 0;
+        worker_stats[i].stolen = 0;
+        steal_seeds[i] = i + 1;
+    }
+
+    job_workers = workers;
+    job_active = 1;
+    for (uint32_t i = 1; i < workers; i++) {
+        atomic_add(&helpers_running, 1);
+        if (smp_call(i, task_worker, NULL) != 0) {
+            atomic_add(&helpers_running, (uint32_t)-1);
+        }
+    }
+
+    task_execute(root, 0);
+
+    // Every task has been joined by now; let the helpers go back to idle
+    job_active = 0;
+    while (helpers_running) {
+        asm volatile ("pause");
+    }
+    job_workers = 0;
+    mutex_unlock(&job_mutex);
+    return workers;
+}
+
+uint32_t task_max_workers(void) {
+    return smp_cpu_count();
+}
+
+void task_get_stats(uint32_t worker, task_worker_stats_t* stats) {
+    if (worker < SMP_MAX_CPUS) {
+        *stats = worker_stats[worker];
+    }
+}
+
+// Split the range until it is small enough, forking the upper half
+static void task_range_run(task_t* task) {
+    task_range_t* range = (task_range_t*)task;
+    if (range->end - range->start <= range->grain) {
+        for (uint32_t i = range->start; i < range->end; i++) {
+            range->body(i, range->arg);
+        }
+        return;
+    }
+
+    uint32_t middle = range->start + (range->end - range->start) / 2;
+    task_range_t upper = *range;
+    upper.start = middle;
+    task_init(&upper.task, task_range_run, NULL);
+    task_fork(&upper.task);
+
+    task_range_t lower = *range;
+    lower.end = middle;
+    task_range_run(&lower.task);
+
+    task_join(&upper.task);
+}
+
+uint32_t task_parallel_for(uint32_t workers, uint32_t count, uint32_t grain,
+                           void (*body)(uint32_t index, void* arg), void* arg) {
+    task_range_t range;
+    task_init(&range.task, task_range_run, NULL);
+    range.start = 0;
+    range.end = count;
+    range.grain = grain ? grain : 1;
+    range.body = body;
+    range.arg = arg;
+    return task_run(&range.task, workers);
+}
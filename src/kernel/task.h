@@ -0,0 +1,42 @@
+#ifndef TASK_H
+#define TASK_H
+
+#include "kernel.h"
+
+#define TASK_DEQUE_SIZE 256         // Per worker, power of two; forks beyond it run at once
+
+// Fork/join task. Embed it first in a larger structure to pass more than
+// `arg`; it must stay in place until joined.
+typedef struct task {
+    void (*function)(struct task* task);
+    void* arg;
+    volatile int done;
+} task_t;
+
+typedef struct {
+    uint32_t executed;              // Tasks this worker ran
+    uint32_t stolen;                // Of those, taken from another worker
+} task_worker_stats_t;
+
+// Work-stealing fork/join on the CPUs (worker N is CPU N). task_run runs
+// `root` on the calling CPU, the boot CPU, as worker 0 and lends up to
+// `workers` - 1 application processors to the job through smp_call; each
+// worker pushes its forks onto its own deque and steals the oldest task of
+// another when it runs out. With one CPU the caller runs every task itself.
+// Jobs run one at a time; task_run returns how many workers took part.
+uint32_t task_run(task_t* root, uint32_t workers);
+uint32_t task_max_workers(void);
+void task_get_stats(uint32_t worker, task_worker_stats_t* stats);
+
+// Inside a job: make `task` available to other workers, and wait for it,
+// running other tasks meanwhile
+void task_init(task_t* task, void (*function)(task_t* task), void* arg);
+void task_fork(task_t* task);
+void task_join(task_t* task);
+
+// Run `body(index, arg)` for every index below `count` as one job, splitting
+// the range in halves down to `grain` indices per task
+uint32_t task_parallel_for(uint32_t workers, uint32_t count, uint32_t grain,
+                           void (*body)(uint32_t index, void* arg), void* arg);
+
+#endif // TASK_H
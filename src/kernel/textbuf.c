@@ -0,0 +1,284 @@
+// PhantomOS Text Buffer
+// A line start s is stored as s while it lies at or before the gap and as
+// s plus the gap length after it, so inserting or deleting at the gap does
+// not change any entry. Moving the gap re-encodes only the line starts it
+// passes, and the line index's own gap sits where lines were last added or
+// removed, so a new line costs one entry.
+
+#include "textbuf.h"
+
+static inline uint32_t gap_length(const textbuf_t* buf) {
+    return buf->gap_end - buf->gap_start;
+}
+
+static inline uint32_t line_entries(const textbuf_t* buf) {
+    return buf->line_size - (buf->line_gap_end - buf->line_gap_start);
+}
+
+static inline uint32_t* line_entry(const textbuf_t* buf, uint32_t index) {
+    if (index >= buf->line_gap_start) {
+        index += buf->line_gap_end - buf->line_gap_start;
+    }
+    return &buf->lines[index];
+}
+
+static inline uint32_t decode_start(const textbuf_t* buf, uint32_t stored) {
+    return stored <= buf->gap_start ? stored : stored - gap_length(buf);
+}
+
+// Index of the first line entry starting after `pos`
+static uint32_t first_entry_after(const textbuf_t* buf, uint32_t pos) {
+    uint32_t low = 0;
+    uint32_t high = line_entries(buf);
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        if (decode_start(buf, *line_entry(buf, middle)) <= pos) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// Move the text gap to `pos`, re-encoding the line starts it passes
+static void move_gap(textbuf_t* buf, uint32_t pos) {
+    uint32_t gap = gap_length(buf);
+    if (pos < buf->gap_start) {
+        // Starts in (pos, gap_start] end up after the gap
+        for (uint32_t i = first_entry_after(buf, pos); i < line_entries(buf); i++) {
+            uint32_t* entry = line_entry(buf, i);
+            if (*entry > buf->gap_start) {
+                break;
+            }
+            *entry += gap;
+        }
+        uint32_t count = buf->gap_start - pos;
+        for (uint32_t i = count; i > 0; i--) {
+            buf->data[pos + gap + i - 1] = buf->data[pos + i - 1];
+        }
+    } else if (pos > buf->gap_start) {
+        // Starts in (gap_start, pos] end up before it
+        for (uint32_t i = first_entry_after(buf, buf->gap_start); i < line_entries(buf); i++) {
+            uint32_t* entry = line_entry(buf, i);
+            if (*entry - gap > pos) {
+                break;
+            }
+            *entry -= gap;
+        }
+        uint32_t count = pos - buf->gap_start;
+        for (uint32_t i = 0; i < count; i++) {
+            buf->data[buf->gap_start + i] = buf->data[buf->gap_end + i];
+        }
+    }
+    buf->gap_end = pos + gap;
+    buf->gap_start = pos;
+}
+
+static void move_line_gap(textbuf_t* buf, uint32_t index) {
+    uint32_t gap = buf->line_gap_end - buf->line_gap_start;
+    while (buf->line_gap_start > index) {
+        buf->lines[--buf->line_gap_end] = buf->lines[--buf->line_gap_start];
+    }
+    while (buf->line_gap_start < index) {
+        buf->lines[buf->line_gap_start++] = buf->lines[buf->line_gap_end++];
+    }
+    buf->line_gap_end = buf->line_gap_start + gap;
+}
+
+// Make the text gap at least `needed` bytes long
+static int grow_text(textbuf_t* buf, uint32_t needed) {
+    if (gap_length(buf) >= needed) {
+        return 0;
+    }
+    uint32_t size = buf->size ? buf->size * 2 : TEXTBUF_MIN_SIZE;
+    while (size - textbuf_length(buf) < needed) {
+        size *= 2;
+    }
+    char* data = (char*)kmalloc(size);
+    if (!data) {
+        return -1;
+    }
+
+    uint32_t tail = buf->size - buf->gap_end;
+    uint32_t growth = size - buf->size;
+    memcpy(data, buf->data, buf->gap_start);
+    memcpy(data + size - tail, buf->data + buf->gap_end, tail);
+    for (uint32_t i = 0; i < line_entries(buf); i++) {
+        uint32_t* entry = line_entry(buf, i);
+        if (*entry > buf->gap_start) {
+            *entry += growth;
+        }
+    }
+    if (buf->data) {
+        kfree(buf->data);
+    }
+    buf->data = data;
+    buf->gap_end += growth;
+    buf->size = size;
+    return 0;
+}
+
+// Make room for `needed` more line starts
+static int grow_lines(textbuf_t* buf, uint32_t needed) {
+    if (buf->line_gap_end - buf->line_gap_start >= needed) {
+        return 0;
+    }
+    uint32_t size = buf->line_size ? buf->line_size * 2 : TEXTBUF_MIN_LINES;
+    while (size - line_entries(buf) < needed) {
+        size *= 2;
+    }
+    uint32_t* lines = (uint32_t*)kmalloc(size * sizeof(uint32_t));
+    if (!lines) {
+        return -1;
+    }
+
+    uint32_t tail = buf->line_size - buf->line_gap_end;
+    memcpy(lines, buf->lines, buf->line_gap_start * sizeof(uint32_t));
+    memcpy(lines + size - tail, buf->lines + buf->line_gap_end, tail * sizeof(uint32_t));
+    if (buf->lines) {
+        kfree(buf->lines);
+    }
+    buf->lines = lines;
+    buf->line_gap_end = size - tail;
+    buf->line_size = size;
+    return 0;
+}
+
+void textbuf_init(textbuf_t* buf) {
+    buf->data = NULL;
+    buf->size = 0;
+    buf->gap_start = 0;
+    buf->gap_end = 0;
+    buf->lines = NULL;
+    buf->line_size = 0;
+    buf->line_gap_start = 0;
+    buf->line_gap_end = 0;
+}
+
+void textbuf_free(textbuf_t* buf) {
+    if (buf->data) {
+        kfree(buf->data);
+    }
+    if (buf->lines) {
+        kfree(buf->lines);
+    }
+    textbuf_init(buf);
+}
+
+uint32_t textbuf_length(const textbuf_t* buf) {
+    return buf->size - gap_length(buf);
+}
+
+uint32_t textbuf_line_count(const textbuf_t* buf) {
+    return line_entries(buf) + 1;
+}
+
+uint32_t textbuf_line_start(const textbuf_t* buf, uint32_t line) {
+    if (line == 0 || line > line_entries(buf)) {
+        return 0;
+    }
+    return decode_start(buf, *line_entry(buf, line - 1));
+}
+
+uint32_t textbuf_line_length(const textbuf_t* buf, uint32_t line) {
+    if (line > line_entries(buf)) {
+        return 0;
+    }
+    uint32_t end = line < line_entries(buf) ? textbuf_line_start(buf, line + 1) - 1
+                                            : textbuf_length(buf);
+    return end - textbuf_line_start(buf, line);
+}
+
+char textbuf_char_at(const textbuf_t* buf, uint32_t pos) {
+    if (pos >= textbuf_length(buf)) {
+        return '\0';
+    }
+    return buf->data[pos < buf->gap_start ? pos : pos + gap_length(buf)];
+}
+
+// Line containing `pos`: the number of later lines starting at or before it
+uint32_t textbuf_line_of(const textbuf_t* buf, uint32_t pos) {
+    return first_entry_after(buf, pos);
+}
+
+uint32_t textbuf_read(const textbuf_t* buf, uint32_t pos, char* dest, uint32_t size) {
+    uint32_t length = textbuf_length(buf);
+    if (pos >= length) {
+        return 0;
+    }
+    if (size > length - pos) {
+        size = length - pos;
+    }
+
+    // Up to the gap, then after it
+    uint32_t done = 0;
+    if (pos < buf->gap_start) {
+        done = buf->gap_start - pos;
+        if (done > size) {
+            done = size;
+        }
+        memcpy(dest, buf->data + pos, done);
+    }
+    if (done < size) {
+        memcpy(dest + done, buf->data + pos + done + gap_length(buf), size - done);
+    }
+    return size;
+}
+
+void textbuf_segments(const textbuf_t* buf, const char** first, uint32_t* first_size,
+                      const char** second, uint32_t* second_size) {
+    *first = buf->data;
+    *first_size = buf->gap_start;
+    *second = buf->data + buf->gap_end;
+    *second_size = buf->size - buf->gap_end;
+}
+
+int textbuf_insert(textbuf_t* buf, uint32_t pos, const char* text, uint32_t length) {
+    if (pos > textbuf_length(buf)) {
+        return -1;
+    }
+    uint32_t newlines = 0;
+    for (uint32_t i = 0; i < length; i++) {
+        if (text[i] == '\n') {
+            newlines++;
+        }
+    }
+    // Allocate first, so a failure leaves the buffer as it was
+    if (grow_text(buf, length) != 0 || grow_lines(buf, newlines) != 0) {
+        return -1;
+    }
+
+    move_gap(buf, pos);
+    if (newlines) {
+        move_line_gap(buf, first_entry_after(buf, pos));
+    }
+    for (uint32_t i = 0; i < length; i++) {
+        buf->data[buf->gap_start++] = text[i];
+        if (text[i] == '\n') {
+            // At the gap start, so stored as is
+            buf->lines[buf->line_gap_start++] = buf->gap_start;
+        }
+    }
+    return 0;
+}
+
+void textbuf_delete(textbuf_t* buf, uint32_t pos, uint32_t length) {
+    uint32_t total = textbuf_length(buf);
+    if (pos >= total) {
+        return;
+    }
+    if (length > total - pos) {
+        length = total - pos;
+    }
+
+    move_gap(buf, pos);
+    // Lines starting in (pos, pos + length] lose their '\n'
+    uint32_t first = first_entry_after(buf, pos);
+    uint32_t last = first_entry_after(buf, pos + length);
+    if (last > first) {
+        move_line_gap(buf, first);
+        buf->line_gap_end += last - first;
+    }
+    buf->gap_end += length;
+}
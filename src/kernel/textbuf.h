@@ -0,0 +1,50 @@
+#ifndef TEXTBUF_H
+#define TEXTBUF_H
+
+#include "kernel.h"
+
+#define TEXTBUF_MIN_SIZE 256        // First allocation; sizes double from there
+#define TEXTBUF_MIN_LINES 64
+
+// Gap buffer with a line index. The text is kept in one allocation with a
+// gap at the last edit, so typing and deleting there move nothing. The
+// start of every line but the first is kept in a second gap array; entries
+// hold offsets into the allocation rather than into the text, so edits in
+// the gap leave the index alone. Positions in the API are text offsets;
+// lines are counted from 0 and do not include their '\n'.
+typedef struct {
+    char* data;
+    uint32_t size;                  // Bytes allocated for data
+    uint32_t gap_start;
+    uint32_t gap_end;
+    uint32_t* lines;                // Starts of lines 1 and up
+    uint32_t line_size;             // Entries allocated for lines
+    uint32_t line_gap_start;
+    uint32_t line_gap_end;
+} textbuf_t;
+
+// An empty buffer needs no memory; textbuf_free returns it to that state
+void textbuf_init(textbuf_t* buf);
+void textbuf_free(textbuf_t* buf);
+
+uint32_t textbuf_length(const textbuf_t* buf);
+uint32_t textbuf_line_count(const textbuf_t* buf);
+uint32_t textbuf_line_start(const textbuf_t* buf, uint32_t line);
+uint32_t textbuf_line_length(const textbuf_t* buf, uint32_t line);
+char textbuf_char_at(const textbuf_t* buf, uint32_t pos);
+uint32_t textbuf_line_of(const textbuf_t* buf, uint32_t pos);
+
+// Copy up to `size` bytes from `pos`; returns how many were copied
+uint32_t textbuf_read(const textbuf_t* buf, uint32_t pos, char* dest, uint32_t size);
+
+// The text in place, as the part before the gap and the part after it;
+// valid until the next insert or delete
+void textbuf_segments(const textbuf_t* buf, const char** first, uint32_t* first_size,
+                      const char** second, uint32_t* second_size);
+
+// -1 (with the buffer unchanged) if `pos` is past the end or memory runs out
+int textbuf_insert(textbuf_t* buf, uint32_t pos, const char* text, uint32_t length);
+// Removes what there is of [pos, pos + length)
+void textbuf_delete(textbuf_t* buf, uint32_t pos, uint32_t length);
+
+#endif // TEXTBUF_H
@@ -0,0 +1,416 @@
+// PhantomOS Kernel Threads
+// Each thread has its own kernel stack; thread_switch (switch.asm) saves
+// the callee-saved registers and swaps stacks. Ready threads wait on one
+// FIFO run queue per priority. The boot CPU's tick counts down the running
+// thread's time slice, and interrupt_dispatch calls thread_preempt on the
+// way out, so a thread that never blocks still gives way. Application
+// processors run no threads; they keep to their smp_call work.
+//
+// sched_lock covers the queues and thread states. schedule() is entered
+// with it held and interrupts off, and the thread switched to releases it
+// (either in the schedule() call it left off in or in thread_start).
+
+#include "thread.h"
+#include "smp.h"
+#include "spinlock.h"
+
+// Switch stacks (switch.asm)
+extern void thread_switch(uint32_t* save_esp, uint32_t new_esp);
+
+static spinlock_t sched_lock = SPINLOCK_INIT;
+static wait_queue_t run_queues[THREAD_PRIORITIES];  // Same FIFO as a wait queue
+static thread_t boot_thread;
+static thread_t* current = NULL;
+static thread_t* idle_thread = NULL;
+static thread_t* all_threads = NULL;
+static thread_t* dead_thread = NULL;    // Freed by the next thread to run
+static volatile int need_resched = 0;
+static uint32_t next_id = 0;
+static uint32_t switches = 0;
+
+static const char* state_names[] = { "ready", "running", "blocked", "sleeping", "dead" };
+
+static void queue_push(wait_queue_t* queue, thread_t* thread) {
+    thread->next = NULL;
+    if (queue->tail) {
+        queue->tail->next = thread;
+    } else {
+        queue->head = thread;
+    }
+    queue->tail = thread;
+}
+
+static thread_t* queue_pop(wait_queue_t* queue) {
+    thread_t* thread = queue->head;
+    if (thread) {
+        queue->head = thread->next;
+        if (!queue->head) {
+            queue->tail = NULL;
+        }
+        thread->next = NULL;
+    }
+    return thread;
+}
+
+static void queue_remove(wait_queue_t* queue, thread_t* thread) {
+    thread_t* prev = NULL;
+    for (thread_t* t = queue->head; t; prev = t, t = t->next) {
+        if (t == thread) {
+            if (prev) {
+                prev->next = t->next;
+            } else {
+                queue->head = t->next;
+            }
+            if (queue->tail == t) {
+                queue->tail = prev;
+            }
+            t->next = NULL;
+            return;
+        }
+    }
+}
+
+// Queue a thread to run; preempt the current one if it matters less
+static void make_ready(thread_t* thread) {
+    thread->state = THREAD_READY;
+    thread->waiting_on = NULL;
+    queue_push(&run_queues[thread->priority], thread);
+    if (!current || current == idle_thread || thread->priority > current->priority) {
+        need_resched = 1;
+    }
+}
+
+static void thread_reap(void) {
+    if (dead_thread && dead_thread != current) {
+        kfree(dead_thread->stack);
+        kfree(dead_thread);
+        dead_thread = NULL;
+    }
+}
+
+// Run the first thread of the highest priority that has one, the current
+// thread going to the back of its queue if it is still runnable
+static void schedule(void) {
+    thread_t* prev = current;
+    if (prev->state == THREAD_RUNNING) {
+        prev->state = THREAD_READY;
+        if (prev != idle_thread) {
+            queue_push(&run_queues[prev->priority], prev);
+        }
+    }
+
+    thread_t* next = NULL;
+    for (int priority = THREAD_PRIORITIES - 1; priority >= 0 && !next; priority--) {
+        next = queue_pop(&run_queues[priority]);
+    }
+    if (!next) {
+        next = idle_thread;
+    }
+    need_resched = 0;
+    next->state = THREAD_RUNNING;
+    next->slice = THREAD_TIMESLICE_MS;
+    if (next == prev) {
+        return;
+    }
+
+    current = next;
+    switches++;
+    thread_switch(&prev->esp, next->esp);
+    thread_reap();  // Back in prev, with the lock handed over
+}
+
+// First code of every new thread, entered from thread_switch
+static void thread_start(void) {
+    thread_reap();
+    spin_unlock(&sched_lock);
+    asm volatile ("sti");
+    current->entry(current->arg);
+    thread_exit();
+}
+
+static void idle_loop(void* arg) {
+    // The switch happens here, not inside the interrupt that woke the CPU,
+    // so the halted time is accounted as idle
+    for (;;) {
+        asm volatile ("cli");
+        if (need_resched) {
+            asm volatile ("sti");
+            thread_yield();
+        } else {
+            cpu_idle_halt();
+        }
+    }
+}
+
+// Allocate a thread whose first switch-in starts it in thread_start
+static thread_t* thread_alloc(const char* name, void (*entry)(void* arg), void* arg, uint32_t priority) {
+    thread_t* thread = kmalloc(sizeof(thread_t));
+    void* stack = kmalloc(THREAD_STACK_SIZE);
+    if (!thread || !stack) {
+        kfree(thread);
+        kfree(stack);
+        return NULL;
+    }
+    memset(thread, 0, sizeof(thread_t));
+    strncpy(thread->name, name, THREAD_NAME_LENGTH);
+    thread->priority = priority;
+    thread->stack = stack;
+    thread->entry = entry;
+    thread->arg = arg;
+
+    // What thread_switch pops: edi, esi, ebx, ebp, then its return address
+    uint32_t* sp = (uint32_t*)(((uint32_t)stack + THREAD_STACK_SIZE) & ~0xF);
+    *--sp = 0;                      // thread_start never returns
+    *--sp = (uint32_t)thread_start;
+    for (int i = 0; i < 4; i++) {
+        *--sp = 0;
+    }
+    thread->esp = (uint32_t)sp;
+    return thread;
+}
+
+// Give the thread an ID and append it to the thread list (sched_lock held)
+static void thread_register(thread_t* thread) {
+    thread->id = next_id++;
+    thread->all_next = NULL;
+    thread_t** link = &all_threads;
+    while (*link) {
+        link = &(*link)->all_next;
+    }
+    *link = thread;
+}
+
+void thread_init(const char* name, uint32_t priority) {
+    memset(&boot_thread, 0, sizeof(boot_thread));
+    strncpy(boot_thread.name, name, THREAD_NAME_LENGTH);
+    boot_thread.priority = priority;
+    boot_thread.state = THREAD_RUNNING;
+    boot_thread.slice = THREAD_TIMESLICE_MS;
+    for (int i = 0; i < THREAD_PRIORITIES; i++) {
+        run_queues[i].head = NULL;
+        run_queues[i].tail = NULL;
+    }
+
+    uint32_t irq = spin_lock_irqsave(&sched_lock);
+    thread_register(&boot_thread);
+    current = &boot_thread;
+    spin_unlock_irqrestore(&sched_lock, irq);
+
+    // Never queued: schedule falls back on it when nothing is ready
+    idle_thread = thread_alloc("idle", idle_loop, NULL, THREAD_PRIORITY_LOW);
+    if (idle_thread) {
+        irq = spin_lock_irqsave(&sched_lock);
+        thread_register(idle_thread);
+        idle_thread->state = THREAD_READY;
+        spin_unlock_irqrestore(&sched_lock, irq);
+    }
+}
+
+thread_t* thread_create(const char* name, void (*entry)(void* arg), void* arg, uint32_t priority) {
+    if (!current || !idle_thread || !entry || priority >= THREAD_PRIORITIES) {
+        return NULL;
+    }
+    thread_t* thread = thread_alloc(name, entry, arg, priority);
+    if (!thread) {
+        return NULL;
+    }
+
+    uint32_t irq = spin_lock_irqsave(&sched_lock);
+    thread_register(thread);
+    make_ready(thread);
+    spin_unlock_irqrestore(&sched_lock, irq);
+    return thread;
+}
+
+thread_t* thread_current(void) {
+    return current;
+}
+
+void thread_yield(void) {
+    uint32_t irq = spin_lock_irqsave(&sched_lock);
+    schedule();
+    spin_unlock_irqrestore(&sched_lock, irq);
+}
+
+void thread_exit(void) {
+    spin_lock_irqsave(&sched_lock);
+    thread_t** link = &all_threads;
+    while (*link && *link != current) {
+        link = &(*link)->all_next;
+    }
+    if (*link) {
+        *link = current->all_next;
+    }
+    current->state = THREAD_DEAD;
+    dead_thread = current;
+    schedule();
+    for (;;) {
+        // Never switched back to
+    }
+}
+
+// Sleep timer callback, from the tick interrupt
+static void thread_sleep_done(void* arg) {
+    thread_t* thread = (thread_t*)arg;
+    uint32_t irq = spin_lock_irqsave(&sched_lock);
+    if (thread->state == THREAD_SLEEPING) {
+        make_ready(thread);
+    }
+    spin_unlock_irqrestore(&sched_lock, irq);
+}
+
+int thread_sleep_ms(uint32_t ms) {
+    uint32_t irq = spin_lock_irqsave(&sched_lock);
+    thread_t* self = current;
+    if (!self->kill_pending) {
+        self->state = THREAD_SLEEPING;
+        timer_setup(&self->sleep_timer, thread_sleep_done, self);
+        timer_schedule(&self->sleep_timer, ms);
+        schedule();
+    }
+    int killed = self->kill_pending;
+    spin_unlock_irqrestore(&sched_lock, irq);
+    return killed ? -1 : 0;
+}
+
+int thread_kill(uint32_t id) {
+    uint32_t irq = spin_lock_irqsave(&sched_lock);
+    thread_t* thread = all_threads;
+    while (thread && thread->id != id) {
+        thread = thread->all_next;
+    }
+    if (!thread || thread == &boot_thread || thread == idle_thread) {
+        spin_unlock_irqrestore(&sched_lock, irq);
+        return -1;
+    }
+
+    thread->kill_pending = 1;
+    if (thread->state == THREAD_SLEEPING) {
+        timer_cancel(&thread->sleep_timer);
+        make_ready(thread);
+    } else if (thread->state == THREAD_BLOCKED && thread->waiting_on) {
+        queue_remove(thread->waiting_on, thread);
+        make_ready(thread);
+    }
+    spin_unlock_irqrestore(&sched_lock, irq);
+    return 0;
+}
+
+int thread_should_exit(void) {
+    return current && current->kill_pending;
+}
+
+uint32_t thread_list(thread_info_t* info, uint32_t max) {
+    uint32_t count = 0;
+    uint32_t irq = spin_lock_irqsave(&sched_lock);
+    for (thread_t* thread = all_threads; thread && count < max; thread = thread->all_next) {
+        info[count].id = thread->id;
+        strncpy(info[count].name, thread->name, THREAD_NAME_LENGTH);
+        info[count].state = thread->state;
+        info[count].priority = thread->priority;
+        info[count].ticks = thread->ticks;
+        count++;
+    }
+    spin_unlock_irqrestore(&sched_lock, irq);
+    return count;
+}
+
+const char* thread_state_name(thread_state_t state) {
+    return state <= THREAD_DEAD ? state_names[state] : "?";
+}
+
+uint32_t thread_get_switches(void) {
+    return switches;
+}
+
+// Tick on the boot CPU: charge the running thread and end its turn
+void thread_tick(void) {
+    if (!current) {
+        return;
+    }
+    current->ticks++;
+    if (current->slice && --current->slice == 0) {
+        need_resched = 1;
+    }
+}
+
+// Last thing interrupt_dispatch does for device and local APIC interrupts,
+// after the EOI. Switching here leaves the interrupted thread's frame on
+// its own stack until it runs again and returns from the interrupt.
+void thread_preempt(void) {
+    if (!current || current == idle_thread || cpu_current()->index != 0) {
+        return;
+    }
+    if (current->kill_pending && current->mutexes_held == 0) {
+        thread_exit();
+    }
+    if (!need_resched) {
+        return;
+    }
+    spin_lock(&sched_lock);
+    schedule();
+    spin_unlock(&sched_lock);
+}
+
+int wait_queue_wait(wait_queue_t* queue, int (*ready)(void* arg), void* arg) {
+    uint32_t irq = spin_lock_irqsave(&sched_lock);
+    thread_t* self = current;
+    while (!ready(arg) && !self->kill_pending) {
+        self->state = THREAD_BLOCKED;
+        self->waiting_on = queue;
+        queue_push(queue, self);
+        schedule();
+    }
+    int killed = self->kill_pending;
+    spin_unlock_irqrestore(&sched_lock, irq);
+    return killed ? -1 : 0;
+}
+
+void wait_queue_wake_one(wait_queue_t* queue) {
+    uint32_t irq = spin_lock_irqsave(&sched_lock);
+    thread_t* thread = queue_pop(queue);
+    if (thread) {
+        make_ready(thread);
+    }
+    spin_unlock_irqrestore(&sched_lock, irq);
+}
+
+void wait_queue_wake_all(wait_queue_t* queue) {
+    uint32_t irq = spin_lock_irqsave(&sched_lock);
+    thread_t* thread;
+    while ((thread = queue_pop(queue))) {
+        make_ready(thread);
+    }
+    spin_unlock_irqrestore(&sched_lock, irq);
+}
+
+// Mutex waits cannot be interrupted by thread_kill, so the holder always
+// finds its data as it left it
+void mutex_lock(mutex_t* mutex) {
+    uint32_t irq = spin_lock_irqsave(&sched_lock);
+    while (mutex->locked) {
+        current->state = THREAD_BLOCKED;
+        queue_push(&mutex->waiters, current);
+        schedule();
+    }
+    mutex->locked = 1;
+    mutex->owner = current;
+    if (current) {
+        current->mutexes_held++;
+    }
+    spin_unlock_irqrestore(&sched_lock, irq);
+}
+
+void mutex_unlock(mutex_t* mutex) {
+    uint32_t irq = spin_lock_irqsave(&sched_lock);
+    mutex->locked = 0;
+    mutex->owner = NULL;
+    if (current) {
+        current->mutexes_held--;
+    }
+    thread_t* thread = queue_pop(&mutex->waiters);
+    if (thread) {
+        make_ready(thread);
+    }
+    spin_unlock_irqrestore(&sched_lock, irq);
+}
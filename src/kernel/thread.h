@@ -0,0 +1,110 @@
+#ifndef THREAD_H
+#define THREAD_H
+
+#include "kernel.h"
+#include "timer.h"
+
+#define THREAD_NAME_LENGTH 16
+#define THREAD_STACK_SIZE 16384
+#define THREAD_TIMESLICE_MS 10      // Ticks a thread runs before others of its priority get a turn
+
+// Priorities: the highest one with a ready thread always runs first
+#define THREAD_PRIORITY_LOW 0
+#define THREAD_PRIORITY_NORMAL 1
+#define THREAD_PRIORITY_HIGH 2
+#define THREAD_PRIORITIES 3
+
+typedef enum {
+    THREAD_READY,
+    THREAD_RUNNING,
+    THREAD_BLOCKED,                 // On a wait queue or a mutex
+    THREAD_SLEEPING,                // Until its sleep timer fires
+    THREAD_DEAD                     // Exited; freed once another thread runs
+} thread_state_t;
+
+struct wait_queue;
+
+typedef struct thread {
+    uint32_t id;
+    char name[THREAD_NAME_LENGTH];
+    thread_state_t state;
+    uint32_t priority;
+    uint32_t esp;                   // Saved stack pointer while switched out
+    void* stack;                    // NULL for the boot thread
+    void (*entry)(void* arg);
+    void* arg;
+    uint32_t slice;                 // Ticks left in this turn
+    uint32_t ticks;                 // Ticks spent running
+    volatile int kill_pending;
+    uint32_t mutexes_held;          // A killed thread exits only holding none
+    struct wait_queue* waiting_on;  // Interruptible wait, NULL otherwise
+    timer_t sleep_timer;
+    struct thread* next;            // Run queue or wait queue link
+    struct thread* all_next;        // Every live thread, for ps
+} thread_t;
+
+typedef struct wait_queue {
+    thread_t* head;
+    thread_t* tail;
+} wait_queue_t;
+
+#define WAIT_QUEUE_INIT { NULL, NULL }
+
+// What ps shows of a thread
+typedef struct {
+    uint32_t id;
+    char name[THREAD_NAME_LENGTH];
+    thread_state_t state;
+    uint32_t priority;
+    uint32_t ticks;
+} thread_info_t;
+
+// Sleeping lock; threads waiting for it block instead of spinning
+typedef struct {
+    volatile int locked;
+    thread_t* owner;
+    wait_queue_t waiters;
+} mutex_t;
+
+#define MUTEX_INIT { 0, NULL, WAIT_QUEUE_INIT }
+
+// Preemptive kernel threads on the boot CPU. thread_init turns the caller
+// into the first thread (the shell, which cannot be killed) and creates the
+// idle thread. The tick takes turns between the ready threads of the
+// highest priority; a thread switch happens on the way out of an interrupt
+// or when a thread blocks, sleeps, yields or exits.
+void thread_init(const char* name, uint32_t priority);
+thread_t* thread_create(const char* name, void (*entry)(void* arg), void* arg, uint32_t priority);
+thread_t* thread_current(void);
+void thread_yield(void);
+void thread_exit(void) __attribute__((noreturn));
+
+// Sleep for `ms` milliseconds; -1 if woken early by thread_kill
+int thread_sleep_ms(uint32_t ms);
+
+// Ask thread `id` to exit: a sleeping or waiting thread wakes with -1, a
+// running one exits at its next preemption if it holds no mutex. -1 for
+// an unknown thread, the first thread or the idle thread.
+int thread_kill(uint32_t id);
+int thread_should_exit(void);
+
+// Snapshot of up to `max` live threads, in creation order; returns how many
+uint32_t thread_list(thread_info_t* info, uint32_t max);
+const char* thread_state_name(thread_state_t state);
+uint32_t thread_get_switches(void);
+
+// Called from the tick and on the way out of interrupts (boot CPU only)
+void thread_tick(void);
+void thread_preempt(void);
+
+// Block until `ready(arg)` is true. Whoever makes it true must then call
+// wait_queue_wake_*; the check is repeated under the scheduler lock, so
+// the wakeup cannot be missed. -1 if the thread was killed meanwhile.
+int wait_queue_wait(wait_queue_t* queue, int (*ready)(void* arg), void* arg);
+void wait_queue_wake_one(wait_queue_t* queue);
+void wait_queue_wake_all(wait_queue_t* queue);
+
+void mutex_lock(mutex_t* mutex);
+void mutex_unlock(mutex_t* mutex);
+
+#endif // THREAD_H
@@ -0,0 +1,300 @@
+// PhantomOS Timer Subsystem
+// The local APIC timer interrupts TIMER_HZ times a second, or the PIT where
+// there is no APIC (or no TSC to calibrate it). Time itself comes from the
+// TSC, calibrated against the PIT at boot, so ticks lost while interrupts
+// are off (long disk transfers during boot) do not slow the clock; without
+// a TSC the clock counts PIT ticks. The RTC is read once for wall-clock
+// time. Deferred callbacks live on a hashed timer wheel with one slot per
+// millisecond, advanced to the clock on every tick of the boot CPU; other
+// CPUs only count their own local APIC timer ticks.
+
+#include "timer.h"
+#include "rtc.h"
+#include "idt.h"
+#include "apic.h"
+#include "smp.h"
+#include "thread.h"
+#include "spinlock.h"
+#include "io.h"
+
+// PIT ports and commands
+#define PIT_CHANNEL0 0x40
+#define PIT_CHANNEL2 0x42
+#define PIT_COMMAND 0x43
+#define PIT_CH0_RATE_GENERATOR 0x34   // Channel 0, low/high byte, mode 2
+#define PIT_CH2_ONE_SHOT 0xB0         // Channel 2, low/high byte, mode 0
+#define PIT_DIVISOR ((PIT_FREQUENCY + TIMER_HZ / 2) / TIMER_HZ)
+#define PIT_TICK_NS ((uint32_t)(PIT_DIVISOR * 1000000000ULL / PIT_FREQUENCY))
+
+// Port 0x61 controls the channel 2 gate and reports its output
+#define PIT_GATE_PORT 0x61
+#define PIT_GATE2 0x01
+#define PIT_SPEAKER 0x02
+#define PIT_OUT2 0x20
+
+#define TIMER_IRQ 0
+
+#define TSC_CALIBRATE_MS 50
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+
+static volatile uint64_t ticks = 0;
+static uint64_t tsc_base = 0;
+static uint32_t tsc_khz = 0;
+static uint32_t boot_time = 0;
+static int lapic_tick = 0;
+static uint32_t timers_fired = 0;
+static uint32_t timers_pending = 0;
+
+static timer_t* wheel[TIMER_WHEEL_SLOTS];
+static uint64_t wheel_time = 0;    // Last millisecond the wheel has run
+static spinlock_t wheel_lock = SPINLOCK_INIT;
+
+static void timer_irq_handler(interrupt_frame_t* frame);
+
+static inline uint64_t rdtsc(void) {
+    uint32_t low, high;
+    asm volatile ("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t)high << 32) | low;
+}
+
+// 64-by-32 bit division (there is no libgcc to do it for us)
+uint64_t div64_32(uint64_t dividend, uint32_t divisor, uint32_t* remainder) {
+    uint32_t high = (uint32_t)(dividend >> 32);
+    uint32_t low = (uint32_t)dividend;
+    uint32_t quotient_high = high / divisor;
+    uint32_t quotient_low, rem;
+
+    high %= divisor;
+    asm ("divl %4" : "=a"(quotient_low), "=d"(rem) : "a"(low), "d"(high), "rm"(divisor));
+    if (remainder) {
+        *remainder = rem;
+    }
+    return ((uint64_t)quotient_high << 32) | quotient_low;
+}
+
+static int cpu_has_tsc(void) {
+    // CPUID exists if the ID flag (bit 21) in EFLAGS can be toggled
+    uint32_t before, after;
+    asm volatile ("pushf; pop %0; mov %0, %1; xor $0x200000, %1; push %1; popf; pushf; pop %1; push %0; popf"
+                  : "=&r"(before), "=&r"(after));
+    if (!((before ^ after) & 0x200000)) {
+        return 0;
+    }
+
+    uint32_t eax = 1, ebx, ecx, edx;
+    asm volatile ("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    return (edx & 0x10) != 0;
+}
+
+// Count TSC cycles over TSC_CALIBRATE_MS of PIT channel 2; 0 on failure
+static uint32_t tsc_calibrate(void) {
+    uint32_t count = PIT_FREQUENCY * TSC_CALIBRATE_MS / 1000;
+
+    // Gate channel 2 on with the speaker disconnected, then load the count
+    outb(PIT_GATE_PORT, (inb(PIT_GATE_PORT) & ~PIT_SPEAKER) | PIT_GATE2);
+    outb(PIT_COMMAND, PIT_CH2_ONE_SHOT);
+    outb(PIT_CHANNEL2, count & 0xFF);
+    outb(PIT_CHANNEL2, count >> 8);
+
+    uint64_t start = rdtsc();
+    uint32_t polls = 0;
+    while (!(inb(PIT_GATE_PORT) & PIT_OUT2)) {
+        if (++polls > 10000000) {
+            return 0;   // Channel 2 never finished - no usable PIT gate
+        }
+    }
+    uint64_t cycles = rdtsc() - start;
+
+    outb(PIT_GATE_PORT, inb(PIT_GATE_PORT) & ~PIT_GATE2);
+    return (uint32_t)div64_32(cycles, TSC_CALIBRATE_MS, NULL);
+}
+
+void timer_init(void) {
+    ticks = 0;
+    timers_fired = 0;
+    timers_pending = 0;
+    wheel_time = 0;
+    memset(wheel, 0, sizeof(wheel));
+
+    tsc_khz = cpu_has_tsc() ? tsc_calibrate() : 0;
+    tsc_base = tsc_khz ? rdtsc() : 0;
+
+    rtc_time_t now;
+    boot_time = rtc_read(&now) == 0 ? rtc_to_unix(&now) : 0;
+
+    // Tick interrupt; calibrating the local APIC timer needs the TSC clock
+    lapic_tick = tsc_khz && apic_enabled() &&
+                 interrupt_register(LAPIC_TIMER_VECTOR, timer_irq_handler, "lapic timer") == 0 &&
+                 lapic_timer_start(TIMER_HZ) == 0;
+    if (!lapic_tick) {
+        outb(PIT_COMMAND, PIT_CH0_RATE_GENERATOR);
+        outb(PIT_CHANNEL0, PIT_DIVISOR & 0xFF);
+        outb(PIT_CHANNEL0, PIT_DIVISOR >> 8);
+        irq_register(TIMER_IRQ, timer_irq_handler, "timer");
+    }
+}
+
+// Nanoseconds since timer_init
+uint64_t timer_monotonic_ns(void) {
+    if (!tsc_khz) {
+        // A 64-bit read is two loads; retry if a tick landed in between
+        uint64_t now;
+        do {
+            now = ticks;
+        } while (now != ticks);
+        return now * PIT_TICK_NS;
+    }
+
+    uint32_t rest;
+    uint64_t ms = div64_32(rdtsc() - tsc_base, tsc_khz, &rest);
+    return ms * 1000000 + (uint32_t)div64_32((uint64_t)rest * 1000000, tsc_khz, NULL);
+}
+
+static uint64_t timer_monotonic_ms(void) {
+    return div64_32(timer_monotonic_ns(), 1000000, NULL);
+}
+
+uint32_t timer_uptime_ms(void) {
+    return (uint32_t)timer_monotonic_ms();
+}
+
+// Seconds since 1970: the RTC at boot plus the monotonic clock
+uint32_t timer_wall_clock(void) {
+    return boot_time + (uint32_t)div64_32(timer_monotonic_ns(), 1000000000, NULL);
+}
+
+static void timer_unlink(timer_t* timer) {
+    if (timer->prev) {
+        timer->prev->next = timer->next;
+    } else {
+        wheel[timer->expires & TIMER_WHEEL_MASK] = timer->next;
+    }
+    if (timer->next) {
+        timer->next->prev = timer->prev;
+    }
+    timer->next = NULL;
+    timer->prev = NULL;
+    timer->pending = 0;
+    timers_pending--;
+}
+
+// Fire everything due up to millisecond `now`. After a long gap (lost
+// ticks) one pass over every slot is enough, since anything due is fired
+// whichever slot it is in; timers a round or more away stay where they are.
+// Callbacks run without wheel_lock, so they can schedule timers.
+static void timer_run_wheel(uint64_t now) {
+    spin_lock(&wheel_lock);
+    if (now - wheel_time > TIMER_WHEEL_SLOTS) {
+        wheel_time = now - TIMER_WHEEL_SLOTS;
+    }
+
+    while (wheel_time < now) {
+        wheel_time++;
+        timer_t* timer = wheel[wheel_time & TIMER_WHEEL_MASK];
+        while (timer) {
+            timer_t* next = timer->next;
+            if (timer->expires <= now) {
+                timer_unlink(timer);
+                timers_fired++;
+                spin_unlock(&wheel_lock);
+                timer->callback(timer->arg);  // May schedule it again
+                spin_lock(&wheel_lock);
+                next = wheel[wheel_time & TIMER_WHEEL_MASK];  // The slot may have changed
+            }
+            timer = next;
+        }
+    }
+    spin_unlock(&wheel_lock);
+}
+
+
+// Tick interrupt on every CPU; the boot CPU keeps time, runs the wheel and
+// charges the running thread
+static void timer_irq_handler(interrupt_frame_t* frame) {
+    cpu_t* cpu = cpu_current();
+    cpu->ticks++;
+    if (cpu->index != 0) {
+        return;
+    }
+    ticks++;
+    timer_run_wheel(timer_monotonic_ms());
+    thread_tick();
+}
+
+// Start the calling CPU's own tick (application processors; the boot CPU
+// gets its tick from timer_init)
+void timer_init_cpu(void) {
+    if (lapic_tick) {
+        lapic_timer_start(TIMER_HZ);
+    }
+}
+
+// Busy-wait; needs the TSC clock or a running tick
+void timer_delay_us(uint32_t us) {
+    uint64_t end = timer_monotonic_ns() + (uint64_t)us * 1000;
+    while (timer_monotonic_ns() < end) {
+        asm volatile ("pause");
+    }
+}
+
+void timer_setup(timer_t* timer, void (*callback)(void* arg), void* arg) {
+    timer->next = NULL;
+    timer->prev = NULL;
+    timer->expires = 0;
+    timer->callback = callback;
+    timer->arg = arg;
+    timer->pending = 0;
+}
+
+// Run the callback once, `delay_ms` from now (rescheduling a pending timer moves it)
+int timer_schedule(timer_t* timer, uint32_t delay_ms) {
+    if (!timer->callback) {
+        return -1;
+    }
+
+    uint32_t irq = spin_lock_irqsave(&wheel_lock);
+    if (timer->pending) {
+        timer_unlink(timer);
+    }
+
+    // Never into a slot the wheel has already passed in this round
+    uint64_t expires = timer_monotonic_ms() + delay_ms;
+    if (expires <= wheel_time) {
+        expires = wheel_time + 1;
+    }
+
+    timer->expires = expires;
+    timer_t** slot = &wheel[expires & TIMER_WHEEL_MASK];
+    timer->prev = NULL;
+    timer->next = *slot;
+    if (*slot) {
+        (*slot)->prev = timer;
+    }
+    *slot = timer;
+    timer->pending = 1;
+    timers_pending++;
+    spin_unlock_irqrestore(&wheel_lock, irq);
+    return 0;
+}
+
+// Stop a pending timer; -1 if it was not pending
+int timer_cancel(timer_t* timer) {
+    uint32_t irq = spin_lock_irqsave(&wheel_lock);
+    int was_pending = timer->pending;
+    if (was_pending) {
+        timer_unlink(timer);
+    }
+    spin_unlock_irqrestore(&wheel_lock, irq);
+    return was_pending ? 0 : -1;
+}
+
+void timer_get_stats(timer_stats_t* stats) {
+    uint32_t irq = spin_lock_irqsave(&wheel_lock);
+    stats->ticks = ticks;
+    stats->tsc_khz = tsc_khz;
+    stats->boot_time = boot_time;
+    stats->tick_source = lapic_tick ? "local APIC timer" : "PIT";
+    stats->fired = timers_fired;
+    stats->pending = timers_pending;
+    spin_unlock_irqrestore(&wheel_lock, irq);
+}
@@ -0,0 +1,51 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include "kernel.h"
+
+// Timer constants
+#define TIMER_HZ 1000               // PIT tick rate; the wheel runs in milliseconds
+#define TIMER_WHEEL_SLOTS 256       // Power of two, one slot per millisecond
+#define PIT_FREQUENCY 1193182
+
+// Deferred callback on the timer wheel. Callbacks run from the timer
+// interrupt with interrupts off, so they must be short.
+typedef struct timer {
+    struct timer* next;
+    struct timer* prev;
+    uint64_t expires;               // Millisecond of the monotonic clock it fires at
+    void (*callback)(void* arg);
+    void* arg;
+    int pending;
+} timer_t;
+
+// Timer statistics
+typedef struct {
+    uint64_t ticks;                 // Timer interrupts taken
+    uint32_t tsc_khz;               // 0 if the clock runs from PIT ticks alone
+    const char* tick_source;
+    uint32_t boot_time;             // Wall-clock seconds at timer_init
+    uint32_t fired;
+    uint32_t pending;
+} timer_stats_t;
+
+// Clocks: local APIC timer (or PIT) tick interrupt, TSC calibrated against
+// the PIT for the monotonic clock (PIT ticks if there is no TSC), RTC for
+// wall-clock time
+void timer_init(void);
+void timer_init_cpu(void);
+void timer_delay_us(uint32_t us);
+uint64_t timer_monotonic_ns(void);
+uint32_t timer_uptime_ms(void);
+uint32_t timer_wall_clock(void);
+void timer_get_stats(timer_stats_t* stats);
+
+// 64-by-32 bit division, with the remainder if `remainder` is not NULL
+uint64_t div64_32(uint64_t dividend, uint32_t divisor, uint32_t* remainder);
+
+// Timer wheel
+void timer_setup(timer_t* timer, void (*callback)(void* arg), void* arg);
+int timer_schedule(timer_t* timer, uint32_t delay_ms);
+int timer_cancel(timer_t* timer);
+
+#endif // TIMER_H
@@ -0,0 +1,67 @@
+; PhantomOS application processor trampoline
+; smp_init copies this code to SMP_TRAMPOLINE_BASE and fills in the
+; parameter block; a STARTUP IPI then starts the processor here in real
+; mode (CS = SMP_TRAMPOLINE_BASE >> 4, IP = 0). It switches to protected
+; mode with a flat GDT of its own and calls smp_ap_main on the given stack.
+; Everything is addressed at its copied location, not where it is linked.
+
+bits 16
+
+global smp_trampoline_start
+global smp_trampoline_end
+global smp_trampoline_params
+
+SMP_TRAMPOLINE_BASE equ 0x7000     ; Must match smp.h
+CODE_SEG equ 0x08
+DATA_SEG equ 0x10
+
+%define TRAMPOLINE(label) (SMP_TRAMPOLINE_BASE + (label) - smp_trampoline_start)
+
+section .text
+
+smp_trampoline_start:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+    lgdt [TRAMPOLINE(trampoline_gdt_descriptor)]
+    mov eax, cr0
+    or eax, 1                       ; Protected mode
+    mov cr0, eax
+    jmp dword CODE_SEG:TRAMPOLINE(trampoline_protected)
+
+bits 32
+trampoline_protected:
+    mov ax, DATA_SEG
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+
+    ; smp_ap_main(cpu index) on the processor's own stack; it never returns
+    mov esp, [TRAMPOLINE(smp_trampoline_params)]
+    push dword [TRAMPOLINE(smp_trampoline_params) + 8]
+    call [TRAMPOLINE(smp_trampoline_params) + 4]
+.halt:
+    cli
+    hlt
+    jmp .halt
+
+; Flat 4GB code and data segments, until smp_ap_main loads the kernel's GDT
+align 8
+trampoline_gdt:
+    dq 0x0000000000000000   ; Null descriptor
+    dq 0x00CF9A000000FFFF   ; Code segment: ring 0, execute/read
+    dq 0x00CF92000000FFFF   ; Data segment: ring 0, read/write
+trampoline_gdt_descriptor:
+    dw trampoline_gdt_descriptor - trampoline_gdt - 1
+    dd TRAMPOLINE(trampoline_gdt)
+
+; Filled in by smp_init for each processor
+align 4
+smp_trampoline_params:
+    dd 0                    ; Stack top
+    dd 0                    ; Entry point (smp_ap_main)
+    dd 0                    ; CPU index
+smp_trampoline_end:
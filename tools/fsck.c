@@ -0,0 +1,347 @@
+// PhantomFS fsck
+// Checks the PhantomFS volume of a PhantomOS disk image: the directory tree,
+// inodes, block pointers and the block bitmap. With -r it clears bad entries
+// and pointers, frees orphaned inodes and rebuilds the bitmap.
+// Usage: fsck.pfs [-r] <image>
+// Exit status: 0 clean, 1 errors repaired, 4 errors left
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/kernel/pfs.h"
+
+#define BLOCK(n) (volume + (size_t)(n) * PFS_BLOCK_SIZE)
+
+static uint8_t* volume;
+static pfs_superblock_t* sb;
+static uint8_t* used_blocks;    // Blocks referenced by reachable inodes
+static uint8_t* reached;        // Inodes linked from the tree
+static int repair = 0;
+static int errors = 0;
+
+static int test_bit(const uint8_t* map, uint32_t bit) {
+    return (map[bit / 8] >> (bit % 8)) & 1;
+}
+
+static void set_bit(uint8_t* map, uint32_t bit) {
+    map[bit / 8] |= (uint8_t)(1 << (bit % 8));
+}
+
+static void problem(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+    errors++;
+}
+
+static pfs_inode_t* inode_at(uint32_t number) {
+    return (pfs_inode_t*)BLOCK(sb->inode_start + number / PFS_INODES_PER_BLOCK) +
+           number % PFS_INODES_PER_BLOCK;
+}
+
+static int check_superblock(long image_blocks) {
+    if (sb->magic != PFS_MAGIC || sb->version != PFS_VERSION || sb->block_size != PFS_BLOCK_SIZE) {
+        return -1;
+    }
+    if (sb->total_blocks > image_blocks - PFS_START_LBA || sb->bitmap_start == 0 ||
+        sb->bitmap_start >= sb->total_blocks || sb->bitmap_blocks > sb->total_blocks ||
+        sb->inode_blocks > sb->total_blocks ||
+        sb->inode_start < sb->bitmap_start + sb->bitmap_blocks ||
+        sb->data_start < sb->inode_start + sb->inode_blocks ||
+        sb->data_start >= sb->total_blocks) {
+        return -1;
+    }
+    if (sb->bitmap_blocks < (sb->total_blocks + PFS_BITS_PER_BLOCK - 1) / PFS_BITS_PER_BLOCK ||
+        sb->inode_count > sb->inode_blocks * PFS_INODES_PER_BLOCK ||
+        sb->root_inode == 0 || sb->root_inode >= sb->inode_count) {
+        return -1;
+    }
+    return 0;
+}
+
+// Check one block pointer of inode `number`. `depth` is 0 for a data block,
+// 1 for a table of data blocks and 2 for a table of tables; `index` is the
+// first file block the pointer covers and `limit` the file's block count.
+static void check_pointer(uint32_t number, uint32_t* slot, int depth, uint32_t index, uint32_t limit) {
+    uint32_t block = *slot;
+    const char* reason = NULL;
+
+    if (block == 0) {
+        return;
+    }
+    if (index >= limit) {
+        reason = "past end of file";
+    } else if (block < sb->data_start || block >= sb->total_blocks) {
+        reason = "out of range";
+    } else if (test_bit(used_blocks, block)) {
+        reason = "already in use";
+    }
+
+    if (reason) {
+        problem("inode %u: block %u %s\n", number, block, reason);
+        if (repair) {
+            *slot = 0;
+        }
+        return;
+    }
+
+    set_bit(used_blocks, block);
+    if (depth > 0) {
+        uint32_t* pointers = (uint32_t*)BLOCK(block);
+        uint32_t span = depth == 2 ? PFS_PTRS_PER_BLOCK : 1;
+        for (uint32_t i = 0; i < PFS_PTRS_PER_BLOCK; i++) {
+            check_pointer(number, &pointers[i], depth - 1, index + i * span, limit);
+        }
+    }
+}
+
+static void check_inode(uint32_t number) {
+    pfs_inode_t* inode = inode_at(number);
+
+    if (inode->type == PFS_TYPE_DIR && inode->size % sizeof(pfs_dirent_t) != 0) {
+        problem("inode %u: directory size %u is not a whole number of entries\n", number, inode->size);
+        if (repair) {
+            inode->size -= inode->size % sizeof(pfs_dirent_t);
+        }
+    }
+
+    uint32_t limit = (uint32_t)(((uint64_t)inode->size + PFS_BLOCK_SIZE - 1) / PFS_BLOCK_SIZE);
+    if (limit > PFS_MAX_FILE_BLOCKS) {
+        problem("inode %u: size %u is larger than PhantomFS supports\n", number, inode->size);
+        limit = PFS_MAX_FILE_BLOCKS;
+    }
+
+    for (uint32_t i = 0; i < PFS_DIRECT_BLOCKS; i++) {
+        check_pointer(number, &inode->direct[i], 0, i, limit);
+    }
+    check_pointer(number, &inode->indirect, 1, PFS_DIRECT_BLOCKS, limit);
+    check_pointer(number, &inode->double_indirect, 2, PFS_DIRECT_BLOCKS + PFS_PTRS_PER_BLOCK, limit);
+}
+
+// Map file block `index` to a disk block, or 0 if unmapped or invalid
+static uint32_t map_block(pfs_inode_t* inode, uint32_t index) {
+    uint32_t table;
+
+    if (index < PFS_DIRECT_BLOCKS) {
+        table = inode->direct[index];
+        return table < sb->total_blocks ? table : 0;
+    }
+
+    index -= PFS_DIRECT_BLOCKS;
+    if (index < PFS_PTRS_PER_BLOCK) {
+        table = inode->indirect;
+    } else {
+        index -= PFS_PTRS_PER_BLOCK;
+        table = inode->double_indirect;
+        if (index >= PFS_PTRS_PER_BLOCK * PFS_PTRS_PER_BLOCK || table == 0 || table >= sb->total_blocks) {
+            return 0;
+        }
+        table = ((uint32_t*)BLOCK(table))[index / PFS_PTRS_PER_BLOCK];
+        index %= PFS_PTRS_PER_BLOCK;
+    }
+
+    if (table == 0 || table >= sb->total_blocks) {
+        return 0;
+    }
+    uint32_t block = ((uint32_t*)BLOCK(table))[index];
+    return block < sb->total_blocks ? block : 0;
+}
+
+static pfs_dirent_t* dirent_at(pfs_inode_t* dir, uint32_t slot) {
+    uint32_t block = map_block(dir, slot / PFS_DIRENTS_PER_BLOCK);
+    if (block == 0) {
+        return NULL;
+    }
+    return (pfs_dirent_t*)BLOCK(block) + slot % PFS_DIRENTS_PER_BLOCK;
+}
+
+// Check a directory's entries, queueing subdirectories
+static void check_directory(uint32_t number, uint32_t* queue, uint32_t* queue_tail) {
+    pfs_inode_t* dir = inode_at(number);
+    uint32_t slots = dir->size / sizeof(pfs_dirent_t);
+
+    for (uint32_t slot = 0; slot < slots; slot++) {
+        pfs_dirent_t* entry = dirent_at(dir, slot);
+        if (!entry) {
+            problem("directory inode %u: entry block %u missing\n", number, slot / PFS_DIRENTS_PER_BLOCK);
+            slot += PFS_DIRENTS_PER_BLOCK - 1 - slot % PFS_DIRENTS_PER_BLOCK;
+            continue;
+        }
+        if (entry->inode == 0) {
+            continue;
+        }
+
+        const char* reason = NULL;
+        size_t length = strnlen(entry->name, PFS_NAME_LENGTH);
+        if (length == 0 || length == PFS_NAME_LENGTH || strchr(entry->name, '/') ||
+            strcmp(entry->name, ".") == 0 || strcmp(entry->name, "..") == 0) {
+            reason = "has an invalid name";
+        } else if (entry->inode >= sb->inode_count ||
+                   (inode_at(entry->inode)->type != PFS_TYPE_FILE &&
+                    inode_at(entry->inode)->type != PFS_TYPE_DIR)) {
+            reason = "points to a free or invalid inode";
+        } else if (test_bit(reached, entry->inode)) {
+            reason = "links an inode that is already linked";
+        } else {
+            for (uint32_t other = 0; other < slot && !reason; other++) {
+                pfs_dirent_t* earlier = dirent_at(dir, other);
+                if (earlier && earlier->inode != 0 && strncmp(earlier->name, entry->name, PFS_NAME_LENGTH) == 0) {
+                    reason = "duplicates an earlier name";
+                }
+            }
+        }
+
+        if (reason) {
+            problem("directory inode %u: entry '%.*s' (inode %u) %s\n",
+                    number, PFS_NAME_LENGTH, entry->name, entry->inode, reason);
+            if (repair) {
+                memset(entry, 0, sizeof(pfs_dirent_t));
+            }
+            continue;
+        }
+
+        set_bit(reached, entry->inode);
+        check_inode(entry->inode);
+        if (inode_at(entry->inode)->type == PFS_TYPE_DIR) {
+            queue[(*queue_tail)++] = entry->inode;
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    const char* path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-r") == 0) {
+            repair = 1;
+        } else if (!path) {
+            path = argv[i];
+        } else {
+            path = NULL;
+            break;
+        }
+    }
+    if (!path) {
+        fprintf(stderr, "usage: %s [-r] <image>\n", argv[0]);
+        return 8;
+    }
+
+    FILE* image = fopen(path, repair ? "r+b" : "rb");
+    if (!image) {
+        perror(path);
+        return 8;
+    }
+
+    fseek(image, 0, SEEK_END);
+    long image_blocks = ftell(image) / PFS_BLOCK_SIZE;
+    if (image_blocks <= PFS_START_LBA) {
+        fprintf(stderr, "%s: image has no room for a PhantomFS volume\n", path);
+        return 8;
+    }
+
+    // Read the whole volume into memory
+    size_t volume_bytes = (size_t)(image_blocks - PFS_START_LBA) * PFS_BLOCK_SIZE;
+    volume = malloc(volume_bytes);
+    if (!volume || fseek(image, (long)PFS_START_LBA * PFS_BLOCK_SIZE, SEEK_SET) != 0 ||
+        fread(volume, volume_bytes, 1, image) != 1) {
+        fprintf(stderr, "%s: read failed\n", path);
+        return 8;
+    }
+
+    sb = (pfs_superblock_t*)volume;
+    if (check_superblock(image_blocks) != 0) {
+        printf("%s: no valid PhantomFS superblock\n", path);
+        return 4;
+    }
+
+    used_blocks = calloc((sb->total_blocks + 7) / 8, 1);
+    reached = calloc((sb->inode_count + 7) / 8, 1);
+    uint32_t* queue = malloc(sb->inode_count * sizeof(uint32_t));
+    if (!used_blocks || !reached || !queue) {
+        return 8;
+    }
+
+    // Walk the tree breadth-first from the root
+    pfs_inode_t* root = inode_at(sb->root_inode);
+    if (root->type != PFS_TYPE_DIR) {
+        printf("%s: root inode %u is not a directory\n", path, sb->root_inode);
+        return 4;
+    }
+
+    uint32_t queue_head = 0;
+    uint32_t queue_tail = 0;
+    set_bit(reached, sb->root_inode);
+    check_inode(sb->root_inode);
+    queue[queue_tail++] = sb->root_inode;
+    while (queue_head < queue_tail) {
+        check_directory(queue[queue_head++], queue, &queue_tail);
+    }
+
+    // Inodes in use that nothing links to
+    uint32_t files = 0;
+    for (uint32_t number = 1; number < sb->inode_count; number++) {
+        pfs_inode_t* inode = inode_at(number);
+        if (test_bit(reached, number)) {
+            files++;
+        } else if (inode->type != PFS_TYPE_FREE) {
+            problem("inode %u is in use but not linked from any directory\n", number);
+            if (repair) {
+                memset(inode, 0, sizeof(pfs_inode_t));
+            }
+        }
+    }
+
+    // Compare the bitmap with the blocks actually referenced
+    uint8_t* bitmap = BLOCK(sb->bitmap_start);
+    uint32_t leaked = 0;
+    uint32_t missing = 0;
+    uint32_t used = 0;
+    for (uint32_t block = 0; block < sb->total_blocks; block++) {
+        int expected = block < sb->data_start || test_bit(used_blocks, block);
+        int marked = test_bit(bitmap, block);
+        used += expected;
+        if (marked && !expected) {
+            leaked++;
+        } else if (!marked && expected) {
+            missing++;
+        }
+    }
+    if (leaked) {
+        problem("bitmap: %u blocks marked used but not referenced\n", leaked);
+    }
+    if (missing) {
+        problem("bitmap: %u referenced blocks marked free\n", missing);
+    }
+    if (repair && (leaked || missing)) {
+        for (uint32_t block = 0; block < sb->total_blocks; block++) {
+            if (block < sb->data_start || test_bit(used_blocks, block)) {
+                set_bit(bitmap, block);
+            } else {
+                bitmap[block / 8] &= (uint8_t)~(1 << (block % 8));
+            }
+        }
+    }
+
+    printf("%s: %u files and directories, %u / %u blocks used, %d problem%s\n",
+           path, files, used, sb->total_blocks, errors, errors == 1 ? "" : "s");
+
+    if (errors == 0) {
+        return 0;
+    }
+    if (!repair) {
+        return 4;
+    }
+
+    if (fseek(image, (long)PFS_START_LBA * PFS_BLOCK_SIZE, SEEK_SET) != 0 ||
+        fwrite(volume, (size_t)sb->total_blocks * PFS_BLOCK_SIZE, 1, image) != 1 ||
+        fclose(image) != 0) {
+        fprintf(stderr, "%s: write failed\n", path);
+        return 4;
+    }
+    printf("%s: repaired\n", path);
+    return 1;
+}
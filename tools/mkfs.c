@@ -0,0 +1,91 @@
+// PhantomFS mkfs
+// Formats the part of a PhantomOS disk image after the kernel as an empty
+// PhantomFS volume. Usage: mkfs.pfs <image>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/kernel/pfs.h"
+
+#define MIN_BLOCKS 64
+
+static int write_block(FILE* image, uint32_t block, const void* data) {
+    long offset = (long)(PFS_START_LBA + block) * PFS_BLOCK_SIZE;
+    return fseek(image, offset, SEEK_SET) == 0 && fwrite(data, PFS_BLOCK_SIZE, 1, image) == 1 ? 0 : -1;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <image>\n", argv[0]);
+        return 2;
+    }
+
+    FILE* image = fopen(argv[1], "r+b");
+    if (!image) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    fseek(image, 0, SEEK_END);
+    long image_size = ftell(image);
+    if (image_size < (long)(PFS_START_LBA + MIN_BLOCKS) * PFS_BLOCK_SIZE) {
+        fprintf(stderr, "%s: image too small for a PhantomFS volume\n", argv[1]);
+        fclose(image);
+        return 1;
+    }
+
+    // Lay out the volume: superblock, bitmap, inode table, data
+    pfs_superblock_t sb;
+    memset(&sb, 0, sizeof(sb));
+    sb.magic = PFS_MAGIC;
+    sb.version = PFS_VERSION;
+    sb.block_size = PFS_BLOCK_SIZE;
+    sb.total_blocks = (uint32_t)(image_size / PFS_BLOCK_SIZE) - PFS_START_LBA;
+    sb.bitmap_start = 1;
+    sb.bitmap_blocks = (sb.total_blocks + PFS_BITS_PER_BLOCK - 1) / PFS_BITS_PER_BLOCK;
+    sb.inode_count = sb.total_blocks / PFS_BLOCKS_PER_INODE;
+    sb.inode_start = sb.bitmap_start + sb.bitmap_blocks;
+    sb.inode_blocks = (sb.inode_count + PFS_INODES_PER_BLOCK - 1) / PFS_INODES_PER_BLOCK;
+    sb.inode_count = sb.inode_blocks * PFS_INODES_PER_BLOCK; // Use the whole table
+    sb.data_start = sb.inode_start + sb.inode_blocks;
+    sb.root_inode = PFS_ROOT_INODE;
+
+    uint8_t block[PFS_BLOCK_SIZE];
+    int failed = write_block(image, 0, &sb);
+
+    // Metadata blocks are marked used in the bitmap
+    uint8_t* bitmap = calloc(sb.bitmap_blocks, PFS_BLOCK_SIZE);
+    if (!bitmap) {
+        fclose(image);
+        return 1;
+    }
+    for (uint32_t i = 0; i < sb.data_start; i++) {
+        bitmap[i / 8] |= (uint8_t)(1 << (i % 8));
+    }
+    for (uint32_t i = 0; i < sb.bitmap_blocks && !failed; i++) {
+        failed = write_block(image, sb.bitmap_start + i, &bitmap[i * PFS_BLOCK_SIZE]);
+    }
+    free(bitmap);
+
+    // Empty inode table apart from the root directory
+    for (uint32_t i = 0; i < sb.inode_blocks && !failed; i++) {
+        memset(block, 0, sizeof(block));
+        if (i == sb.root_inode / PFS_INODES_PER_BLOCK) {
+            pfs_inode_t* root = (pfs_inode_t*)block + sb.root_inode % PFS_INODES_PER_BLOCK;
+            root->type = PFS_TYPE_DIR;
+        }
+        failed = write_block(image, sb.inode_start + i, block);
+    }
+
+    if (fclose(image) != 0 || failed) {
+        fprintf(stderr, "%s: write failed\n", argv[1]);
+        return 1;
+    }
+
+    printf("%s: PhantomFS with %u blocks (%u KB), %u inodes, data from block %u\n",
+           argv[1], sb.total_blocks, sb.total_blocks * PFS_BLOCK_SIZE / 1024,
+           sb.inode_count - 1, sb.data_start);
+    return 0;
+}